@@ -143,6 +143,12 @@
  * Does not return a status.
  */
 
+/**
+ * \def fsw_memmove(dest,src,size)
+ * Copies a block of memory from \a src to \a dest. The two memory blocks
+ * may overlap. Does not return a status.
+ */
+
 /**
  * \def fsw_memeq(dest,src,size)
  * Compares two blocks of memory for equality. Returns boolean true if the
@@ -40,6 +40,24 @@
 //#define DPRINT(x...)  Print(x)
 
 #include "fsw_core.h"
+
+/* SIMD kernels for rebuilding degraded RAID5/6 data. The x86_64 ones are
+   written with compiler builtins and need no headers; the NEON ones need
+   <arm_neon.h>, which comes before the type macros below, so firmware builds
+   only get them when they ask for BTRFS_RAID_SIMD.  */
+#ifndef BTRFS_RAID_SIMD
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BTRFS_RAID_SIMD 1
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON) && defined(HOST_POSIX)
+#define BTRFS_RAID_SIMD 1
+#else
+#define BTRFS_RAID_SIMD 0
+#endif
+#endif
+#if BTRFS_RAID_SIMD && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #define uint8_t fsw_u8
 #define uint16_t fsw_u16
 #define uint32_t fsw_u32
@@ -127,7 +145,11 @@ struct btrfs_header
 {
     btrfs_checksum_t checksum;
     btrfs_uuid_t uuid;
-    uint8_t dummy[0x30];
+    uint64_t bytenr;
+    uint64_t flags;
+    btrfs_uuid_t chunk_tree_uuid;
+    uint64_t generation;
+    uint64_t owner;
     uint32_t nitems;
     uint8_t level;
 } __attribute__ ((__packed__));
@@ -138,13 +160,106 @@ struct fsw_btrfs_device_desc
     uint64_t id;
 };
 
-#define RECOVER_CACHE_SIZE 17
+/* Sectors rebuilt from the parity of a degraded RAID5/6 chunk.  */
+#ifndef BTRFS_RECOVER_CACHE_SIZE
+#define BTRFS_RECOVER_CACHE_SIZE 256
+#endif
+#define BTRFS_RECOVER_HASH_SIZE 64
+
+/* Block kernels for rebuilding RAID5/6 data, picked for the CPU at mount.
+   Sizes are multiples of 64 bytes.  */
+struct fsw_btrfs_raid_ops
+{
+    const char *name;
+    void (*xor_block) (char *dst, const char *src, uint32_t size);
+    void (*mulx) (unsigned mul, char *buf, uint32_t size);
+    void (*mulx_xor) (char *dst, unsigned mul, const char *buf, uint32_t size);
+};
+
 struct fsw_btrfs_recover_cache
 {
+    struct fsw_btrfs_recover_cache *hash_next;
     uint64_t device_id;
     uint64_t offset;
     char *buffer;
     BOOLEAN valid;
+    BOOLEAN referenced;             //!< Used since the CLOCK hand last passed
+};
+
+/* One chunk of the chunk tree, as loaded at mount time. */
+struct fsw_btrfs_chunk_map
+{
+    uint64_t start;                 //!< First logical address of the chunk
+    uint64_t end;                   //!< First logical address past the chunk
+    struct btrfs_key *key;          //!< On-disk key, followed by the chunk item and its stripes
+};
+
+/* Tree nodes are cached with their item arrays; interior nodes are pinned,
+   leaves are evicted with a CLOCK hand.  */
+#ifndef BTRFS_NODE_CACHE_SIZE
+#define BTRFS_NODE_CACHE_SIZE 128
+#endif
+#ifndef BTRFS_NODE_CACHE_PINNED
+#define BTRFS_NODE_CACHE_PINNED (BTRFS_NODE_CACHE_SIZE / 2)
+#endif
+#define BTRFS_NODE_HASH_SIZE 64
+
+struct fsw_btrfs_node
+{
+    struct fsw_btrfs_node *hash_next;   //!< Next node in the same hash bucket
+    uint64_t addr;                  //!< Logical address of the node
+    uint64_t generation;            //!< Generation from the node header
+    unsigned nitems;                //!< Number of items
+    unsigned level;                 //!< Level in the tree, 0 for leaves
+    int pinned;                     //!< Never evicted (interior nodes)
+    int referenced;                 //!< Set on use, cleared by the CLOCK hand
+    void *items;                    //!< btrfs_internal_node or btrfs_leaf_node array of the node
+};
+
+/* Whole decompressed extents of compressed files, at most
+   BTRFS_EXTENT_CACHE_BUDGET bytes of them (0 disables the cache).  */
+#ifndef BTRFS_EXTENT_CACHE_SIZE
+#define BTRFS_EXTENT_CACHE_SIZE 16
+#endif
+#ifndef BTRFS_EXTENT_CACHE_BUDGET
+#define BTRFS_EXTENT_CACHE_BUDGET (1024 * 1024)
+#endif
+
+struct fsw_btrfs_extent_cache
+{
+    uint64_t tree;                  //!< Tree of the file
+    uint64_t ino;                   //!< Inode number of the file
+    uint64_t start;                 //!< File offset of the extent
+    uint32_t size;                  //!< Decompressed size of the extent
+    uint64_t last_used;             //!< Value of ecache_clock when last used
+    char *data;                     //!< Decompressed data, NULL if the slot is free
+};
+
+/* Driver-specific performance counters, reported through fsw_volume_driver_counters.  */
+enum
+{
+    BTRFS_PERF_XLATE_CALLS,         //!< Logical-to-physical address translations
+    BTRFS_PERF_XLATE_MAP_HITS,      //!< Translations answered from the in-memory chunk map
+    BTRFS_PERF_XLATE_NODES_SAVED,   //!< Chunk tree node reads avoided by those map hits
+    BTRFS_PERF_NODE_CACHE_HITS,     //!< Tree nodes found in the node cache
+    BTRFS_PERF_NODE_CACHE_MISSES,   //!< Tree nodes read into the node cache
+    BTRFS_PERF_DECOMPRESS_CALLS,    //!< Compressed extents decompressed
+    BTRFS_PERF_DECOMPRESS_CACHE_HITS, //!< Compressed extents served from the decompressed-extent cache
+    BTRFS_PERF_RAID_REBUILDS,       //!< Sectors of missing RAID devices rebuilt from parity
+    BTRFS_PERF_RAID_CACHE_HITS,     //!< Sectors of missing RAID devices served from the rebuilt-sector cache
+    BTRFS_PERF_COUNT
+};
+
+static const char * const fsw_btrfs_perf_names[BTRFS_PERF_COUNT] = {
+    "xlate_calls",
+    "xlate_map_hits",
+    "xlate_nodes_saved",
+    "node_cache_hits",
+    "node_cache_misses",
+    "decompress_calls",
+    "decompress_cache_hits",
+    "raid_rebuilds",
+    "raid_cache_hits",
 };
 
 struct fsw_btrfs_volume
@@ -162,6 +277,8 @@ struct fsw_btrfs_volume
     unsigned num_devices;
     unsigned sectorshift;
     unsigned sectorsize;
+    unsigned nodesize;
+    unsigned nodeshift;
     int is_master;
     int rescan_once;
 
@@ -169,6 +286,18 @@ struct fsw_btrfs_volume
     unsigned n_devices_attached;
     unsigned n_devices_allocated;
 
+    /* Whole chunk tree, sorted by logical address.  */
+    struct fsw_btrfs_chunk_map *chunk_map;
+    unsigned n_chunks;
+    unsigned chunk_tree_levels;
+
+    /* Tree node cache.  */
+    struct fsw_btrfs_node *nodes;
+    struct fsw_btrfs_node **node_hash;
+    unsigned nodes_used;
+    unsigned nodes_pinned;
+    unsigned node_hand;
+
     /* Cached extent data.  */
     uint64_t extstart;
     uint64_t extend;
@@ -176,7 +305,22 @@ struct fsw_btrfs_volume
     uint64_t exttree;
     uint32_t extsize;
     struct btrfs_extent_data *extent;
+
+    /* Rebuilt sectors of missing RAID5/6 devices.  */
+    const struct fsw_btrfs_raid_ops *raid_ops;
     struct fsw_btrfs_recover_cache *rcache;
+    struct fsw_btrfs_recover_cache **rcache_hash;
+    unsigned rcache_used;
+    unsigned rcache_hand;
+
+    /* Decompressed extents.  */
+    struct fsw_btrfs_extent_cache ecache[BTRFS_EXTENT_CACHE_SIZE];
+    uint32_t ecache_bytes;
+    uint64_t ecache_clock;
+
+    void *zstd_workspace;           //!< zstd decompression context, allocated on first use
+
+    fsw_u64 perf[BTRFS_PERF_COUNT]; //!< Driver-specific performance counters
 };
 
 enum
@@ -235,7 +379,7 @@ struct btrfs_internal_node
 {
     struct btrfs_key key;
     uint64_t addr;
-    uint64_t dummy;
+    uint64_t generation;
 } __attribute__ ((__packed__));
 
 struct btrfs_dir_item
@@ -346,6 +490,7 @@ static int uuid_eq(btrfs_uuid_t u1, btrfs_uuid_t u2) {
     return u1[0]==u2[0] && u1[1]==u2[1] && u1[2]==u2[2] && u1[3]==u2[3];
 }
 
+/* Shared by all volumes of the host; only touched with fsw_host_lock held. */
 static struct fsw_btrfs_uuid_list *master_uuid_list = NULL;
 
 static int master_uuid_add(struct fsw_btrfs_volume *vol, struct fsw_btrfs_volume **master_out) {
@@ -390,12 +535,14 @@ static fsw_status_t btrfs_set_superblock_info(struct fsw_btrfs_volume *vol, stru
     vol->bytes_used = fsw_u64_le_swap(sb->bytes_used);
 
     vol->sectorshift = 0;
+    vol->nodeshift = 0;
     vol->sectorsize = fsw_u32_le_swap(sb->sectorsize);
+    vol->nodesize = fsw_u32_le_swap(sb->nodesize);
     for(i=9; i<20; i++) {
-        if((1UL<<i) == vol->sectorsize) {
+        if((1UL<<i) == vol->sectorsize)
             vol->sectorshift = i;
-            break;
-        }
+        if((1UL<<i) == vol->nodesize)
+            vol->nodeshift = i;
     }
     if(fsw_u64_le_swap(sb->num_devices) > BTRFS_MAX_NUM_DEVICES)
         vol->num_devices = BTRFS_MAX_NUM_DEVICES;
@@ -465,6 +612,32 @@ static fsw_status_t btrfs_read_superblock (struct fsw_volume *vol, struct btrfs_
     return err;
 }
 
+/* Superblock check without a mount: only the primary copy at 64 KiB is looked at,
+ * like btrfs_read_superblock, which gives up when that one is missing. */
+static fsw_status_t fsw_btrfs_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u32 offset = superblock_pos[0] * BTRFS_DEFAULT_BLOCK_SIZE;
+    struct btrfs_superblock *sb;
+
+    if (size < offset + sizeof (*sb))
+        return FSW_UNSUPPORTED;
+    sb = (struct btrfs_superblock *)((uint8_t *)buffer + offset);
+    if (!fsw_memeq (sb->signature, GRUB_BTRFS_SIGNATURE,
+                sizeof (GRUB_BTRFS_SIGNATURE) - 1))
+        return FSW_UNSUPPORTED;
+    return FSW_SUCCESS;
+}
+
+static fsw_u32 fsw_btrfs_perf_counters(struct fsw_volume *volg, const char * const **names_out,
+                                       fsw_u64 **values_out)
+{
+    struct fsw_btrfs_volume *vol = (struct fsw_btrfs_volume *)volg;
+
+    *names_out = fsw_btrfs_perf_names;
+    *values_out = vol->perf;
+    return BTRFS_PERF_COUNT;
+}
+
 static int key_cmp (const struct btrfs_key *a, const struct btrfs_key *b)
 {
     if (fsw_u64_le_swap (a->object_id) < fsw_u64_le_swap (b->object_id))
@@ -512,13 +685,163 @@ static fsw_status_t save_ref (struct fsw_btrfs_leaf_descriptor *desc,
     return FSW_SUCCESS;
 }
 
+static unsigned fsw_btrfs_node_hash (struct fsw_btrfs_volume *vol, uint64_t addr)
+{
+    return (unsigned) (addr >> vol->nodeshift) & (BTRFS_NODE_HASH_SIZE - 1);
+}
+
+/* Pick a free slot, or evict an unpinned one with the CLOCK hand.  */
+static struct fsw_btrfs_node *fsw_btrfs_node_slot (struct fsw_btrfs_volume *vol)
+{
+    struct fsw_btrfs_node *node, **link;
+
+    if (vol->nodes_used < BTRFS_NODE_CACHE_SIZE)
+        return &vol->nodes[vol->nodes_used++];
+
+    for (;;)
+    {
+        node = &vol->nodes[vol->node_hand];
+        vol->node_hand = (vol->node_hand + 1) % BTRFS_NODE_CACHE_SIZE;
+        if (node->pinned)
+            continue;
+        if (node->referenced) {
+            node->referenced = 0;
+            continue;
+        }
+        break;
+    }
+
+    for (link = &vol->node_hash[fsw_btrfs_node_hash (vol, node->addr)]; *link; link = &(*link)->hash_next)
+        if (*link == node) {
+            *link = node->hash_next;
+            break;
+        }
+    return node;
+}
+
+/*
+ * Get a tree node with its item array from the node cache, reading it on a
+ * miss. generation is the one recorded in the parent's pointer, or 0 if not
+ * known. The node stays valid until the next call.
+ */
+static fsw_status_t fsw_btrfs_get_node (struct fsw_btrfs_volume *vol, uint64_t addr,
+        uint64_t generation, int rdepth, int cache_level, struct fsw_btrfs_node **node_out)
+{
+    struct fsw_btrfs_node *node;
+    struct btrfs_header head;
+    fsw_status_t err;
+    unsigned size;
+    void *items = NULL;
+
+    if (vol->nodes == NULL) {
+        err = fsw_alloc_zero (sizeof (struct fsw_btrfs_node) * BTRFS_NODE_CACHE_SIZE, (void **)&vol->nodes);
+        if (err)
+            return err;
+        err = fsw_alloc_zero (sizeof (struct fsw_btrfs_node *) * BTRFS_NODE_HASH_SIZE, (void **)&vol->node_hash);
+        if (err) {
+            FreePool (vol->nodes);
+            vol->nodes = NULL;
+            return err;
+        }
+    }
+
+    for (node = vol->node_hash[fsw_btrfs_node_hash (vol, addr)]; node; node = node->hash_next)
+        if (node->addr == addr && (generation == 0 || node->generation == generation)) {
+            node->referenced = 1;
+            vol->perf[BTRFS_PERF_NODE_CACHE_HITS]++;
+            *node_out = node;
+            return FSW_SUCCESS;
+        }
+    vol->perf[BTRFS_PERF_NODE_CACHE_MISSES]++;
+
+    /* read everything before taking a slot: reading may search the chunk tree */
+    err = fsw_btrfs_read_logical (vol, addr, &head, sizeof (head), rdepth + 1, cache_level);
+    if (err)
+        return err;
+    size = fsw_u32_le_swap (head.nitems) * (head.level ? sizeof (struct btrfs_internal_node)
+            : sizeof (struct btrfs_leaf_node));
+    if (fsw_u32_le_swap (head.nitems) > vol->nodesize || size > vol->nodesize - sizeof (head))
+        return FSW_VOLUME_CORRUPTED;
+    if (size) {
+        items = AllocatePool (size);
+        if (!items)
+            return FSW_OUT_OF_MEMORY;
+        err = fsw_btrfs_read_logical (vol, addr + sizeof (head), items, size, rdepth + 1, cache_level);
+        if (err) {
+            FreePool (items);
+            return err;
+        }
+    }
+
+    /* a stale copy of the node is replaced in place */
+    for (node = vol->node_hash[fsw_btrfs_node_hash (vol, addr)]; node; node = node->hash_next)
+        if (node->addr == addr)
+            break;
+    if (node == NULL) {
+        node = fsw_btrfs_node_slot (vol);
+        if (node->pinned)
+            vol->nodes_pinned--;
+        node->pinned = head.level && vol->nodes_pinned < BTRFS_NODE_CACHE_PINNED;
+        if (node->pinned)
+            vol->nodes_pinned++;
+        node->addr = addr;
+        node->hash_next = vol->node_hash[fsw_btrfs_node_hash (vol, addr)];
+        vol->node_hash[fsw_btrfs_node_hash (vol, addr)] = node;
+    }
+    if (node->items)
+        FreePool (node->items);
+    node->items = items;
+    node->generation = fsw_u64_le_swap (head.generation);
+    node->nitems = fsw_u32_le_swap (head.nitems);
+    node->level = head.level;
+    node->referenced = 1;
+    *node_out = node;
+    return FSW_SUCCESS;
+}
+
+static void fsw_btrfs_free_nodes (struct fsw_btrfs_volume *vol)
+{
+    unsigned i;
+
+    if (vol->nodes == NULL)
+        return;
+    for (i = 0; i < vol->nodes_used; i++)
+        if (vol->nodes[i].items)
+            FreePool (vol->nodes[i].items);
+    FreePool (vol->nodes);
+    FreePool (vol->node_hash);
+    vol->nodes = NULL;
+    vol->node_hash = NULL;
+}
+
+/* Number of items of a node whose key is not greater than key.  */
+static unsigned fsw_btrfs_node_search (struct fsw_btrfs_node *node, const struct btrfs_key *key)
+{
+    unsigned lo = 0, hi = node->nitems;
+
+    while (lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        const struct btrfs_key *mkey = node->level
+            ? &((struct btrfs_internal_node *) node->items)[mid].key
+            : &((struct btrfs_leaf_node *) node->items)[mid].key;
+
+        if (key_cmp (mkey, key) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 static int next (struct fsw_btrfs_volume *vol,
         struct fsw_btrfs_leaf_descriptor *desc,
         uint64_t * outaddr, fsw_size_t * outsize,
         struct btrfs_key *key_out)
 {
     fsw_status_t err;
-    struct btrfs_leaf_node leaf;
+    struct fsw_btrfs_node *node;
+    struct btrfs_leaf_node *leaf;
 
     for (; desc->depth > 0; desc->depth--)
     {
@@ -531,37 +854,34 @@ static int next (struct fsw_btrfs_volume *vol,
         return 0;
     while (!desc->data[desc->depth - 1].leaf)
     {
-        struct btrfs_internal_node node;
-        struct btrfs_header head;
-        fsw_memzero(&node, sizeof (node));
-
-        err = fsw_btrfs_read_logical (vol, desc->data[desc->depth - 1].iter
-                * sizeof (node)
-                + sizeof (struct btrfs_header)
-                + desc->data[desc->depth - 1].addr,
-                &node, sizeof (node), 0, 1);
+        struct btrfs_internal_node *inode;
+
+        err = fsw_btrfs_get_node (vol, desc->data[desc->depth - 1].addr, 0, 0, 1, &node);
         if (err)
             return -err;
+        if (!node->level || desc->data[desc->depth - 1].iter >= node->nitems)
+            return -FSW_VOLUME_CORRUPTED;
+        inode = &((struct btrfs_internal_node *) node->items)[desc->data[desc->depth - 1].iter];
 
-        err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (node.addr),
-                &head, sizeof (head), 0, 1);
+        err = fsw_btrfs_get_node (vol, fsw_u64_le_swap (inode->addr),
+                fsw_u64_le_swap (inode->generation), 0, 1, &node);
         if (err)
             return -err;
 
-        save_ref (desc, fsw_u64_le_swap (node.addr), 0,
-                fsw_u32_le_swap (head.nitems), !head.level);
+        err = save_ref (desc, node->addr, 0, node->nitems, !node->level);
+        if (err)
+            return -err;
     }
-    err = fsw_btrfs_read_logical (vol, desc->data[desc->depth - 1].iter
-            * sizeof (leaf)
-            + sizeof (struct btrfs_header)
-            + desc->data[desc->depth - 1].addr, &leaf,
-            sizeof (leaf), 0, 1);
+    err = fsw_btrfs_get_node (vol, desc->data[desc->depth - 1].addr, 0, 0, 1, &node);
     if (err)
         return -err;
-    *outsize = fsw_u32_le_swap (leaf.size);
+    if (node->level || desc->data[desc->depth - 1].iter >= node->nitems)
+        return -FSW_VOLUME_CORRUPTED;
+    leaf = &((struct btrfs_leaf_node *) node->items)[desc->data[desc->depth - 1].iter];
+    *outsize = fsw_u32_le_swap (leaf->size);
     *outaddr = desc->data[desc->depth - 1].addr + sizeof (struct btrfs_header)
-        + fsw_u32_le_swap (leaf.offset);
-    *key_out = leaf.key;
+        + fsw_u32_le_swap (leaf->offset);
+    *key_out = leaf->key;
     return 1;
 }
 
@@ -575,6 +895,7 @@ static fsw_status_t lower_bound (struct fsw_btrfs_volume *vol,
         int rdepth)
 {
     uint64_t addr = fsw_u64_le_swap (root);
+    uint64_t generation = 0;
     int depth = -1;
 
     if (desc)
@@ -597,117 +918,66 @@ static fsw_status_t lower_bound (struct fsw_btrfs_volume *vol,
     while (1)
     {
         fsw_status_t err;
-        struct btrfs_header head;
-        fsw_memzero(&head, sizeof (head));
+        struct fsw_btrfs_node *node;
+        unsigned i;
 
-reiter:
         depth++;
-        /* FIXME: preread few nodes into buffer. */
-        err = fsw_btrfs_read_logical (vol, addr, &head, sizeof (head),
-                rdepth + 1, depth2cache(rdepth));
+        /* upper levels stay in the node cache, so this rarely reads */
+        err = fsw_btrfs_get_node (vol, addr, generation, rdepth, depth2cache(rdepth), &node);
         if (err)
             return err;
-        addr += sizeof (head);
-        if (head.level)
-        {
-            unsigned i;
-            struct btrfs_internal_node node, node_last;
-            int have_last = 0;
-            fsw_memzero (&node_last, sizeof (node_last));
-            for (i = 0; i < fsw_u32_le_swap (head.nitems); i++)
-            {
-                err = fsw_btrfs_read_logical (vol, addr + i * sizeof (node),
-                        &node, sizeof (node), rdepth + 1, depth2cache(rdepth));
-                if (err)
-                    return err;
+        /* the item to follow is the last one with a key not above key_in */
+        i = fsw_btrfs_node_search (node, key_in);
 
-                DPRINT (L"btrfs: internal node (depth %d) %lx %x %lx\n", depth,
-                        node.key.object_id, node.key.type,
-                        node.key.offset);
+        if (node->level)
+        {
+            struct btrfs_internal_node *inode;
 
-                if (key_cmp (&node.key, key_in) == 0)
-                {
-                    err = FSW_SUCCESS;
-                    if (desc)
-                        err = save_ref (desc, addr - sizeof (head), i,
-                                fsw_u32_le_swap (head.nitems), 0);
-                    if (err)
-                        return err;
-                    addr = fsw_u64_le_swap (node.addr);
-                    goto reiter;
-                }
-                if (key_cmp (&node.key, key_in) > 0)
-                    break;
-                node_last = node;
-                have_last = 1;
-            }
-            if (have_last)
+            if (i == 0)
             {
-                err = FSW_SUCCESS;
+                *outsize = 0;
+                *outaddr = 0;
+                fsw_memzero (key_out, sizeof (*key_out));
                 if (desc)
-                    err = save_ref (desc, addr - sizeof (head), i - 1,
-                            fsw_u32_le_swap (head.nitems), 0);
-                if (err)
-                    return err;
-                addr = fsw_u64_le_swap (node_last.addr);
-                goto reiter;
+                    return save_ref (desc, addr, -1, node->nitems, 0);
+                return FSW_SUCCESS;
             }
-            *outsize = 0;
-            *outaddr = 0;
-            fsw_memzero (key_out, sizeof (*key_out));
+            inode = &((struct btrfs_internal_node *) node->items)[i - 1];
+
+            DPRINT (L"btrfs: internal node (depth %d) %lx %x %lx\n", depth,
+                    inode->key.object_id, inode->key.type, inode->key.offset);
+
+            err = FSW_SUCCESS;
             if (desc)
-                return save_ref (desc, addr - sizeof (head), -1,
-                        fsw_u32_le_swap (head.nitems), 0);
-            return FSW_SUCCESS;
+                err = save_ref (desc, addr, i - 1, node->nitems, 0);
+            if (err)
+                return err;
+            addr = fsw_u64_le_swap (inode->addr);
+            generation = fsw_u64_le_swap (inode->generation);
+            continue;
         }
         {
-            unsigned i;
-            struct btrfs_leaf_node leaf, leaf_last;
-            int have_last = 0;
-            for (i = 0; i < fsw_u32_le_swap (head.nitems); i++)
-            {
-                err = fsw_btrfs_read_logical (vol, addr + i * sizeof (leaf),
-                        &leaf, sizeof (leaf), rdepth + 1, depth2cache(rdepth));
-                if (err)
-                    return err;
-
-                DPRINT (L"btrfs: leaf (depth %d) %lx %x %lx\n", depth,
-                        leaf.key.object_id, leaf.key.type, leaf.key.offset);
+            struct btrfs_leaf_node *leaf;
 
-                if (key_cmp (&leaf.key, key_in) == 0)
-                {
-                    fsw_memcpy (key_out, &leaf.key, sizeof (*key_out));
-                    *outsize = fsw_u32_le_swap (leaf.size);
-                    *outaddr = addr + fsw_u32_le_swap (leaf.offset);
-                    if (desc)
-                        return save_ref (desc, addr - sizeof (head), i,
-                                fsw_u32_le_swap (head.nitems), 1);
-                    return FSW_SUCCESS;
-                }
-
-                if (key_cmp (&leaf.key, key_in) > 0)
-                    break;
-
-                have_last = 1;
-                leaf_last = leaf;
-            }
-
-            if (have_last)
+            if (i == 0)
             {
-                fsw_memcpy (key_out, &leaf_last.key, sizeof (*key_out));
-                *outsize = fsw_u32_le_swap (leaf_last.size);
-                *outaddr = addr + fsw_u32_le_swap (leaf_last.offset);
+                *outsize = 0;
+                *outaddr = 0;
+                fsw_memzero (key_out, sizeof (*key_out));
                 if (desc)
-                    return save_ref (desc, addr - sizeof (head), i - 1,
-                            fsw_u32_le_swap (head.nitems), 1);
+                    return save_ref (desc, addr, -1, node->nitems, 1);
                 return FSW_SUCCESS;
             }
-            *outsize = 0;
-            *outaddr = 0;
-            fsw_memzero (key_out, sizeof (*key_out));
+            leaf = &((struct btrfs_leaf_node *) node->items)[i - 1];
+
+            DPRINT (L"btrfs: leaf (depth %d) %lx %x %lx\n", depth,
+                    leaf->key.object_id, leaf->key.type, leaf->key.offset);
+
+            fsw_memcpy (key_out, &leaf->key, sizeof (*key_out));
+            *outsize = fsw_u32_le_swap (leaf->size);
+            *outaddr = addr + sizeof (struct btrfs_header) + fsw_u32_le_swap (leaf->offset);
             if (desc)
-                return save_ref (desc, addr - sizeof (head), -1,
-                        fsw_u32_le_swap (head.nitems), 1);
+                return save_ref (desc, addr, i - 1, node->nitems, 1);
             return FSW_SUCCESS;
         }
     }
@@ -736,6 +1006,7 @@ static int btrfs_add_multi_device(struct fsw_btrfs_volume *master, struct fsw_vo
 static int scan_disks_hook(struct fsw_volume *volg, struct fsw_volume *slave) {
     struct fsw_btrfs_volume *vol = (struct fsw_btrfs_volume *)volg;
     struct btrfs_superblock sb;
+    btrfs_uuid_t u;
     fsw_status_t err;
 
     if(vol->n_devices_attached >= vol->n_devices_allocated)
@@ -785,21 +1056,30 @@ static void block_xor(char *dst, const char *src, uint32_t blocksize)
     const UINTN *s = (const UINTN *)src;
     blocksize /= sizeof (UINTN);
     uint32_t i;
-    for( i = 0; i < blocksize; i++)
+    for( i = 0; i < blocksize; i += 4) {
 	d[i] ^= s[i];
+	d[i+1] ^= s[i+1];
+	d[i+2] ^= s[i+2];
+	d[i+3] ^= s[i+3];
+    }
 }
 
-static void stripe_xor(char *dst, struct stripe_table *stripe, int data_stripes, uint32_t blocksize)
+/* XOR of the data and P blocks that could be read */
+static void stripe_xor(const struct fsw_btrfs_raid_ops *ops, char *dst, struct stripe_table *stripe, int data_stripes, uint32_t blocksize)
 {
-    unsigned i, j;
-    UINTN c;
-    for(j = 0; j < blocksize; j += sizeof (UINTN)) {
-	/* data + P stripes */
-	for(c=0, i=0; i <= data_stripes; i++)
-	    if(stripe[i].ptr)
-		c ^= *(UINTN *)(stripe[i].ptr + j);
-	*(UINTN *)(dst + j) = c;
+    int i;
+    BOOLEAN first = TRUE;
+    for(i = 0; i <= data_stripes; i++) {
+	if(!stripe[i].ptr)
+	    continue;
+	if(first)
+	    fsw_memcpy(dst, stripe[i].ptr, blocksize);
+	else
+	    ops->xor_block(dst, stripe[i].ptr, blocksize);
+	first = FALSE;
     }
+    if(first)
+	fsw_memzero(dst, blocksize);
 }
 
 static void stripe_release(struct stripe_table *stripe, int count, uint32_t offset)
@@ -812,76 +1092,387 @@ static void stripe_release(struct stripe_table *stripe, int count, uint32_t offs
     }
 }
 
-/* x**y.  */
-static uint8_t powx[255 * 2];
+/* x**y over GF(2^8) with the RAID6 polynomial 0x11d, twice over so that
+   exponents can be added without reducing them modulo 255.  */
+static const uint8_t powx[255 * 2] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d, 0x3a, 0x74, 0xe8,
+    0xcd, 0x87, 0x13, 0x26, 0x4c, 0x98, 0x2d, 0x5a, 0xb4, 0x75, 0xea, 0xc9,
+    0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x9d, 0x27, 0x4e, 0x9c,
+    0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee, 0xc1, 0x9f, 0x23,
+    0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d, 0xba, 0x69, 0xd2,
+    0xb9, 0x6f, 0xde, 0xa1, 0x5f, 0xbe, 0x61, 0xc2, 0x99, 0x2f, 0x5e, 0xbc,
+    0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0, 0xfd, 0xe7, 0xd3, 0xbb,
+    0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b, 0xb6, 0x71, 0xe2,
+    0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d, 0x1a, 0x34, 0x68,
+    0xd0, 0xbd, 0x67, 0xce, 0x81, 0x1f, 0x3e, 0x7c, 0xf8, 0xed, 0xc7, 0x93,
+    0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc, 0x85, 0x17, 0x2e, 0x5c,
+    0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84, 0x15, 0x2a, 0x54,
+    0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49, 0x92, 0x39, 0x72,
+    0xe4, 0xd5, 0xb7, 0x73, 0xe6, 0xd1, 0xbf, 0x63, 0xc6, 0x91, 0x3f, 0x7e,
+    0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff, 0xe3, 0xdb, 0xab, 0x4b,
+    0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5, 0x57, 0xae, 0x41,
+    0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c, 0x38, 0x70, 0xe0,
+    0xdd, 0xa7, 0x53, 0xa6, 0x51, 0xa2, 0x59, 0xb2, 0x79, 0xf2, 0xf9, 0xef,
+    0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09, 0x12, 0x24, 0x48, 0x90,
+    0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb, 0x8b, 0x0b, 0x16,
+    0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b, 0x36, 0x6c, 0xd8,
+    0xad, 0x47, 0x8e, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1d,
+    0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26, 0x4c, 0x98, 0x2d, 0x5a, 0xb4,
+    0x75, 0xea, 0xc9, 0x8f, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0xc0, 0x9d,
+    0x27, 0x4e, 0x9c, 0x25, 0x4a, 0x94, 0x35, 0x6a, 0xd4, 0xb5, 0x77, 0xee,
+    0xc1, 0x9f, 0x23, 0x46, 0x8c, 0x05, 0x0a, 0x14, 0x28, 0x50, 0xa0, 0x5d,
+    0xba, 0x69, 0xd2, 0xb9, 0x6f, 0xde, 0xa1, 0x5f, 0xbe, 0x61, 0xc2, 0x99,
+    0x2f, 0x5e, 0xbc, 0x65, 0xca, 0x89, 0x0f, 0x1e, 0x3c, 0x78, 0xf0, 0xfd,
+    0xe7, 0xd3, 0xbb, 0x6b, 0xd6, 0xb1, 0x7f, 0xfe, 0xe1, 0xdf, 0xa3, 0x5b,
+    0xb6, 0x71, 0xe2, 0xd9, 0xaf, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0d,
+    0x1a, 0x34, 0x68, 0xd0, 0xbd, 0x67, 0xce, 0x81, 0x1f, 0x3e, 0x7c, 0xf8,
+    0xed, 0xc7, 0x93, 0x3b, 0x76, 0xec, 0xc5, 0x97, 0x33, 0x66, 0xcc, 0x85,
+    0x17, 0x2e, 0x5c, 0xb8, 0x6d, 0xda, 0xa9, 0x4f, 0x9e, 0x21, 0x42, 0x84,
+    0x15, 0x2a, 0x54, 0xa8, 0x4d, 0x9a, 0x29, 0x52, 0xa4, 0x55, 0xaa, 0x49,
+    0x92, 0x39, 0x72, 0xe4, 0xd5, 0xb7, 0x73, 0xe6, 0xd1, 0xbf, 0x63, 0xc6,
+    0x91, 0x3f, 0x7e, 0xfc, 0xe5, 0xd7, 0xb3, 0x7b, 0xf6, 0xf1, 0xff, 0xe3,
+    0xdb, 0xab, 0x4b, 0x96, 0x31, 0x62, 0xc4, 0x95, 0x37, 0x6e, 0xdc, 0xa5,
+    0x57, 0xae, 0x41, 0x82, 0x19, 0x32, 0x64, 0xc8, 0x8d, 0x07, 0x0e, 0x1c,
+    0x38, 0x70, 0xe0, 0xdd, 0xa7, 0x53, 0xa6, 0x51, 0xa2, 0x59, 0xb2, 0x79,
+    0xf2, 0xf9, 0xef, 0xc3, 0x9b, 0x2b, 0x56, 0xac, 0x45, 0x8a, 0x09, 0x12,
+    0x24, 0x48, 0x90, 0x3d, 0x7a, 0xf4, 0xf5, 0xf7, 0xf3, 0xfb, 0xeb, 0xcb,
+    0x8b, 0x0b, 0x16, 0x2c, 0x58, 0xb0, 0x7d, 0xfa, 0xe9, 0xcf, 0x83, 0x1b,
+    0x36, 0x6c, 0xd8, 0xad, 0x47, 0x8e,
+};
 /* Such an s that x**s = y */
-static unsigned powx_inv[256];
-static const uint8_t poly = 0x1d;
+static const uint8_t powx_inv[256] = {
+    0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1a, 0xc6, 0x03, 0xdf, 0x33, 0xee,
+    0x1b, 0x68, 0xc7, 0x4b, 0x04, 0x64, 0xe0, 0x0e, 0x34, 0x8d, 0xef, 0x81,
+    0x1c, 0xc1, 0x69, 0xf8, 0xc8, 0x08, 0x4c, 0x71, 0x05, 0x8a, 0x65, 0x2f,
+    0xe1, 0x24, 0x0f, 0x21, 0x35, 0x93, 0x8e, 0xda, 0xf0, 0x12, 0x82, 0x45,
+    0x1d, 0xb5, 0xc2, 0x7d, 0x6a, 0x27, 0xf9, 0xb9, 0xc9, 0x9a, 0x09, 0x78,
+    0x4d, 0xe4, 0x72, 0xa6, 0x06, 0xbf, 0x8b, 0x62, 0x66, 0xdd, 0x30, 0xfd,
+    0xe2, 0x98, 0x25, 0xb3, 0x10, 0x91, 0x22, 0x88, 0x36, 0xd0, 0x94, 0xce,
+    0x8f, 0x96, 0xdb, 0xbd, 0xf1, 0xd2, 0x13, 0x5c, 0x83, 0x38, 0x46, 0x40,
+    0x1e, 0x42, 0xb6, 0xa3, 0xc3, 0x48, 0x7e, 0x6e, 0x6b, 0x3a, 0x28, 0x54,
+    0xfa, 0x85, 0xba, 0x3d, 0xca, 0x5e, 0x9b, 0x9f, 0x0a, 0x15, 0x79, 0x2b,
+    0x4e, 0xd4, 0xe5, 0xac, 0x73, 0xf3, 0xa7, 0x57, 0x07, 0x70, 0xc0, 0xf7,
+    0x8c, 0x80, 0x63, 0x0d, 0x67, 0x4a, 0xde, 0xed, 0x31, 0xc5, 0xfe, 0x18,
+    0xe3, 0xa5, 0x99, 0x77, 0x26, 0xb8, 0xb4, 0x7c, 0x11, 0x44, 0x92, 0xd9,
+    0x23, 0x20, 0x89, 0x2e, 0x37, 0x3f, 0xd1, 0x5b, 0x95, 0xbc, 0xcf, 0xcd,
+    0x90, 0x87, 0x97, 0xb2, 0xdc, 0xfc, 0xbe, 0x61, 0xf2, 0x56, 0xd3, 0xab,
+    0x14, 0x2a, 0x5d, 0x9e, 0x84, 0x3c, 0x39, 0x53, 0x47, 0x6d, 0x41, 0xa2,
+    0x1f, 0x2d, 0x43, 0xd8, 0xb7, 0x7b, 0xa4, 0x76, 0xc4, 0x17, 0x49, 0xec,
+    0x7f, 0x0c, 0x6f, 0xf6, 0x6c, 0xa1, 0x3b, 0x52, 0x29, 0x9d, 0x55, 0xaa,
+    0xfb, 0x60, 0x86, 0xb1, 0xbb, 0xcc, 0x3e, 0x5a, 0xcb, 0x59, 0x5f, 0xb0,
+    0x9c, 0xa9, 0xa0, 0x51, 0x0b, 0xf5, 0x16, 0xeb, 0x7a, 0x75, 0x2c, 0xd7,
+    0x4f, 0xae, 0xd5, 0xe9, 0xe6, 0xe7, 0xad, 0xe8, 0x74, 0xd6, 0xf4, 0xea,
+    0xa8, 0x50, 0x58, 0xaf,
+};
+/* v * x**mul for every byte v */
+static void gf_mul_table (unsigned mul, uint8_t *t)
+{
+    unsigned v;
+    t[0] = 0;
+    for (v = 1; v < 256; v++)
+	t[v] = powx[mul + powx_inv[v]];
+}
+
+/* The same for the low and the high nibble of v, for the shuffle kernels:
+   v * x**mul = lo[v & 15] ^ hi[v >> 4] */
+static void gf_nibble_tables (unsigned mul, uint8_t *lo, uint8_t *hi)
+{
+    unsigned v;
+    lo[0] = hi[0] = 0;
+    for (v = 1; v < 16; v++) {
+	lo[v] = powx[mul + powx_inv[v]];
+	hi[v] = powx[mul + powx_inv[v << 4]];
+    }
+}
+
 static void block_mulx (unsigned mul, char *buf, uint32_t size)
 {
     uint32_t i;
+    uint8_t t[256];
     uint8_t *p = (uint8_t *) buf;
-    for (i = 0; i < size; i++, p++)
-	if (*p)
-	    *p = powx[mul + powx_inv[*p]];
+    gf_mul_table (mul, t);
+    for (i = 0; i < size; i++)
+	p[i] = t[p[i]];
 }
 static void block_mulx_xor (char *dst, unsigned mul, const char *buf, uint32_t size)
 {
     uint32_t i;
+    uint8_t t[256];
     const uint8_t *p = (const uint8_t *) buf;
     uint8_t *q = (uint8_t *) dst;
-    for (i = 0; i < size; i++, p++, q++)
-	if (*p)
-	    *q ^= powx[mul + powx_inv[*p]];
+    gf_mul_table (mul, t);
+    for (i = 0; i < size; i++)
+	q[i] ^= t[p[i]];
 }
 
-static void raid6_init_table (void)
+static const struct fsw_btrfs_raid_ops raid_ops_generic = {
+    "generic", block_xor, block_mulx, block_mulx_xor
+};
+
+#if BTRFS_RAID_SIMD && defined(__x86_64__)
+/* SSSE3 and AVX2 kernels: pshufb looks up the products of both nibbles of
+   16 or 32 bytes at once. Plain GCC vector types and the pshufb builtins
+   keep them free of <immintrin.h>, which needs the C library headers.  */
+typedef char v16qi __attribute__((vector_size (16)));
+typedef unsigned char v16qu __attribute__((vector_size (16)));
+typedef unsigned char v16qu_u __attribute__((vector_size (16), aligned (1), may_alias));
+typedef char v32qi __attribute__((vector_size (32)));
+typedef unsigned char v32qu __attribute__((vector_size (32)));
+typedef unsigned char v32qu_u __attribute__((vector_size (32), aligned (1), may_alias));
+
+__attribute__((target("ssse3")))
+static inline v16qu gf_mul_ssse3 (v16qu v, v16qu lo, v16qu hi)
 {
-    static int initialized = 0;
-    unsigned i;
+    return (v16qu) __builtin_ia32_pshufb128 ((v16qi) lo, (v16qi) (v & 0x0f))
+	^ (v16qu) __builtin_ia32_pshufb128 ((v16qi) hi, (v16qi) (v >> 4));
+}
 
-    if(initialized)
-	return;
+__attribute__((target("ssse3")))
+static void block_xor_ssse3 (char *dst, const char *src, uint32_t size)
+{
+    uint32_t i;
+    for (i = 0; i < size; i += 16)
+	*(v16qu_u *)(dst + i) ^= *(const v16qu_u *)(src + i);
+}
 
-    uint8_t cur = 1;
-    for (i = 0; i < 255; i++)
-    {
-	powx[i] = cur;
-	powx[i + 255] = cur;
-	powx_inv[cur] = i;
-	if (cur & 0x80)
-	    cur = (cur << 1) ^ poly;
-	else
-	    cur <<= 1;
+__attribute__((target("ssse3")))
+static void block_mulx_ssse3 (unsigned mul, char *buf, uint32_t size)
+{
+    uint32_t i;
+    uint8_t lo[16], hi[16];
+    v16qu tlo, thi;
+    gf_nibble_tables (mul, lo, hi);
+    tlo = *(const v16qu_u *)lo;
+    thi = *(const v16qu_u *)hi;
+    for (i = 0; i < size; i += 16)
+	*(v16qu_u *)(buf + i) = gf_mul_ssse3 (*(const v16qu_u *)(buf + i), tlo, thi);
+}
+
+__attribute__((target("ssse3")))
+static void block_mulx_xor_ssse3 (char *dst, unsigned mul, const char *buf, uint32_t size)
+{
+    uint32_t i;
+    uint8_t lo[16], hi[16];
+    v16qu tlo, thi;
+    gf_nibble_tables (mul, lo, hi);
+    tlo = *(const v16qu_u *)lo;
+    thi = *(const v16qu_u *)hi;
+    for (i = 0; i < size; i += 16)
+	*(v16qu_u *)(dst + i) ^= gf_mul_ssse3 (*(const v16qu_u *)(buf + i), tlo, thi);
+}
+
+static const struct fsw_btrfs_raid_ops raid_ops_ssse3 = {
+    "ssse3", block_xor_ssse3, block_mulx_ssse3, block_mulx_xor_ssse3
+};
+
+/* vpshufb looks up within each 16-byte lane, so the tables go in both */
+__attribute__((target("avx2")))
+static inline v32qu gf_mul_avx2 (v32qu v, v32qu lo, v32qu hi)
+{
+    return (v32qu) __builtin_ia32_pshufb256 ((v32qi) lo, (v32qi) (v & 0x0f))
+	^ (v32qu) __builtin_ia32_pshufb256 ((v32qi) hi, (v32qi) (v >> 4));
+}
+
+__attribute__((target("avx2")))
+static void block_xor_avx2 (char *dst, const char *src, uint32_t size)
+{
+    uint32_t i;
+    for (i = 0; i < size; i += 32)
+	*(v32qu_u *)(dst + i) ^= *(const v32qu_u *)(src + i);
+}
+
+__attribute__((target("avx2")))
+static void block_mulx_avx2 (unsigned mul, char *buf, uint32_t size)
+{
+    uint32_t i;
+    uint8_t lo[32], hi[32];
+    v32qu tlo, thi;
+    gf_nibble_tables (mul, lo, hi);
+    fsw_memcpy (lo + 16, lo, 16);
+    fsw_memcpy (hi + 16, hi, 16);
+    tlo = *(const v32qu_u *)lo;
+    thi = *(const v32qu_u *)hi;
+    for (i = 0; i < size; i += 32)
+	*(v32qu_u *)(buf + i) = gf_mul_avx2 (*(const v32qu_u *)(buf + i), tlo, thi);
+}
+
+__attribute__((target("avx2")))
+static void block_mulx_xor_avx2 (char *dst, unsigned mul, const char *buf, uint32_t size)
+{
+    uint32_t i;
+    uint8_t lo[32], hi[32];
+    v32qu tlo, thi;
+    gf_nibble_tables (mul, lo, hi);
+    fsw_memcpy (lo + 16, lo, 16);
+    fsw_memcpy (hi + 16, hi, 16);
+    tlo = *(const v32qu_u *)lo;
+    thi = *(const v32qu_u *)hi;
+    for (i = 0; i < size; i += 32)
+	*(v32qu_u *)(dst + i) ^= gf_mul_avx2 (*(const v32qu_u *)(buf + i), tlo, thi);
+}
+
+static const struct fsw_btrfs_raid_ops raid_ops_avx2 = {
+    "avx2", block_xor_avx2, block_mulx_avx2, block_mulx_xor_avx2
+};
+
+static void fsw_btrfs_cpuid (unsigned leaf, unsigned subleaf, unsigned *a, unsigned *b, unsigned *c, unsigned *d)
+{
+    __asm__ __volatile__ ("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) : "a" (leaf), "c" (subleaf));
+}
+
+#elif BTRFS_RAID_SIMD && defined(__aarch64__)
+/* NEON kernels: tbl looks up the products of both nibbles of 16 bytes.  */
+static inline uint8x16_t gf_mul_neon (uint8x16_t v, uint8x16_t lo, uint8x16_t hi)
+{
+    return veorq_u8 (vqtbl1q_u8 (lo, vandq_u8 (v, vdupq_n_u8 (0x0f))),
+	    vqtbl1q_u8 (hi, vshrq_n_u8 (v, 4)));
+}
+
+static void block_xor_neon (char *dst, const char *src, uint32_t size)
+{
+    uint32_t i;
+    for (i = 0; i < size; i += 16)
+	vst1q_u8 ((uint8_t *)dst + i, veorq_u8 (vld1q_u8 ((const uint8_t *)dst + i),
+		    vld1q_u8 ((const uint8_t *)src + i)));
+}
+
+static void block_mulx_neon (unsigned mul, char *buf, uint32_t size)
+{
+    uint32_t i;
+    uint8_t lo[16], hi[16];
+    uint8x16_t tlo, thi;
+    gf_nibble_tables (mul, lo, hi);
+    tlo = vld1q_u8 (lo);
+    thi = vld1q_u8 (hi);
+    for (i = 0; i < size; i += 16)
+	vst1q_u8 ((uint8_t *)buf + i, gf_mul_neon (vld1q_u8 ((const uint8_t *)buf + i), tlo, thi));
+}
+
+static void block_mulx_xor_neon (char *dst, unsigned mul, const char *buf, uint32_t size)
+{
+    uint32_t i;
+    uint8_t lo[16], hi[16];
+    uint8x16_t tlo, thi;
+    gf_nibble_tables (mul, lo, hi);
+    tlo = vld1q_u8 (lo);
+    thi = vld1q_u8 (hi);
+    for (i = 0; i < size; i += 16)
+	vst1q_u8 ((uint8_t *)dst + i, veorq_u8 (vld1q_u8 ((const uint8_t *)dst + i),
+		    gf_mul_neon (vld1q_u8 ((const uint8_t *)buf + i), tlo, thi)));
+}
+
+static const struct fsw_btrfs_raid_ops raid_ops_neon = {
+    "neon", block_xor_neon, block_mulx_neon, block_mulx_xor_neon
+};
+#endif
+
+/* Pick the fastest kernels the CPU supports.  */
+static const struct fsw_btrfs_raid_ops *fsw_btrfs_raid_select (void)
+{
+#if BTRFS_RAID_SIMD && defined(__x86_64__)
+    unsigned int a, b, c, d, max, xcr0, xcr0_hi;
+
+    /* leaf 1: ECX bit 9 SSSE3, 27 OSXSAVE, 28 AVX; leaf 7: EBX bit 5 AVX2 */
+    fsw_btrfs_cpuid (0, 0, &max, &b, &c, &d);
+    if (max < 1)
+	return &raid_ops_generic;
+    fsw_btrfs_cpuid (1, 0, &a, &b, &c, &d);
+    if (!(c & (1U << 9)))
+	return &raid_ops_generic;
+    /* AVX2 also needs the YMM state enabled in XCR0 by the firmware or OS */
+    if ((c & (1U << 27)) && (c & (1U << 28)) && max >= 7) {
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+	fsw_btrfs_cpuid (7, 0, &a, &b, &c, &d);
+	if ((xcr0 & 6) == 6 && (b & (1U << 5)))
+	    return &raid_ops_avx2;
     }
-    initialized = 1;
+    return &raid_ops_ssse3;
+#elif BTRFS_RAID_SIMD && defined(__aarch64__)
+    return &raid_ops_neon;
+#else
+    return &raid_ops_generic;
+#endif
 }
 
+static unsigned fsw_btrfs_recover_hash (uint64_t device_id, uint64_t offset)
+{
+    return (unsigned) (offset ^ (device_id << 4)) & (BTRFS_RECOVER_HASH_SIZE - 1);
+}
+
+/*
+ * Find the rebuilt copy of a sector of a missing device, or take a slot for
+ * it, evicting with the CLOCK hand once all are used. A new slot comes back
+ * with valid cleared, for the caller to fill.
+ */
 static struct fsw_btrfs_recover_cache *get_recover_cache(struct fsw_btrfs_volume *vol, uint64_t device_id, uint64_t offset)
 {
+    struct fsw_btrfs_recover_cache *rc, **link;
+    unsigned hash = fsw_btrfs_recover_hash(device_id, offset);
+
     if(vol->rcache == NULL) {
-	if(fsw_alloc_zero(sizeof (struct fsw_btrfs_recover_cache) * RECOVER_CACHE_SIZE, (void **)&vol->rcache) != FSW_SUCCESS)
+	if(fsw_alloc_zero(sizeof (struct fsw_btrfs_recover_cache) * BTRFS_RECOVER_CACHE_SIZE, (void **)&vol->rcache) != FSW_SUCCESS)
 	    return NULL;
-    }
-#ifdef __MAKEWITH_TIANO
-    unsigned hash;
-#else
-    UINTN hash;
-#endif
-    DivU64x32Remainder(((device_id >> 32) | device_id | (offset >> 32) | offset), RECOVER_CACHE_SIZE, &hash);
-    struct fsw_btrfs_recover_cache *rc = &vol->rcache[hash];
-    if(rc->buffer == NULL) {
-	if(fsw_alloc_zero(vol->sectorsize, (void **)&rc->buffer) != FSW_SUCCESS)
+	if(fsw_alloc_zero(sizeof (struct fsw_btrfs_recover_cache *) * BTRFS_RECOVER_HASH_SIZE, (void **)&vol->rcache_hash) != FSW_SUCCESS) {
+	    FreePool(vol->rcache);
+	    vol->rcache = NULL;
 	    return NULL;
+	}
     }
-    if(rc->device_id != device_id || rc->offset != offset) {
-	rc->valid = FALSE;
-	rc->device_id = device_id;
-	rc->offset = offset;
+
+    for(rc = vol->rcache_hash[hash]; rc; rc = rc->hash_next)
+	if(rc->device_id == device_id && rc->offset == offset) {
+	    rc->referenced = TRUE;
+	    return rc;
+	}
+
+    if(vol->rcache_used < BTRFS_RECOVER_CACHE_SIZE) {
+	rc = &vol->rcache[vol->rcache_used];
+	if(fsw_alloc(vol->sectorsize, (void **)&rc->buffer) != FSW_SUCCESS)
+	    return NULL;
+	vol->rcache_used++;
+    } else {
+	for(;;) {
+	    rc = &vol->rcache[vol->rcache_hand];
+	    vol->rcache_hand = (vol->rcache_hand + 1) % BTRFS_RECOVER_CACHE_SIZE;
+	    if(!rc->referenced)
+		break;
+	    rc->referenced = FALSE;
+	}
+	for(link = &vol->rcache_hash[fsw_btrfs_recover_hash(rc->device_id, rc->offset)]; *link; link = &(*link)->hash_next)
+	    if(*link == rc) {
+		*link = rc->hash_next;
+		break;
+	    }
     }
+    rc->device_id = device_id;
+    rc->offset = offset;
+    rc->valid = FALSE;
+    rc->referenced = TRUE;
+    rc->hash_next = vol->rcache_hash[hash];
+    vol->rcache_hash[hash] = rc;
     return rc;
 }
 
+/* Binary search of the chunk map loaded at mount time.  */
+static struct fsw_btrfs_chunk_map *fsw_btrfs_find_chunk (struct fsw_btrfs_volume *vol, uint64_t addr)
+{
+    unsigned lo = 0, hi = vol->n_chunks;
+
+    while (lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        struct fsw_btrfs_chunk_map *cm = &vol->chunk_map[mid];
+
+        if (addr < cm->start)
+            hi = mid;
+        else if (addr >= cm->end)
+            lo = mid + 1;
+        else
+            return cm;
+    }
+    return NULL;
+}
+
 static fsw_status_t fsw_btrfs_read_logical (struct fsw_btrfs_volume *vol, uint64_t addr,
         void *buf, fsw_size_t size, int rdepth, int cache_level)
 {
@@ -900,6 +1491,20 @@ static fsw_status_t fsw_btrfs_read_logical (struct fsw_btrfs_volume *vol, uint64
         uint64_t chaddr;
 
 	err = 0;
+        vol->perf[BTRFS_PERF_XLATE_CALLS]++;
+        if (vol->n_chunks)
+        {
+            struct fsw_btrfs_chunk_map *cm = fsw_btrfs_find_chunk (vol, addr);
+            if (cm)
+            {
+                vol->perf[BTRFS_PERF_XLATE_MAP_HITS]++;
+                vol->perf[BTRFS_PERF_XLATE_NODES_SAVED] += vol->chunk_tree_levels;
+                key = cm->key;
+                chunk = (struct btrfs_chunk_item *) (key + 1);
+                goto chunk_found;
+            }
+        }
+
         for (ptr = vol->bootstrap_mapping; ptr < vol->bootstrap_mapping + sizeof (vol->bootstrap_mapping) - sizeof (struct btrfs_key);)
         {
             key = (struct btrfs_key *) ptr;
@@ -1176,6 +1781,7 @@ begin_direct_read:
 			goto io_error;
 		    } else if(rcache->valid) {
 			// hit recovered cache
+			vol->perf[BTRFS_PERF_RAID_CACHE_HITS]++;
                         fsw_memcpy(buf+n, rcache->buffer+off, used_bytes);
 
                     } else {
@@ -1237,28 +1843,26 @@ begin_direct_read:
 			    stripe_release(stripe_table, i, stripe_offset);
 			} else if(bad2 == RAID5_TAG) {
 			    // single failed
-			    stripe_xor(rcache->buffer, stripe_table, i, sectorsize);
+			    stripe_xor(vol->raid_ops, rcache->buffer, stripe_table, i, sectorsize);
 			    stripe_release(stripe_table, i+1, stripe_offset);
 			} else {
-			    raid6_init_table();
-
 			    // calc Q
 			    fsw_memzero(rcache->buffer, sectorsize);
 			    for( i = 0; i < nstripes - 2; i++) {
 				if(stripe_table[i].ptr)
-				    block_mulx_xor(rcache->buffer, i, stripe_table[i].ptr, sectorsize);
+				    vol->raid_ops->mulx_xor(rcache->buffer, i, stripe_table[i].ptr, sectorsize);
 			    }
-			    block_xor(rcache->buffer, /*Q*/stripe_table[nstripes - 1].ptr, sectorsize);
+			    vol->raid_ops->xor_block(rcache->buffer, /*Q*/stripe_table[nstripes - 1].ptr, sectorsize);
 
 			    if(bad2 == nstripes - 2) {
 				// target & P failed
-				block_mulx(255 - posN, rcache->buffer, sectorsize);
+				vol->raid_ops->mulx(255 - posN, rcache->buffer, sectorsize);
 			    } else if((err = fsw_alloc(sectorsize, (void **)&pbuf))==FSW_SUCCESS) {
 				// double data failed
 				unsigned int c = ((255 ^ posN) + (255 ^ powx_inv[(powx[bad2 + (posN ^ 255)] ^ 1)]))%255;
-				block_mulx (c, rcache->buffer, sectorsize);
-				stripe_xor(pbuf, stripe_table, dstripes, sectorsize);
-				block_mulx_xor(rcache->buffer, (bad2+c)%255, pbuf, sectorsize);
+				vol->raid_ops->mulx(c, rcache->buffer, sectorsize);
+				stripe_xor(vol->raid_ops, pbuf, stripe_table, dstripes, sectorsize);
+				vol->raid_ops->mulx_xor(rcache->buffer, (bad2+c)%255, pbuf, sectorsize);
 				fsw_free(pbuf);
 			    }
 			    stripe_release(stripe_table, nstripes, stripe_offset);
@@ -1269,6 +1873,7 @@ begin_direct_read:
 
 			fsw_memcpy(buf+n, rcache->buffer+off, used_bytes);
 			rcache->valid = TRUE;
+			vol->perf[BTRFS_PERF_RAID_REBUILDS]++;
 		    }
 
 		    err = 0;
@@ -1301,6 +1906,177 @@ io_error:
     return err;
 }
 
+static void fsw_btrfs_free_chunk_map(struct fsw_btrfs_volume *vol)
+{
+    unsigned i;
+
+    for (i = 0; i < vol->n_chunks; i++)
+        FreePool (vol->chunk_map[i].key);
+    if (vol->chunk_map)
+        FreePool (vol->chunk_map);
+    vol->chunk_map = NULL;
+    vol->n_chunks = 0;
+}
+
+/* Append a copy of one chunk item to vol->chunk_map. */
+static fsw_status_t fsw_btrfs_add_chunk(struct fsw_btrfs_volume *vol, unsigned *allocated,
+        const struct btrfs_key *key_in, const uint8_t *item, fsw_size_t size)
+{
+    struct fsw_btrfs_chunk_map *cm;
+    struct btrfs_chunk_item *chunk = (struct btrfs_chunk_item *) item;
+    struct btrfs_key *key;
+
+    if (size < (fsw_size_t) sizeof (*chunk)
+            || fsw_u16_le_swap (chunk->nstripes) == 0
+            || sizeof (*chunk) + sizeof (struct btrfs_chunk_stripe)
+            * fsw_u16_le_swap (chunk->nstripes) > (unsigned) size)
+        return FSW_VOLUME_CORRUPTED;
+
+    if (vol->n_chunks == *allocated)
+    {
+        struct fsw_btrfs_chunk_map *newmap;
+
+        *allocated = *allocated ? *allocated * 2 : 64;
+        newmap = AllocatePool (sizeof (*newmap) * *allocated);
+        if (!newmap)
+            return FSW_OUT_OF_MEMORY;
+        if (vol->chunk_map) {
+            fsw_memcpy (newmap, vol->chunk_map, sizeof (*newmap) * vol->n_chunks);
+            FreePool (vol->chunk_map);
+        }
+        vol->chunk_map = newmap;
+    }
+
+    key = AllocatePool (sizeof (*key) + size);
+    if (!key)
+        return FSW_OUT_OF_MEMORY;
+    *key = *key_in;
+    fsw_memcpy (key + 1, item, size);
+
+    cm = &vol->chunk_map[vol->n_chunks];
+    cm->start = fsw_u64_le_swap (key->offset);
+    cm->end = cm->start + fsw_u64_le_swap (chunk->size);
+    cm->key = key;
+    vol->n_chunks++;
+
+    /* the tree is walked in key order, so the chunks come sorted */
+    if (cm->end <= cm->start || (vol->n_chunks > 1 && cm->start < cm[-1].end))
+        return FSW_VOLUME_CORRUPTED;
+    return FSW_SUCCESS;
+}
+
+/*
+ * Walk the chunk tree below addr and add its chunk items to vol->chunk_map.
+ * Each node is fetched with a few large reads instead of item by item.
+ */
+static fsw_status_t fsw_btrfs_load_chunk_node(struct fsw_btrfs_volume *vol, unsigned *allocated,
+        uint64_t addr, unsigned max_level)
+{
+    struct btrfs_header head;
+    unsigned nitems, i;
+    uint8_t *items = NULL;
+    fsw_status_t err;
+
+    err = fsw_btrfs_read_logical (vol, addr, &head, sizeof (head), 0, 1);
+    if (err)
+        return err;
+    nitems = fsw_u32_le_swap (head.nitems);
+    if (head.level > max_level || nitems > 0x10000)
+        return FSW_VOLUME_CORRUPTED;
+    addr += sizeof (head);
+
+    if (head.level)
+    {
+        struct btrfs_internal_node *node;
+        struct btrfs_key first;
+
+        first.object_id = fsw_u64_le_swap (GRUB_BTRFS_OBJECT_ID_CHUNK);
+        first.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+        first.offset = 0;
+
+        items = AllocatePool (nitems * sizeof (*node));
+        if (!items)
+            return FSW_OUT_OF_MEMORY;
+        err = fsw_btrfs_read_logical (vol, addr, items, nitems * sizeof (*node), 0, 1);
+        node = (struct btrfs_internal_node *) items;
+        for (i = 0; !err && i < nitems; i++)
+        {
+            /* skip subtrees that end before the first chunk item (device items) */
+            if (i + 1 < nitems && key_cmp (&node[i + 1].key, &first) <= 0)
+                continue;
+            err = fsw_btrfs_load_chunk_node (vol, allocated, fsw_u64_le_swap (node[i].addr), head.level - 1);
+        }
+    }
+    else
+    {
+        struct btrfs_leaf_node *leaf;
+        uint32_t data_end = nitems * sizeof (*leaf);
+
+        items = AllocatePool (data_end);
+        if (!items)
+            return FSW_OUT_OF_MEMORY;
+        err = fsw_btrfs_read_logical (vol, addr, items, data_end, 0, 1);
+        leaf = (struct btrfs_leaf_node *) items;
+        if (!err)
+        {
+            uint8_t *data;
+
+            /* item data is packed at the end of the node: read all of it at once */
+            for (i = 0; i < nitems; i++)
+                if (data_end < fsw_u32_le_swap (leaf[i].offset) + fsw_u32_le_swap (leaf[i].size))
+                    data_end = fsw_u32_le_swap (leaf[i].offset) + fsw_u32_le_swap (leaf[i].size);
+            if (data_end > 0x10000) {
+                FreePool (items);
+                return FSW_VOLUME_CORRUPTED;
+            }
+            data = AllocatePool (data_end);
+            if (!data) {
+                FreePool (items);
+                return FSW_OUT_OF_MEMORY;
+            }
+            err = fsw_btrfs_read_logical (vol, addr, data, data_end, 0, 1);
+            for (i = 0; !err && i < nitems; i++)
+            {
+                if (fsw_u64_le_swap (leaf[i].key.object_id) != GRUB_BTRFS_OBJECT_ID_CHUNK
+                        || leaf[i].key.type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+                    continue;
+                err = fsw_btrfs_add_chunk (vol, allocated, &leaf[i].key,
+                        data + fsw_u32_le_swap (leaf[i].offset), fsw_u32_le_swap (leaf[i].size));
+            }
+            FreePool (data);
+        }
+    }
+    FreePool (items);
+    return err;
+}
+
+/*
+ * Read all chunk items of the chunk tree into vol->chunk_map, so that
+ * fsw_btrfs_read_logical can translate addresses with a binary search
+ * instead of searching the chunk tree every time.
+ */
+static fsw_status_t fsw_btrfs_load_chunk_map(struct fsw_btrfs_volume *vol)
+{
+    struct btrfs_header head;
+    unsigned allocated = 0;
+    fsw_status_t err;
+
+    err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->chunk_tree), &head, sizeof (head), 0, 1);
+    if (err)
+        return err;
+    /* 8 is BTRFS_MAX_LEVEL */
+    if (head.level >= 8)
+        return FSW_VOLUME_CORRUPTED;
+    vol->chunk_tree_levels = head.level + 1;
+
+    err = fsw_btrfs_load_chunk_node (vol, &allocated, fsw_u64_le_swap (vol->chunk_tree), head.level);
+    if (err)
+        fsw_btrfs_free_chunk_map(vol);
+    DPRINT (L"btrfs: %d chunks loaded, chunk tree has %d levels, err %d\n",
+            vol->n_chunks, vol->chunk_tree_levels, err);
+    return err;
+}
+
 static fsw_status_t fsw_btrfs_get_default_root(struct fsw_btrfs_volume *vol, uint64_t root_dir_objectid);
 static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
     struct btrfs_superblock sblock;
@@ -1310,7 +2086,7 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
     fsw_status_t err;
     int i;
 
-    init_crc32c_table();
+    vol->raid_ops = fsw_btrfs_raid_select();
 
     err = btrfs_read_superblock (volg, &sblock);
     if (err)
@@ -1321,9 +2097,13 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
     if(vol->sectorshift == 0)
         return FSW_UNSUPPORTED;
 
+    if(vol->nodeshift == 0 || vol->nodesize <= sizeof (struct btrfs_header) || vol->nodesize > 0x10000)
+        return FSW_UNSUPPORTED;
+
     if(vol->num_devices >= BTRFS_MAX_NUM_DEVICES)
         return FSW_UNSUPPORTED;
 
+    fsw_host_lock(volg);
     vol->is_master = master_uuid_add(vol, &master_out);
     /* already mounted via other device */
     if(vol->is_master == 0) {
@@ -1332,12 +2112,16 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
         s.size = s.len = sizeof (FAKE_LABEL)-1;
         s.data = FAKE_LABEL;
         err = fsw_strdup_coerce(&volg->label, volg->host_string_type, &s);
-        if (err)
+        if (err) {
+            fsw_host_unlock(volg);
             return err;
+        }
         btrfs_add_multi_device(master_out, volg, &sblock);
+        fsw_host_unlock(volg);
         /* create fake root */
         return fsw_dnode_create_root_with_tree(volg, 0, 0, &volg->root);
     }
+    fsw_host_unlock(volg);
 
     fsw_set_blocksize(volg, vol->sectorsize, vol->sectorsize);
     vol->n_devices_allocated = vol->num_devices;
@@ -1365,9 +2149,17 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
         return err;
     }
 
+    /* without the map, addresses are still translated through the chunk tree */
+    if (fsw_btrfs_load_chunk_map(vol) == FSW_OUT_OF_MEMORY) {
+        FreePool (vol->devices_attached);
+        vol->devices_attached = NULL;
+        return FSW_OUT_OF_MEMORY;
+    }
+
     err = fsw_btrfs_get_default_root(vol, sblock.root_dir_objectid);
     if (err) {
         DPRINT(L"root not found\n");
+        fsw_btrfs_free_chunk_map(vol);
         FreePool (vol->devices_attached);
         vol->devices_attached = NULL;
         return err;
@@ -1384,8 +2176,11 @@ static void fsw_btrfs_volume_free(struct fsw_volume *volg)
     if (vol==NULL)
         return;
 
-    if (vol->is_master)
+    if (vol->is_master) {
+        fsw_host_lock(volg);
         master_uuid_remove(vol);
+        fsw_host_unlock(volg);
+    }
 
     if(vol->devices_attached) {
 	/* The device 0 is closed one layer upper.  */
@@ -1395,13 +2190,20 @@ static void fsw_btrfs_volume_free(struct fsw_volume *volg)
 	}
 	FreePool (vol->devices_attached);
     }
+    fsw_btrfs_free_chunk_map(vol);
+    fsw_btrfs_free_nodes(vol);
+    for (i = 0; i < BTRFS_EXTENT_CACHE_SIZE; i++)
+        if (vol->ecache[i].data)
+            FreePool (vol->ecache[i].data);
+    if(vol->zstd_workspace)
+        FreePool (vol->zstd_workspace);
     if(vol->extent)
         FreePool (vol->extent);
     if(vol->rcache) {
-	for(i = 0; i < RECOVER_CACHE_SIZE; i++)
-	    if(vol->rcache->buffer)
-		FreePool(vol->rcache->buffer);
+	for(i = 0; i < vol->rcache_used; i++)
+	    FreePool(vol->rcache[i].buffer);
         FreePool (vol->rcache);
+        FreePool (vol->rcache_hash);
     }
 }
 
@@ -1595,19 +2397,134 @@ static fsw_ssize_t grub_btrfs_lzo_decompress(char *ibuf, fsw_size_t isize, grub_
 
 #include "fsw_btrfs_zstd.h"
 
-typedef fsw_ssize_t (*decompressor_t)(char *ibuf, fsw_size_t isize, grub_off_t off, char *obuf, fsw_size_t osize);
-static decompressor_t btrfs_decompressor_table[GRUB_BTRFS_COMPRESSION_MAX] = {
-	grub_zlib_decompress,
-	grub_btrfs_lzo_decompress,
-	zstd_decompress,
-};
-
-static fsw_ssize_t btrfs_decompress(uint8_t comp,
+static fsw_ssize_t btrfs_decompress(struct fsw_btrfs_volume *vol, uint8_t comp,
 	char *ibuf, fsw_size_t isize,
 	grub_off_t off,
         char *obuf, fsw_size_t osize)
 {
-	return btrfs_decompressor_table[comp-1](ibuf, isize, off, obuf, osize);
+	switch (comp) {
+	    case GRUB_BTRFS_COMPRESSION_ZLIB:
+		return grub_zlib_decompress(ibuf, isize, off, obuf, osize);
+	    case GRUB_BTRFS_COMPRESSION_LZO:
+		return grub_btrfs_lzo_decompress(ibuf, isize, off, obuf, osize);
+	    case GRUB_BTRFS_COMPRESSION_ZSTD:
+		return zstd_decompress(&vol->zstd_workspace, ibuf, isize, off, obuf, osize);
+	}
+	return -1;
+}
+
+/* Decompress size bytes of the current extent, starting extoff bytes into its
+   file range, into obuf.  */
+static fsw_status_t fsw_btrfs_decompress_extent(struct fsw_btrfs_volume *vol,
+        uint64_t extoff, char *obuf, fsw_size_t size)
+{
+    char *tmp;
+    uint64_t zsize;
+    fsw_ssize_t ret;
+    fsw_status_t err;
+
+    vol->perf[BTRFS_PERF_DECOMPRESS_CALLS]++;
+    if (vol->extent->type == GRUB_BTRFS_EXTENT_INLINE)
+    {
+        ret = btrfs_decompress (vol, vol->extent->compression,
+                vol->extent->inl, vol->extsize -
+                ((uint8_t *) vol->extent->inl - (uint8_t *) vol->extent),
+                extoff, obuf, size);
+        return ret == (fsw_ssize_t) size ? FSW_SUCCESS : FSW_VOLUME_CORRUPTED;
+    }
+
+    zsize = fsw_u64_le_swap (vol->extent->compressed_size);
+    tmp = AllocatePool (zsize);
+    if (!tmp)
+        return FSW_OUT_OF_MEMORY;
+    err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->extent->laddr), tmp, zsize, 0, 0);
+    if (err)
+    {
+        FreePool (tmp);
+        return FSW_VOLUME_CORRUPTED;
+    }
+
+    ret = btrfs_decompress (vol, vol->extent->compression, tmp, zsize,
+            extoff + fsw_u64_le_swap (vol->extent->offset), obuf, size);
+    FreePool (tmp);
+    return ret == (fsw_ssize_t) size ? FSW_SUCCESS : FSW_VOLUME_CORRUPTED;
+}
+
+static void fsw_btrfs_ecache_drop(struct fsw_btrfs_volume *vol, struct fsw_btrfs_extent_cache *ec)
+{
+    vol->ecache_bytes -= ec->size;
+    FreePool (ec->data);
+    ec->data = NULL;
+}
+
+/*
+ * Copy size bytes of the current compressed extent, starting extoff bytes
+ * into its file range, to obuf. The whole extent is decompressed once and
+ * kept in a small LRU cache, so that reading it again from another handle or
+ * from another offset does not decompress it again.
+ */
+static fsw_status_t fsw_btrfs_read_compressed(struct fsw_btrfs_volume *vol,
+        uint64_t tree, uint64_t ino, uint64_t extoff, char *obuf, fsw_size_t size)
+{
+    struct fsw_btrfs_extent_cache *ec, *victim = NULL;
+    uint64_t full = vol->extend - vol->extstart;
+    fsw_status_t err;
+    unsigned i;
+
+    for (i = 0; i < BTRFS_EXTENT_CACHE_SIZE; i++)
+    {
+        ec = &vol->ecache[i];
+        if (ec->data && ec->tree == tree && ec->ino == ino
+                && ec->start == vol->extstart && ec->size == full)
+        {
+            ec->last_used = ++vol->ecache_clock;
+            vol->perf[BTRFS_PERF_DECOMPRESS_CACHE_HITS]++;
+            fsw_memcpy (obuf, ec->data + extoff, size);
+            return FSW_SUCCESS;
+        }
+    }
+
+    /* too big to keep: decompress just the part asked for */
+    if (full > BTRFS_EXTENT_CACHE_BUDGET)
+        return fsw_btrfs_decompress_extent (vol, extoff, obuf, size);
+
+    /* make room: take a free slot, else drop the least recently used ones */
+    for (;;)
+    {
+        struct fsw_btrfs_extent_cache *oldest = NULL;
+
+        victim = NULL;
+        for (i = 0; i < BTRFS_EXTENT_CACHE_SIZE; i++)
+        {
+            ec = &vol->ecache[i];
+            if (ec->data == NULL)
+                victim = ec;
+            else if (oldest == NULL || ec->last_used < oldest->last_used)
+                oldest = ec;
+        }
+        if (victim && vol->ecache_bytes + full <= BTRFS_EXTENT_CACHE_BUDGET)
+            break;
+        fsw_btrfs_ecache_drop (vol, oldest);
+    }
+
+    victim->data = AllocatePool (full);
+    if (!victim->data)
+        return fsw_btrfs_decompress_extent (vol, extoff, obuf, size);
+    err = fsw_btrfs_decompress_extent (vol, 0, victim->data, full);
+    if (err)
+    {
+        FreePool (victim->data);
+        victim->data = NULL;
+        return err;
+    }
+    victim->tree = tree;
+    victim->ino = ino;
+    victim->start = vol->extstart;
+    victim->size = full;
+    victim->last_used = ++vol->ecache_clock;
+    vol->ecache_bytes += full;
+    fsw_memcpy (obuf, victim->data + extoff, size);
+    return FSW_SUCCESS;
 }
 
 static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dnode *dnog,
@@ -1710,15 +2627,10 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
                 return FSW_OUT_OF_MEMORY;
             if (vol->extent->compression == GRUB_BTRFS_COMPRESSION_NONE)
                 fsw_memcpy (buf, vol->extent->inl + extoff, csize);
-            else if (btrfs_decompress (vol->extent->compression,
-				vol->extent->inl, vol->extsize -
-                            ((uint8_t *) vol->extent->inl
-                             - (uint8_t *) vol->extent),
-                            extoff, buf, csize)
-                        != (fsw_ssize_t) csize)
+            else if ((err = fsw_btrfs_read_compressed (vol, tree, ino, extoff, buf, csize)) != FSW_SUCCESS)
 	    {
                 FreePool(buf);
-                return FSW_VOLUME_CORRUPTED;
+                return err;
 	    }
             break;
 
@@ -1747,47 +2659,19 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
             }
 
             if (vol->extent->compression > GRUB_BTRFS_COMPRESSION_MAX)
-                    return -FSW_VOLUME_CORRUPTED;
-
-            {
-                char *tmp;
-                uint64_t zsize;
-                fsw_ssize_t ret;
-
-                zsize = fsw_u64_le_swap (vol->extent->compressed_size);
-                tmp = AllocatePool (zsize);
-                if (!tmp)
-                    return -FSW_OUT_OF_MEMORY;
-                err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->extent->laddr), tmp, zsize, 0, 0);
-                if (err)
-                {
-                    FreePool (tmp);
-                    return -FSW_VOLUME_CORRUPTED;
-                }
-
-                buf = AllocatePool( count << vol->sectorshift);
-                if(!buf) {
-                    FreePool(tmp);
-                    return FSW_OUT_OF_MEMORY;
-                }
-
-		ret = btrfs_decompress ( vol->extent->compression,
-			tmp, zsize,
-			extoff + fsw_u64_le_swap (vol->extent->offset),
-			buf, csize);
-
-                FreePool (tmp);
-
-                if (ret != (fsw_ssize_t) csize) {
-                    FreePool(tmp);
-                    return -FSW_VOLUME_CORRUPTED;
-                }
+                return FSW_VOLUME_CORRUPTED;
 
-                break;
+            buf = AllocatePool( count << vol->sectorshift);
+            if(!buf)
+                return FSW_OUT_OF_MEMORY;
+            err = fsw_btrfs_read_compressed (vol, tree, ino, extoff, buf, csize);
+            if (err) {
+                FreePool(buf);
+                return err;
             }
             break;
         default:
-            return -FSW_VOLUME_CORRUPTED;
+            return FSW_VOLUME_CORRUPTED;
     }
 
     extent->log_count = count;
@@ -2203,4 +3087,7 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(btrfs) = {
     fsw_btrfs_dir_lookup,
     fsw_btrfs_dir_read,
     fsw_btrfs_readlink,
+    NULL,
+    fsw_btrfs_probe,
+    fsw_btrfs_perf_counters,
 };
@@ -22,7 +22,7 @@ static inline uint16_t get_unaligned_le16(const void *s)
 static inline uint32_t get_unaligned_le32(const void *s)
 {
 	const unsigned char *p = (const unsigned char *)s;
-	return p[0]+ (p[1]<<8) + (p[2]<<16) + (p[3]<<24);
+	return p[0]+ (p[1]<<8) + (p[2]<<16) + ((uint32_t)p[3]<<24);
 }
 
 static inline uint64_t get_unaligned_le64(const void *s)
@@ -51,68 +51,90 @@ static inline void put_unaligned_le16(uint16_t v, void *s)
 #define ZSTD_BTRFS_MAX_INPUT (1 << ZSTD_BTRFS_MAX_WINDOWLOG)
 
 
-static fsw_ssize_t zstd_decompress(char *data_in, fsw_size_t srclen,
+/*
+ * Size of a decompression workspace: a ZSTD_DStream with its ZSTD_DCtx and
+ * buffers, then one page that output before start_byte is decompressed into.
+ * It is allocated for the first zstd extent of a volume and reused until the
+ * volume is unmounted.
+ */
+#define ZSTD_BTRFS_WORKSPACE_SIZE (ZSTD_DStreamWorkspaceBound(ZSTD_BTRFS_MAX_INPUT) + PAGE_SIZE)
+
+static fsw_ssize_t zstd_decompress(void **workspace,
+		char *data_in, fsw_size_t srclen,
 		grub_off_t start_byte,
 		char *data_out, fsw_size_t destlen)
 {
 	ZSTD_DStream *stream;
+	ZSTD_frameParams params;
 	ZSTD_inBuffer in_buf;
 	ZSTD_outBuffer out_buf;
 	fsw_ssize_t ret = 0;
 	size_t ret2;
+	char *skip;
 
-	size_t workspace_size = ZSTD_DStreamWorkspaceBound(ZSTD_BTRFS_MAX_INPUT);
-	void * workspace;
-	
-	in_buf.src = data_in;
-	in_buf.pos = 0;
-	in_buf.size = srclen;
-
-	out_buf.dst = NULL;
-
-	workspace = AllocatePool(workspace_size);
+	out_buf.dst = data_out;
+	out_buf.size = destlen;
+	out_buf.pos = 0;
 
-	if(!workspace) {
-		ret = -FSW_OUT_OF_MEMORY;
-		goto finish;
+	if(*workspace == NULL) {
+		*workspace = AllocatePool(ZSTD_BTRFS_WORKSPACE_SIZE);
+		if(!*workspace) {
+			ret = -FSW_OUT_OF_MEMORY;
+			goto finish;
+		}
+		stream = ZSTD_initDStream(ZSTD_BTRFS_MAX_INPUT, *workspace,
+				ZSTD_BTRFS_WORKSPACE_SIZE - PAGE_SIZE);
+	} else {
+		stream = &((ZSTD_DStreamWorkspace *)*workspace)->DStream;
+		ZSTD_resetDStream(stream);
 	}
-
-	stream = ZSTD_initDStream(ZSTD_BTRFS_MAX_INPUT, workspace, workspace_size);
-	if (!stream) {
-		DPRINT(L"BTRFS: ZSTD_initDStream failed\n");
-		ret = -FSW_OUT_OF_MEMORY;
+	skip = (char *)*workspace + ZSTD_BTRFS_WORKSPACE_SIZE - PAGE_SIZE;
+
+	/* The whole frame fits: decompress it in one pass, without the window buffer.
+	   Input is padded to the sector size, so pass just the frame.  */
+	if (start_byte == 0 && ZSTD_getFrameParams(&params, data_in, srclen) == 0
+			&& params.windowSize && params.frameContentSize
+			&& params.frameContentSize <= destlen) {
+		ret2 = ZSTD_findFrameCompressedSize(data_in, srclen);
+		if (!ZSTD_isError(ret2))
+			ret2 = ZSTD_decompressDCtx(stream->dctx, data_out, destlen, data_in, ret2);
+		if (ZSTD_isError(ret2)) {
+			DPRINT(L"BTRFS: ZSTD_decompressDCtx returned %d\n", ZSTD_getErrorCode(ret2));
+			ret = -FSW_VOLUME_CORRUPTED;
+			goto finish;
+		}
+		out_buf.pos = ret2;
+		ret = destlen;
 		goto finish;
 	}
 
+	in_buf.src = data_in;
+	in_buf.pos = 0;
+	in_buf.size = srclen;
+
 	while(start_byte > 0) {
-	    out_buf.size = start_byte < PAGE_SIZE ? start_byte : PAGE_SIZE;
-	    if(out_buf.dst == NULL)
-		out_buf.dst = AllocatePool(out_buf.size);
-	    out_buf.pos = 0;
+	    ZSTD_outBuffer skip_buf;
+
+	    skip_buf.dst = skip;
+	    skip_buf.size = start_byte < PAGE_SIZE ? start_byte : PAGE_SIZE;
+	    skip_buf.pos = 0;
 
-	    ret2 = ZSTD_decompressStream(stream, &out_buf, &in_buf);
+	    ret2 = ZSTD_decompressStream(stream, &skip_buf, &in_buf);
 	    if (ZSTD_isError(ret2)) {
 		DPRINT(L"BTRFS: ZSTD_decompressStream returned %d\n", ZSTD_getErrorCode(ret2));
 		ret = -FSW_VOLUME_CORRUPTED;
 		goto finish;
 	    }
 
-	    if(out_buf.pos == 0 && in_buf.pos == in_buf.size) {
+	    if(skip_buf.pos == 0 && in_buf.pos == in_buf.size) {
 		DPRINT(L"BTRFS: ZSTD_decompressStream ended early\n");
 		ret = -FSW_VOLUME_CORRUPTED;
 		goto finish;
 	    }
 
-	    start_byte -= out_buf.pos;
+	    start_byte -= skip_buf.pos;
 	}
 
-	if(out_buf.dst)
-		FreePool(out_buf.dst);
-
-	out_buf.dst = data_out;
-	out_buf.size = destlen;
-	out_buf.pos = 0;
-
 	ret2 = ZSTD_decompressStream(stream, &out_buf, &in_buf);
 	if (ZSTD_isError(ret2)) {
 	    DPRINT(L"BTRFS: ZSTD_decompressStream returned %d\n", ZSTD_getErrorCode(ret2));
@@ -122,10 +144,6 @@ static fsw_ssize_t zstd_decompress(char *data_in, fsw_size_t srclen,
 
 	ret = destlen;
 finish:
-	if(out_buf.dst && out_buf.dst != data_out)
-		FreePool(out_buf.dst);
-	if(workspace)
-		FreePool(workspace);
 	if (out_buf.pos < destlen)
 		memset(data_out + out_buf.pos, 0, destlen - out_buf.pos);
 	return ret;
@@ -38,14 +38,18 @@
  */
 
 #include "fsw_core.h"
-#include "fsw_efi.h"
 
 
 // functions
 
 static void fsw_blockcache_free(struct fsw_volume *vol);
-
-#define MAX_CACHE_LEVEL (5)
+static void fsw_dcache_flush(struct fsw_volume *vol);
+static void fsw_dcache_free(struct fsw_volume *vol);
+static void fsw_slab_init(struct fsw_slab *slab, fsw_u32 object_size);
+static fsw_status_t fsw_slab_alloc(struct fsw_volume *vol, struct fsw_slab *slab, void **ptr_out);
+static void fsw_slab_free(struct fsw_volume *vol, struct fsw_slab *slab, void *ptr);
+static void fsw_arena_free(struct fsw_volume *vol);
+static void fsw_extent_map_free(struct fsw_volume *vol, struct fsw_dnode *dno);
 
 /**
  * Mount a volume with a given file system driver. This function is called by the
@@ -82,6 +86,20 @@ fsw_status_t fsw_mount(void *host_data,
     vol->host_table     = host_table;
     vol->fstype_table   = fstype_table;
     vol->host_string_type = host_table->native_string_type;
+    vol->bcache_budget  = FSW_BCACHE_BUDGET;
+    vol->ra_min_window  = FSW_READAHEAD_MIN;
+    vol->ra_max_window  = FSW_READAHEAD_MAX;
+    fsw_slab_init(&vol->dnode_slab, fstype_table->dnode_struct_size);
+    fsw_slab_init(&vol->block_slab, vol->phys_blocksize);
+    fsw_slab_init(&vol->extent_slab, FSW_EXTENT_MAP_INITIAL * sizeof (struct fsw_extent));
+
+    // set up the dnode hash table before the driver creates the root dnode
+    status = fsw_alloc_zero(FSW_DNODE_HASH_INITIAL * sizeof (struct fsw_dnode *), (void **)&vol->dnode_hash);
+    if (status) {
+        fsw_free(vol);
+        return status;
+    }
+    vol->dnode_hash_size = FSW_DNODE_HASH_INITIAL;
 
     // let the fs driver mount the file system
     status = vol->fstype_table->volume_mount(vol);
@@ -98,6 +116,57 @@ errorexit:
     return status;
 }
 
+/**
+ * Mount a volume with the first of several file system drivers that accepts it.
+ * The drivers are tried in the order of the NULL-terminated fstype_tables list,
+ * so a host that serves several file system types needs only one driver binding.
+ *
+ * If the host passes the first bytes of the volume in probe_buffer (usually
+ * FSW_PROBE_SIZE of them), drivers whose probe function rejects them are skipped
+ * without a trial mount. Pass NULL to try every driver.
+ *
+ * Returns the status of the first driver that failed with something other than
+ * FSW_UNSUPPORTED, or FSW_UNSUPPORTED if no driver recognized the volume.
+ */
+
+fsw_status_t fsw_mount_any(void *host_data,
+                           struct fsw_host_table *host_table,
+                           struct fsw_fstype_table **fstype_tables,
+                           void *probe_buffer, fsw_u32 probe_size,
+                           struct fsw_volume **vol_out)
+{
+    fsw_status_t    status, result = FSW_UNSUPPORTED;
+
+    for (; *fstype_tables != NULL; fstype_tables++) {
+        if (probe_buffer != NULL &&
+            fsw_probe(*fstype_tables, probe_buffer, probe_size) == FSW_UNSUPPORTED)
+            continue;
+        status = fsw_mount(host_data, host_table, *fstype_tables, vol_out);
+        if (status == FSW_SUCCESS)
+            return FSW_SUCCESS;
+        if (status != FSW_UNSUPPORTED && result == FSW_UNSUPPORTED)
+            result = status;
+    }
+    return result;
+}
+
+/**
+ * Check cheaply whether a volume may hold the file system of a driver, given the
+ * first size bytes of the volume in buffer. This only looks at superblock magic
+ * and similar fields, so a host can turn down foreign partitions with one read
+ * instead of a full mount. Returns FSW_UNSUPPORTED if the driver's probe function
+ * rejects the volume, and FSW_SUCCESS otherwise, including for drivers that don't
+ * have a probe function; a successful probe does not guarantee that fsw_mount
+ * will succeed.
+ */
+
+fsw_status_t fsw_probe(struct fsw_fstype_table *fstype_table, void *buffer, fsw_u32 size)
+{
+    if (fstype_table->probe == NULL)
+        return FSW_SUCCESS;
+    return fstype_table->probe(buffer, size);
+}
+
 /**
  * Unmount a volume by releasing all memory associated with it. This function is
  * called by the host driver when a volume is no longer needed. It is also called
@@ -108,6 +177,7 @@ errorexit:
 
 void fsw_unmount(struct fsw_volume *vol)
 {
+    fsw_dcache_free(vol);
     if (vol->root)
         fsw_dnode_release(vol->root);
     // TODO: check that no other dnodes are still around
@@ -116,6 +186,9 @@ void fsw_unmount(struct fsw_volume *vol)
 
     fsw_blockcache_free(vol);
     fsw_strfree(&vol->label);
+    if (vol->dnode_hash != NULL)
+        fsw_free(vol->dnode_hash);
+    fsw_arena_free(vol);
     fsw_free(vol);
 }
 
@@ -129,6 +202,208 @@ fsw_status_t fsw_volume_stat(struct fsw_volume *vol, struct fsw_volume_stat *sb)
     return vol->fstype_table->volume_stat(vol, sb);
 }
 
+/**
+ * Take the host's lock for file system driver state that is shared between
+ * volumes, such as the list of mounted multi-device file systems. Does nothing
+ * on hosts that use one thread only.
+ */
+
+void fsw_host_lock(struct fsw_volume *vol)
+{
+    if (vol->host_table->lock != NULL)
+        vol->host_table->lock();
+}
+
+/**
+ * Release the lock taken by fsw_host_lock.
+ */
+
+void fsw_host_unlock(struct fsw_volume *vol)
+{
+    if (vol->host_table->unlock != NULL)
+        vol->host_table->unlock();
+}
+
+/**
+ * Copy the performance counters of the volume. Host drivers and test tools use this
+ * to report what a sequence of operations cost.
+ */
+
+void fsw_volume_perf_snapshot(struct fsw_volume *vol, struct fsw_volume_perf *perf_out)
+{
+    *perf_out = vol->perf;
+}
+
+/**
+ * Reset the performance counters of the volume to zero, including the driver-specific ones.
+ */
+
+void fsw_volume_perf_reset(struct fsw_volume *vol)
+{
+    const char * const *names;
+    fsw_u64     *values;
+    fsw_u32     count;
+
+    fsw_memzero(&vol->perf, sizeof (struct fsw_volume_perf));
+    if (vol->fstype_table->perf_counters != NULL) {
+        count = vol->fstype_table->perf_counters(vol, &names, &values);
+        fsw_memzero(values, count * sizeof (fsw_u64));
+    }
+}
+
+/**
+ * Copy the driver-specific performance counters of the volume, at most max of them.
+ * Returns the number of counters copied, zero if the driver has none.
+ */
+
+fsw_u32 fsw_volume_driver_counters(struct fsw_volume *vol, struct fsw_perf_counter *counters_out,
+                                   fsw_u32 max)
+{
+    const char * const *names;
+    fsw_u64     *values;
+    fsw_u32     count, i;
+
+    if (vol->fstype_table->perf_counters == NULL)
+        return 0;
+    count = vol->fstype_table->perf_counters(vol, &names, &values);
+    if (count > max)
+        count = max;
+    for (i = 0; i < count; i++) {
+        counters_out[i].name = names[i];
+        counters_out[i].value = values[i];
+    }
+    return count;
+}
+
+/**
+ * Read one block through the host driver, updating the performance counters.
+ */
+
+static fsw_status_t fsw_host_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
+{
+    fsw_status_t    status;
+    fsw_u64         start = 0;
+
+    if (vol->host_table->clock != NULL)
+        start = vol->host_table->clock();
+    status = vol->host_table->read_block(vol, phys_bno, buffer);
+    if (vol->host_table->clock != NULL)
+        vol->perf.io_time += vol->host_table->clock() - start;
+    vol->perf.read_block_calls++;
+    if (status == FSW_SUCCESS)
+        vol->perf.bytes_read += vol->phys_blocksize;
+    return status;
+}
+
+/**
+ * Read consecutive blocks through the host driver's optional read_blocks function,
+ * updating the performance counters.
+ */
+
+static fsw_status_t fsw_host_read_blocks(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer)
+{
+    fsw_status_t    status;
+    fsw_u64         start = 0;
+
+    if (vol->host_table->clock != NULL)
+        start = vol->host_table->clock();
+    status = vol->host_table->read_blocks(vol, phys_bno, count, buffer);
+    if (vol->host_table->clock != NULL)
+        vol->perf.io_time += vol->host_table->clock() - start;
+    vol->perf.read_blocks_calls++;
+    if (status == FSW_SUCCESS)
+        vol->perf.bytes_read += (fsw_u64)count * vol->phys_blocksize;
+    return status;
+}
+
+/**
+ * Queue of asynchronous reads issued on behalf of one core operation. Requests are
+ * started in order and completed oldest first; at most FSW_IO_QUEUE_DEPTH are in
+ * flight. Every queue must be drained with fsw_io_queue_wait before the operation
+ * returns, as the requests live on its stack.
+ */
+
+struct fsw_io_queue {
+    struct fsw_io_request req[FSW_IO_QUEUE_DEPTH];
+    fsw_u32         head;           //!< Index of the oldest request in flight
+    fsw_u32         pending;        //!< Number of requests in flight
+    fsw_status_t    status;         //!< First error reported by a completed request
+};
+
+static void fsw_io_queue_init(struct fsw_io_queue *q)
+{
+    q->head = 0;
+    q->pending = 0;
+    q->status = FSW_SUCCESS;
+}
+
+/**
+ * Complete the oldest request in flight.
+ */
+
+static void fsw_io_queue_complete(struct fsw_volume *vol, struct fsw_io_queue *q)
+{
+    fsw_status_t    status;
+    fsw_u64         start = 0;
+    struct fsw_io_request *req = &q->req[q->head];
+
+    if (vol->host_table->clock != NULL)
+        start = vol->host_table->clock();
+    status = vol->host_table->complete_read(vol, req);
+    if (vol->host_table->clock != NULL)
+        vol->perf.io_time += vol->host_table->clock() - start;
+    if (status == FSW_SUCCESS)
+        vol->perf.bytes_read += (fsw_u64)req->count * vol->phys_blocksize;
+    else if (q->status == FSW_SUCCESS)
+        q->status = status;
+
+    q->head = (q->head + 1) % FSW_IO_QUEUE_DEPTH;
+    q->pending--;
+}
+
+/**
+ * Read consecutive blocks, asynchronously if the host supports it. The data is only
+ * valid after fsw_io_queue_wait. Without asynchronous support on the host, or if the
+ * host refuses the request, the blocks are read right away through read_blocks.
+ */
+
+static fsw_status_t fsw_io_queue_read(struct fsw_volume *vol, struct fsw_io_queue *q,
+                                      fsw_u64 phys_bno, fsw_u32 count, void *buffer)
+{
+    struct fsw_io_request *req;
+
+    if (vol->host_table->submit_read != NULL) {
+        if (q->pending == FSW_IO_QUEUE_DEPTH)
+            fsw_io_queue_complete(vol, q);
+
+        req = &q->req[(q->head + q->pending) % FSW_IO_QUEUE_DEPTH];
+        req->phys_bno = phys_bno;
+        req->count = count;
+        req->buffer = buffer;
+        req->host_data = NULL;
+        req->next = NULL;
+        if (vol->host_table->submit_read(vol, req) == FSW_SUCCESS) {
+            q->pending++;
+            vol->perf.read_async_calls++;
+            if (vol->perf.read_async_peak < q->pending)
+                vol->perf.read_async_peak = q->pending;
+            return FSW_SUCCESS;
+        }
+    }
+    return fsw_host_read_blocks(vol, phys_bno, count, buffer);
+}
+
+/**
+ * Wait for all requests of the queue and return the first error, if any.
+ */
+
+static fsw_status_t fsw_io_queue_wait(struct fsw_volume *vol, struct fsw_io_queue *q)
+{
+    while (q->pending > 0)
+        fsw_io_queue_complete(vol, q);
+    return q->status;
+}
+
 /**
  * Set the physical and logical block sizes of the volume. This functions is called by
  * the file system driver to announce the block sizes it wants to use for accessing
@@ -149,8 +424,9 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
     // TODO: Check the sizes. Both must be powers of 2. log_blocksize must not be smaller than
     //  phys_blocksize.
 
-    // drop core block cache if present
+    // drop core block cache and lookup cache if present
     fsw_blockcache_free(vol);
+    fsw_dcache_flush(vol);
 
     // signal host driver to drop caches etc.
     vol->host_table->change_blocksize(vol,
@@ -159,6 +435,320 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
 
     vol->phys_blocksize = phys_blocksize;
     vol->log_blocksize = log_blocksize;
+
+    // all block buffers are back on the free list; size them for the new block size
+    if (vol->block_slab.object_size != ((phys_blocksize + 7) & ~7))
+        fsw_slab_init(&vol->block_slab, phys_blocksize);
+}
+
+/**
+ * Allocate memory from the volume's arena. The memory stays with the arena until
+ * the volume is unmounted; callers recycle it through a slab's free list.
+ * The size must be a multiple of 8.
+ */
+
+static fsw_status_t fsw_arena_alloc(struct fsw_volume *vol, fsw_u32 size, void **ptr_out)
+{
+    fsw_status_t    status;
+    struct fsw_arena *arena = &vol->arena;
+    fsw_u32         header_size = (sizeof (void *) + 7) & ~7;
+    fsw_u32         chunk_size;
+    void            *chunk;
+
+    if (arena->free_bytes < size) {
+        chunk_size = header_size + size;
+        if (chunk_size < FSW_ARENA_CHUNK_SIZE)
+            chunk_size = FSW_ARENA_CHUNK_SIZE;
+        status = fsw_alloc(chunk_size, &chunk);
+        if (status)
+            return status;
+        *(void **)chunk = arena->chunks;
+        arena->chunks = chunk;
+        arena->chunk_count++;
+        arena->bytes += chunk_size;
+        arena->free_ptr = (fsw_u8 *)chunk + header_size;
+        arena->free_bytes = chunk_size - header_size;
+    }
+
+    *ptr_out = arena->free_ptr;
+    arena->free_ptr += size;
+    arena->free_bytes -= size;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Release all memory of the volume's arena in one step. Called when unmounting
+ * the volume, after everything allocated from the slabs has been given back.
+ */
+
+static void fsw_arena_free(struct fsw_volume *vol)
+{
+    void            *chunk;
+
+    while (vol->arena.chunks != NULL) {
+        chunk = vol->arena.chunks;
+        vol->arena.chunks = *(void **)chunk;
+        fsw_free(chunk);
+    }
+    vol->arena.free_ptr = NULL;
+    vol->arena.free_bytes = 0;
+}
+
+/**
+ * Set up a slab for objects of the given size. Objects that are still on the free
+ * list are abandoned to the arena.
+ */
+
+static void fsw_slab_init(struct fsw_slab *slab, fsw_u32 object_size)
+{
+    if (object_size < sizeof (void *))
+        object_size = sizeof (void *);
+    slab->object_size = (object_size + 7) & ~7;
+    slab->free_list = NULL;
+}
+
+/**
+ * Allocate an object from a slab. The memory is not cleared.
+ */
+
+static fsw_status_t fsw_slab_alloc(struct fsw_volume *vol, struct fsw_slab *slab, void **ptr_out)
+{
+    fsw_status_t    status;
+
+    if (slab->free_list != NULL) {
+        *ptr_out = slab->free_list;
+        slab->free_list = *(void **)slab->free_list;
+    } else {
+        status = fsw_arena_alloc(vol, slab->object_size, ptr_out);
+        if (status)
+            return status;
+    }
+
+    slab->in_use++;
+    slab->allocs++;
+    vol->arena.live_bytes += slab->object_size;
+    if (vol->arena.peak_bytes < vol->arena.live_bytes)
+        vol->arena.peak_bytes = vol->arena.live_bytes;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Return an object to its slab.
+ */
+
+static void fsw_slab_free(struct fsw_volume *vol, struct fsw_slab *slab, void *ptr)
+{
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    vol->arena.live_bytes -= slab->object_size;
+}
+
+/**
+ * Compute the home slot of a physical block number in the block cache index.
+ * Fibonacci hashing on the folded block number; only 32-bit multiplication is
+ * used so that this stays cheap on IA32 firmware.
+ */
+
+static fsw_u32 fsw_blockcache_hash(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    fsw_u32 folded = (fsw_u32)phys_bno ^ (fsw_u32)FSW_U64_SHR(phys_bno, 32);
+
+    return (fsw_u32)(folded * 0x9E3779B1U) >> (32 - vol->bcache_hash_bits);
+}
+
+/**
+ * Find the block cache entry holding a physical block. Returns the index of the
+ * entry, or vol->bcache_size if the block is not cached. If slot_out is not NULL,
+ * it receives the index slot that refers to the entry.
+ */
+
+static fsw_u32 fsw_blockcache_find(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 *slot_out)
+{
+    fsw_u32 mask, slot, entry;
+
+    if (vol->bcache_hash == NULL)
+        return vol->bcache_size;
+
+    mask = (1UL << vol->bcache_hash_bits) - 1;
+    for (slot = fsw_blockcache_hash(vol, phys_bno); (entry = vol->bcache_hash[slot]) != 0; slot = (slot + 1) & mask) {
+        if (vol->bcache[entry - 1].phys_bno == phys_bno) {
+            if (slot_out != NULL)
+                *slot_out = slot;
+            return entry - 1;
+        }
+    }
+    return vol->bcache_size;
+}
+
+/**
+ * Enter a block cache entry into the index. The entry's phys_bno must be valid
+ * and not yet present in the index.
+ */
+
+static void fsw_blockcache_index(struct fsw_volume *vol, fsw_u32 i)
+{
+    fsw_u32 mask = (1UL << vol->bcache_hash_bits) - 1;
+    fsw_u32 slot;
+
+    for (slot = fsw_blockcache_hash(vol, vol->bcache[i].phys_bno); vol->bcache_hash[slot] != 0; slot = (slot + 1) & mask)
+        ;
+    vol->bcache_hash[slot] = i + 1;
+}
+
+/**
+ * Remove a block cache entry from the index and mark it as empty. Uses backward
+ * shift deletion so that lookups never need tombstones.
+ */
+
+static void fsw_blockcache_unindex(struct fsw_volume *vol, fsw_u32 i)
+{
+    fsw_u32 mask, hole, slot, home;
+
+    if (vol->bcache[i].phys_bno == (fsw_u64)FSW_INVALID_BNO)
+        return;
+    if (fsw_blockcache_find(vol, vol->bcache[i].phys_bno, &hole) < vol->bcache_size) {
+        mask = (1UL << vol->bcache_hash_bits) - 1;
+        vol->bcache_hash[hole] = 0;
+        for (slot = (hole + 1) & mask; vol->bcache_hash[slot] != 0; slot = (slot + 1) & mask) {
+            home = fsw_blockcache_hash(vol, vol->bcache[vol->bcache_hash[slot] - 1].phys_bno);
+            // move the entry into the hole unless its home lies cyclically in (hole, slot]
+            if ((slot > hole) ? (home <= hole || home > slot) : (home <= hole && home > slot)) {
+                vol->bcache_hash[hole] = vol->bcache_hash[slot];
+                vol->bcache_hash[slot] = 0;
+                hole = slot;
+            }
+        }
+    }
+    vol->bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
+}
+
+/**
+ * Enlarge the block cache array and rebuild its index. The array doubles until it
+ * reaches the number of blocks allowed by the volume's memory budget. It only grows
+ * beyond that when every entry is referenced and nothing can be evicted.
+ */
+
+static fsw_status_t fsw_blockcache_grow(struct fsw_volume *vol)
+{
+    fsw_status_t    status;
+    fsw_u32         i, new_bcache_size, budget_size, hash_bits;
+    struct fsw_blockcache *new_bcache;
+    fsw_u32         *new_hash;
+
+    budget_size = vol->bcache_budget / vol->phys_blocksize;
+    if (vol->bcache_size < 16)
+        new_bcache_size = 16;
+    else
+        new_bcache_size = vol->bcache_size << 1;
+    if (vol->bcache_size < budget_size && new_bcache_size > budget_size)
+        new_bcache_size = budget_size;
+
+    // the index is kept at most half full
+    for (hash_bits = 1; (1UL << hash_bits) < new_bcache_size * 2; hash_bits++)
+        ;
+
+    status = fsw_alloc(new_bcache_size * sizeof (struct fsw_blockcache), &new_bcache);
+    if (status)
+        return status;
+    status = fsw_alloc_zero((1UL << hash_bits) * sizeof (fsw_u32), (void **)&new_hash);
+    if (status) {
+        fsw_free(new_bcache);
+        return status;
+    }
+    if (vol->bcache_size > 0)
+        fsw_memcpy(new_bcache, vol->bcache, vol->bcache_size * sizeof (struct fsw_blockcache));
+    for (i = vol->bcache_size; i < new_bcache_size; i++) {
+        new_bcache[i].refcount = 0;
+        new_bcache[i].cache_level = 0;
+        new_bcache[i].clock_weight = 0;
+        new_bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
+        new_bcache[i].data = NULL;
+    }
+
+    // switch caches
+    if (vol->bcache != NULL)
+        fsw_free(vol->bcache);
+    if (vol->bcache_hash != NULL)
+        fsw_free(vol->bcache_hash);
+    vol->bcache = new_bcache;
+    vol->bcache_size = new_bcache_size;
+    vol->bcache_hash = new_hash;
+    vol->bcache_hash_bits = hash_bits;
+
+    for (i = 0; i < vol->bcache_used; i++) {
+        if (vol->bcache[i].phys_bno != (fsw_u64)FSW_INVALID_BNO)
+            fsw_blockcache_index(vol, i);
+    }
+    return FSW_SUCCESS;
+}
+
+/**
+ * Pick a block cache entry to reuse. This is a generalized CLOCK: each entry
+ * carries a weight derived from its cache level, and the hand decrements the
+ * weight of every unreferenced entry it passes. An entry is evicted when the
+ * hand finds its weight at zero, so blocks with a higher cache level survive
+ * proportionally more sweeps than file data. Returns vol->bcache_size if every
+ * entry is currently referenced.
+ */
+
+static fsw_u32 fsw_blockcache_evict(struct fsw_volume *vol)
+{
+    fsw_u32 i, steps;
+    struct fsw_blockcache *bc;
+
+    for (steps = vol->bcache_used * (MAX_CACHE_LEVEL + 2); steps > 0; steps--) {
+        i = vol->bcache_hand;
+        if (++vol->bcache_hand >= vol->bcache_used)
+            vol->bcache_hand = 0;
+
+        bc = &vol->bcache[i];
+        if (bc->refcount > 0)
+            continue;
+        if (bc->phys_bno != (fsw_u64)FSW_INVALID_BNO && bc->clock_weight > 0) {
+            bc->clock_weight--;
+            continue;
+        }
+        fsw_blockcache_unindex(vol, i);
+        return i;
+    }
+    return vol->bcache_size;
+}
+
+/**
+ * Pick a block cache entry for new data: a never-used one, else a recycled one once
+ * the memory budget is exhausted, else a new one from a grown cache. The entry is
+ * not indexed yet and has its data buffer allocated.
+ */
+
+static fsw_status_t fsw_blockcache_slot(struct fsw_volume *vol, fsw_u32 *index_out)
+{
+    fsw_status_t    status;
+    fsw_u32         i;
+    struct fsw_blockcache *bc;
+
+    // find a never-used entry, else recycle one once the budget is exhausted
+    i = vol->bcache_size;
+    if (vol->bcache_used < vol->bcache_size)
+        i = vol->bcache_used++;
+    else if (vol->bcache_size >= vol->bcache_budget / vol->phys_blocksize)
+        i = fsw_blockcache_evict(vol);
+    if (i >= vol->bcache_size) {
+        // enlarge / create the cache
+        status = fsw_blockcache_grow(vol);
+        if (status)
+            return status;
+        i = vol->bcache_used++;
+    }
+    bc = &vol->bcache[i];
+
+    if (bc->data == NULL) {
+        status = fsw_slab_alloc(vol, &vol->block_slab, &bc->data);
+        if (status)
+            return status;
+    }
+    *index_out = i;
+    return FSW_SUCCESS;
 }
 
 /**
@@ -174,6 +764,9 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
  *  - 2: File system metadata
  *  - 3..5: File system metadata with a high rate of access
  *
+ * The cache grows until it holds vol->bcache_budget bytes of block data; from then on
+ * entries are recycled in CLOCK order, weighted by cache level.
+ *
  * If this function returns successfully, the returned data pointer is valid until the
  * caller calls fsw_block_release.
  */
@@ -181,8 +774,8 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
 fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level, void **buffer_out)
 {
     fsw_status_t    status;
-    fsw_u32         i, discard_level, new_bcache_size;
-    struct fsw_blockcache *new_bcache;
+    fsw_u32         i;
+    struct fsw_blockcache *bc;
 
     // TODO: allow the host driver to do its own caching; just call through if
     //  the appropriate function pointers are set
@@ -191,76 +784,86 @@ fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32
         cache_level = MAX_CACHE_LEVEL;
 
     // check block cache
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == phys_bno) {
-            // cache hit!
-            if (vol->bcache[i].cache_level < cache_level)
-                vol->bcache[i].cache_level = cache_level;  // promote the entry
-            vol->bcache[i].refcount++;
-            *buffer_out = vol->bcache[i].data;
-            return FSW_SUCCESS;
-        }
-    }
-
-    // find a free entry in the cache table
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == (fsw_u64)FSW_INVALID_BNO)
-            break;
-    }
-    if (i >= vol->bcache_size) {
-        for (discard_level = 0; discard_level <= MAX_CACHE_LEVEL; discard_level++) {
-            for (i = 0; i < vol->bcache_size; i++) {
-                if (vol->bcache[i].refcount == 0 && vol->bcache[i].cache_level <= discard_level)
-                    break;
-            }
-            if (i < vol->bcache_size)
-                break;
-        }
-    }
-    if (i >= vol->bcache_size) {
-        // enlarge / create the cache
-        if (vol->bcache_size < 16)
-            new_bcache_size = 16;
-        else
-            new_bcache_size = vol->bcache_size << 1;
-        status = fsw_alloc(new_bcache_size * sizeof (struct fsw_blockcache), &new_bcache);
-        if (status)
-            return status;
-        if (vol->bcache_size > 0)
-            fsw_memcpy(new_bcache, vol->bcache, vol->bcache_size * sizeof (struct fsw_blockcache));
-        for (i = vol->bcache_size; i < new_bcache_size; i++) {
-            new_bcache[i].refcount = 0;
-            new_bcache[i].cache_level = 0;
-            new_bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
-            new_bcache[i].data = NULL;
-        }
-        i = vol->bcache_size;
-
-        // switch caches
-        if (vol->bcache != NULL)
-            fsw_free(vol->bcache);
-        vol->bcache = new_bcache;
-        vol->bcache_size = new_bcache_size;
+    i = fsw_blockcache_find(vol, phys_bno, NULL);
+    if (i < vol->bcache_size) {
+        // cache hit!
+        bc = &vol->bcache[i];
+        if (bc->cache_level < cache_level)
+            bc->cache_level = cache_level;  // promote the entry
+        bc->clock_weight = bc->cache_level + 1;
+        bc->refcount++;
+        vol->perf.bcache_hits[cache_level]++;
+        *buffer_out = bc->data;
+        return FSW_SUCCESS;
     }
-    vol->bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
+    vol->perf.bcache_misses[cache_level]++;
 
     // read the data
-    if (vol->bcache[i].data == NULL) {
-        status = fsw_alloc(vol->phys_blocksize, &vol->bcache[i].data);
-        if (status)
-            return status;
-    }
-    status = vol->host_table->read_block(vol, phys_bno, vol->bcache[i].data);
+    status = fsw_blockcache_slot(vol, &i);
+    if (status)
+        return status;
+    bc = &vol->bcache[i];
+    status = fsw_host_read_block(vol, phys_bno, bc->data);
     if (status)
         return status;
 
-    vol->bcache[i].phys_bno = phys_bno;
-    vol->bcache[i].cache_level = cache_level;
-    vol->bcache[i].refcount = 1;
-    *buffer_out = vol->bcache[i].data;
+    bc->phys_bno = phys_bno;
+    bc->cache_level = cache_level;
+    bc->clock_weight = cache_level + 1;
+    bc->refcount = 1;
+    fsw_blockcache_index(vol, i);
+    *buffer_out = bc->data;
     return FSW_SUCCESS;
 }
 
+/**
+ * Read a run of consecutive disk blocks into the block cache with a single host
+ * call, ahead of metadata accesses that will ask for them one by one. Blocks
+ * already cached are kept as they are. Nothing is done if the host has no
+ * read_blocks function or if at most one block is missing at the ends of the run;
+ * fsw_block_get reads that one just as well.
+ */
+
+void fsw_block_prefetch(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 count, fsw_u32 cache_level)
+{
+    fsw_u8          *buffer;
+    fsw_u32         i, j;
+    struct fsw_blockcache *bc;
+
+    if (vol->host_table->read_blocks == NULL)
+        return;
+    if (cache_level > MAX_CACHE_LEVEL)
+        cache_level = MAX_CACHE_LEVEL;
+
+    while (count > 0 && fsw_blockcache_find(vol, phys_bno, NULL) < vol->bcache_size) {
+        phys_bno++;
+        count--;
+    }
+    while (count > 0 && fsw_blockcache_find(vol, phys_bno + count - 1, NULL) < vol->bcache_size)
+        count--;
+    if (count < 2)
+        return;
+
+    if (fsw_alloc(count * vol->phys_blocksize, &buffer))
+        return;
+    if (fsw_host_read_blocks(vol, phys_bno, count, buffer) == FSW_SUCCESS) {
+        for (i = 0; i < count; i++) {
+            if (fsw_blockcache_find(vol, phys_bno + i, NULL) < vol->bcache_size)
+                continue;
+            if (fsw_blockcache_slot(vol, &j))
+                break;
+            bc = &vol->bcache[j];
+            fsw_memcpy(bc->data, buffer + i * vol->phys_blocksize, vol->phys_blocksize);
+            bc->phys_bno = phys_bno + i;
+            bc->cache_level = cache_level;
+            bc->clock_weight = cache_level + 1;
+            bc->refcount = 0;
+            fsw_blockcache_index(vol, j);
+        }
+    }
+    fsw_free(buffer);
+}
+
 /**
  * Releases a disk block. This function must be called to release disk blocks returned
  * from fsw_block_get.
@@ -274,10 +877,9 @@ void fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer
     //  the appropriate function pointers are set
 
     // update block cache
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == phys_bno && vol->bcache[i].refcount > 0)
-            vol->bcache[i].refcount--;
-    }
+    i = fsw_blockcache_find(vol, phys_bno, NULL);
+    if (i < vol->bcache_size && vol->bcache[i].refcount > 0)
+        vol->bcache[i].refcount--;
 }
 
 /**
@@ -291,29 +893,126 @@ static void fsw_blockcache_free(struct fsw_volume *vol)
 
     for (i = 0; i < vol->bcache_size; i++) {
         if (vol->bcache[i].data != NULL)
-            fsw_free(vol->bcache[i].data);
+            fsw_slab_free(vol, &vol->block_slab, vol->bcache[i].data);
     }
     if (vol->bcache != NULL) {
         fsw_free(vol->bcache);
         vol->bcache = NULL;
     }
+    if (vol->bcache_hash != NULL) {
+        fsw_free(vol->bcache_hash);
+        vol->bcache_hash = NULL;
+    }
     vol->bcache_size = 0;
-    fsw_efi_clear_cache();
+    vol->bcache_used = 0;
+    vol->bcache_hand = 0;
+    vol->bcache_hash_bits = 0;
+}
+
+/**
+ * Compute the dnode hash table bucket for a (tree_id, dnode_id) pair.
+ */
+
+static fsw_u32 fsw_dnode_hash(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id)
+{
+    fsw_u32 folded;
+
+    folded = (fsw_u32)dnode_id ^ (fsw_u32)FSW_U64_SHR(dnode_id, 32);
+    folded ^= ((fsw_u32)tree_id ^ (fsw_u32)FSW_U64_SHR(tree_id, 32)) * 0x85EBCA6BU;
+    folded = (fsw_u32)(folded * 0x9E3779B1U);
+    return (folded ^ (folded >> 16)) & (vol->dnode_hash_size - 1);
+}
+
+/**
+ * Double the number of buckets in the dnode hash table. This is best effort:
+ * if memory is short, the old table is kept and the chains simply get longer.
+ */
+
+static void fsw_dnode_hash_grow(struct fsw_volume *vol)
+{
+    struct fsw_dnode **old_hash = vol->dnode_hash;
+    fsw_u32         old_size = vol->dnode_hash_size;
+    fsw_u32         i, bucket;
+    struct fsw_dnode *dno, *next;
+
+    if (fsw_alloc_zero(old_size * 2 * sizeof (struct fsw_dnode *), (void **)&vol->dnode_hash)) {
+        vol->dnode_hash = old_hash;
+        return;
+    }
+    vol->dnode_hash_size = old_size * 2;
+
+    for (i = 0; i < old_size; i++) {
+        for (dno = old_hash[i]; dno; dno = next) {
+            next = dno->hash_next;
+            bucket = fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id);
+            dno->hash_next = vol->dnode_hash[bucket];
+            vol->dnode_hash[bucket] = dno;
+        }
+    }
+    fsw_free(old_hash);
 }
 
 /**
  * Add a new dnode to the list of known dnodes. This internal function is used when a
- * dnode is created to add it to the dnode list that is used to search for existing
- * dnodes by id.
+ * dnode is created to add it to the dnode list and to the hash table that is used to
+ * search for existing dnodes by id.
  */
 
 static void fsw_dnode_register(struct fsw_volume *vol, struct fsw_dnode *dno)
 {
+    fsw_u32 bucket;
+
     dno->next = vol->dnode_head;
     if (vol->dnode_head != NULL)
         vol->dnode_head->prev = dno;
     dno->prev = NULL;
     vol->dnode_head = dno;
+
+    if (++vol->dnode_count > vol->dnode_hash_size)
+        fsw_dnode_hash_grow(vol);
+    bucket = fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id);
+    dno->hash_next = vol->dnode_hash[bucket];
+    vol->dnode_hash[bucket] = dno;
+}
+
+/**
+ * Remove a dnode from the list and hash table of known dnodes. Called when the
+ * last reference to the dnode is released.
+ */
+
+static void fsw_dnode_unregister(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    struct fsw_dnode **link;
+
+    if (dno->next)
+        dno->next->prev = dno->prev;
+    if (dno->prev)
+        dno->prev->next = dno->next;
+    if (vol->dnode_head == dno)
+        vol->dnode_head = dno->next;
+
+    for (link = &vol->dnode_hash[fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id)]; *link; link = &(*link)->hash_next) {
+        if (*link == dno) {
+            *link = dno->hash_next;
+            vol->dnode_count--;
+            break;
+        }
+    }
+}
+
+/**
+ * Find a registered dnode by id. Returns NULL if there is none.
+ */
+
+static struct fsw_dnode * fsw_dnode_find(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id)
+{
+    struct fsw_dnode *dno;
+
+    for (dno = vol->dnode_hash[fsw_dnode_hash(vol, tree_id, dnode_id)]; dno; dno = dno->hash_next) {
+        if (dno->dnode_id == dnode_id && dno->tree_id == tree_id)
+            return dno;
+    }
+    return NULL;
 }
 
 /**
@@ -329,9 +1028,11 @@ fsw_status_t fsw_dnode_create_root_with_tree(struct fsw_volume *vol, fsw_u64 tre
     struct fsw_dnode *dno;
 
     // allocate memory for the structure
-    status = fsw_alloc_zero(vol->fstype_table->dnode_struct_size, (void **)&dno);
+    status = fsw_slab_alloc(vol, &vol->dnode_slab, (void **)&dno);
     if (status)
         return status;
+    fsw_memzero(dno, vol->fstype_table->dnode_struct_size);
+    vol->perf.dnodes_created++;
 
     // fill the structure
     dno->vol = vol;
@@ -379,18 +1080,19 @@ fsw_status_t fsw_dnode_create_with_tree(struct fsw_dnode *parent_dno, fsw_u64 tr
     struct fsw_dnode *dno;
 
     // check if we already have a dnode with the same id
-    for (dno = vol->dnode_head; dno; dno = dno->next) {
-        if (dno->dnode_id == dnode_id && dno->tree_id == tree_id) {
-            fsw_dnode_retain(dno);
-            *dno_out = dno;
-            return FSW_SUCCESS;
-        }
+    dno = fsw_dnode_find(vol, tree_id, dnode_id);
+    if (dno != NULL) {
+        fsw_dnode_retain(dno);
+        *dno_out = dno;
+        return FSW_SUCCESS;
     }
 
     // allocate memory for the structure
-    status = fsw_alloc_zero(vol->fstype_table->dnode_struct_size, (void **)&dno);
+    status = fsw_slab_alloc(vol, &vol->dnode_slab, (void **)&dno);
     if (status)
         return status;
+    fsw_memzero(dno, vol->fstype_table->dnode_struct_size);
+    vol->perf.dnodes_created++;
 
     // fill the structure
     dno->vol = vol;
@@ -402,7 +1104,7 @@ fsw_status_t fsw_dnode_create_with_tree(struct fsw_dnode *parent_dno, fsw_u64 tr
     dno->refcount = 1;
     status = fsw_strdup_coerce(&dno->name, vol->host_table->native_string_type, name);
     if (status) {
-        fsw_free(dno);
+        fsw_slab_free(vol, &vol->dnode_slab, dno);
         return status;
     }
 
@@ -446,19 +1148,16 @@ void fsw_dnode_release(struct fsw_dnode *dno)
     if (dno->refcount == 0) {
         parent_dno = dno->parent;
 
-        // de-register from volume's list
-        if (dno->next)
-            dno->next->prev = dno->prev;
-        if (dno->prev)
-            dno->prev->next = dno->next;
-        if (vol->dnode_head == dno)
-            vol->dnode_head = dno->next;
+        // de-register from volume's list and hash table
+        fsw_dnode_unregister(vol, dno);
 
         // run fstype-specific cleanup
         vol->fstype_table->dnode_free(vol, dno);
 
+        if (dno->extent_map != NULL)
+            fsw_extent_map_free(vol, dno);
         fsw_strfree(&dno->name);
-        fsw_free(dno);
+        fsw_slab_free(vol, &vol->dnode_slab, dno);
 
         // release our pointer to the parent, possibly deallocating it, too
         if (parent_dno)
@@ -509,6 +1208,172 @@ fsw_status_t fsw_dnode_stat(struct fsw_dnode *dno, struct fsw_dnode_stat *sb)
     return status;
 }
 
+/**
+ * Hash a name looked up in a parent directory. The name is hashed by character
+ * value, so ISO-8859-1 and UTF-16 spellings of the same ASCII name agree.
+ */
+
+static fsw_u32 fsw_dcache_hash(struct fsw_dnode *parent, struct fsw_string *name)
+{
+    fsw_u32         hash = 2166136261U, c;
+    int             i;
+
+    for (i = 0; i < name->len; i++) {
+        if (name->type == FSW_STRING_TYPE_UTF16)
+            c = ((fsw_u16 *)name->data)[i];
+        else if (name->type == FSW_STRING_TYPE_UTF16_SWAPPED)
+            c = FSW_SWAPVALUE_U16(((fsw_u16 *)name->data)[i]);
+        else
+            c = ((fsw_u8 *)name->data)[i];
+        hash = (hash ^ c) * 16777619U;
+    }
+    hash ^= (fsw_u32)parent->dnode_id * 0x9E3779B1U;
+    hash ^= (fsw_u32)parent->tree_id * 0x85EBCA6BU;
+    return hash ^ (hash >> 15);
+}
+
+/**
+ * Drop an entry from the directory lookup cache, releasing the dnodes it retains.
+ */
+
+static void fsw_dcache_drop(struct fsw_volume *vol, struct fsw_dentry *entry)
+{
+    struct fsw_dentry **link;
+
+    for (link = &vol->dcache_hash[entry->hash & (FSW_DCACHE_SIZE - 1)]; *link; link = &(*link)->hash_next) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+    }
+    fsw_strfree(&entry->name);
+    if (entry->child != NULL)
+        fsw_dnode_release(entry->child);
+    fsw_dnode_release(entry->parent);
+    entry->parent = NULL;
+    entry->child = NULL;
+}
+
+/**
+ * Record the result of a directory lookup in the cache. Entries are recycled in
+ * CLOCK order. This is best effort; if memory is short, nothing is recorded.
+ */
+
+static void fsw_dcache_add(struct fsw_volume *vol, struct fsw_dnode *parent, struct fsw_string *name,
+                           fsw_u32 hash, struct fsw_dnode *child)
+{
+    struct fsw_dentry *entry;
+
+    if (vol->dcache == NULL) {
+        if (fsw_alloc_zero(FSW_DCACHE_SIZE * sizeof (struct fsw_dentry), (void **)&vol->dcache))
+            return;
+        if (fsw_alloc_zero(FSW_DCACHE_SIZE * sizeof (struct fsw_dentry *), (void **)&vol->dcache_hash)) {
+            fsw_free(vol->dcache);
+            vol->dcache = NULL;
+            return;
+        }
+    }
+
+    // advance the hand to a free or unreferenced entry
+    for (;;) {
+        entry = &vol->dcache[vol->dcache_hand];
+        vol->dcache_hand = (vol->dcache_hand + 1) & (FSW_DCACHE_SIZE - 1);
+        if (entry->parent == NULL || !entry->referenced)
+            break;
+        entry->referenced = 0;
+    }
+    if (entry->parent != NULL)
+        fsw_dcache_drop(vol, entry);
+
+    if (fsw_strdup_coerce(&entry->name, name->type, name))
+        return;
+    entry->parent = parent;
+    fsw_dnode_retain(parent);
+    entry->child = child;
+    if (child != NULL)
+        fsw_dnode_retain(child);
+    entry->hash = hash;
+    entry->referenced = 0;
+    entry->hash_next = vol->dcache_hash[hash & (FSW_DCACHE_SIZE - 1)];
+    vol->dcache_hash[hash & (FSW_DCACHE_SIZE - 1)] = entry;
+}
+
+/**
+ * Drop all entries from the directory lookup cache.
+ */
+
+static void fsw_dcache_flush(struct fsw_volume *vol)
+{
+    fsw_u32 i;
+
+    if (vol->dcache == NULL)
+        return;
+    for (i = 0; i < FSW_DCACHE_SIZE; i++) {
+        if (vol->dcache[i].parent != NULL)
+            fsw_dcache_drop(vol, &vol->dcache[i]);
+    }
+    vol->dcache_hand = 0;
+}
+
+/**
+ * Release the directory lookup cache. Called when unmounting the volume, before
+ * the root dnode is released.
+ */
+
+static void fsw_dcache_free(struct fsw_volume *vol)
+{
+    fsw_dcache_flush(vol);
+    if (vol->dcache != NULL) {
+        fsw_free(vol->dcache);
+        vol->dcache = NULL;
+    }
+    if (vol->dcache_hash != NULL) {
+        fsw_free(vol->dcache_hash);
+        vol->dcache_hash = NULL;
+    }
+}
+
+/**
+ * Look up a name in a directory through the directory lookup cache. Positive and
+ * negative results of the file system driver's dir_lookup are remembered, so that
+ * repeated probes of the same path do not go to the disk again. The caller has
+ * made sure that dno is a directory.
+ */
+
+static fsw_status_t fsw_dnode_cached_lookup(struct fsw_dnode *dno,
+                                            struct fsw_string *lookup_name, struct fsw_dnode **child_dno_out)
+{
+    fsw_status_t    status;
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_dentry *entry;
+    fsw_u32         hash;
+
+    hash = fsw_dcache_hash(dno, lookup_name);
+    if (vol->dcache_hash != NULL) {
+        for (entry = vol->dcache_hash[hash & (FSW_DCACHE_SIZE - 1)]; entry; entry = entry->hash_next) {
+            if (entry->hash == hash && entry->parent == dno && fsw_streq(&entry->name, lookup_name)) {
+                entry->referenced = 1;
+                if (entry->child == NULL) {
+                    vol->perf.dcache_negative_hits++;
+                    return FSW_NOT_FOUND;
+                }
+                vol->perf.dcache_hits++;
+                fsw_dnode_retain(entry->child);
+                *child_dno_out = entry->child;
+                return FSW_SUCCESS;
+            }
+        }
+    }
+
+    vol->perf.dir_lookup_calls++;
+    status = vol->fstype_table->dir_lookup(vol, dno, lookup_name, child_dno_out);
+    if (status == FSW_SUCCESS)
+        fsw_dcache_add(vol, dno, lookup_name, hash, *child_dno_out);
+    else if (status == FSW_NOT_FOUND)
+        fsw_dcache_add(vol, dno, lookup_name, hash, NULL);
+    return status;
+}
+
 /**
  * Lookup a directory entry by name. This function is called by the host driver.
  * Given a directory dnode and a file name, it looks up the named entry in the
@@ -532,7 +1397,7 @@ fsw_status_t fsw_dnode_lookup(struct fsw_dnode *dno,
     if (dno->type != FSW_DNODE_TYPE_DIR)
         return FSW_UNSUPPORTED;
 
-    return dno->vol->fstype_table->dir_lookup(dno->vol, dno, lookup_name, child_dno_out);
+    return fsw_dnode_cached_lookup(dno, lookup_name, child_dno_out);
 }
 
 /**
@@ -624,7 +1489,7 @@ fsw_status_t fsw_dnode_lookup_path(struct fsw_dnode *dno,
 
             } else {
                 // do an actual lookup
-                status = vol->fstype_table->dir_lookup(vol, dno, &lookup_name, &child_dno);
+                status = fsw_dnode_cached_lookup(dno, &lookup_name, &child_dno);
                 if (status)
                     goto errorexit;
             }
@@ -677,6 +1542,85 @@ fsw_status_t fsw_dnode_dir_read(struct fsw_shandle *shand, struct fsw_dnode **ch
     return status;
 }
 
+/**
+ * Get the next batch of directory items, filled. This is the readdir-plus variant
+ * of fsw_dnode_dir_read for hosts that need the metadata of every entry, e.g. to
+ * return EFI_FILE_INFO records. Up to *count_inout (at most FSW_DIR_READ_PLUS_MAX)
+ * entries are read first and sorted by the disk block holding their metadata, as
+ * reported by the driver's optional dnode_locate function (ext2/ext4 inode tables,
+ * the NTFS MFT). Entries it cannot locate follow, sorted by dnode id. Nearby
+ * metadata blocks of the located entries are read into the block cache with one
+ * host call per run, then all entries are filled in that order, so a listing no
+ * longer costs one scattered read per entry.
+ *
+ * On return, child_dnos holds the entries in directory order and *count_inout their
+ * number; zero means the end of the directory was reached. The caller must call
+ * fsw_dnode_release on each of them. Errors from filling single entries are not
+ * reported here; they show up again when the caller fills or stats the entry.
+ */
+
+fsw_status_t fsw_dnode_dir_read_plus(struct fsw_shandle *shand, struct fsw_dnode **child_dnos, fsw_u32 *count_inout)
+{
+    fsw_status_t    status = FSW_SUCCESS;
+    struct fsw_volume *vol = shand->dnode->vol;
+    struct fsw_dnode *dno;
+    fsw_u32         count, max, i, j;
+    fsw_u32         order[FSW_DIR_READ_PLUS_MAX];
+    fsw_u64         key[FSW_DIR_READ_PLUS_MAX];
+    fsw_u8          located[FSW_DIR_READ_PLUS_MAX];
+    fsw_u32         located_count = 0;
+    fsw_u64         run_start, run_end;
+
+    max = *count_inout;
+    if (max > FSW_DIR_READ_PLUS_MAX)
+        max = FSW_DIR_READ_PLUS_MAX;
+
+    // collect the entries, keeping them sorted by location through insertion
+    for (count = 0; count < max; count++) {
+        status = fsw_dnode_dir_read(shand, &child_dnos[count]);
+        if (status)
+            break;
+        dno = child_dnos[count];
+        located[count] = vol->fstype_table->dnode_locate != NULL &&
+            vol->fstype_table->dnode_locate(vol, dno, &key[count]) == FSW_SUCCESS;
+        if (located[count])
+            located_count++;
+        else
+            key[count] = dno->dnode_id;
+        // located entries first, by block, then the others by dnode id
+        for (i = count; i > 0 && (located[order[i - 1]] < located[count] ||
+             (located[order[i - 1]] == located[count] && key[order[i - 1]] > key[count])); i--)
+            order[i] = order[i - 1];
+        order[i] = count;
+    }
+    *count_inout = count;
+    if (status == FSW_NOT_FOUND)
+        status = FSW_SUCCESS;
+    if (status && count == 0)
+        return status;
+
+    // read the metadata blocks of the located entries together, bridging small gaps
+    if (located_count > 1) {
+        run_start = run_end = key[order[0]];
+        for (j = 1; j <= located_count; j++) {
+            if (j < located_count && key[order[j]] >= run_start &&
+                key[order[j]] <= run_end + FSW_DIR_READ_PLUS_GAP + 1 &&
+                key[order[j]] - run_start < FSW_DIR_READ_PLUS_MAX) {
+                run_end = key[order[j]];
+                continue;
+            }
+            fsw_block_prefetch(vol, run_start, (fsw_u32)(run_end - run_start + 1), 2);
+            if (j < located_count)
+                run_start = run_end = key[order[j]];
+        }
+    }
+
+    // load the metadata in on-disk order
+    for (j = 0; j < count; j++)
+        fsw_dnode_fill(child_dnos[order[j]]);
+    return FSW_SUCCESS;
+}
+
 /**
  * Read the target path of a symbolic link. This function is called by the host driver
  * to read the "content" of a symbolic link, that is the relative or absolute path
@@ -835,6 +1779,12 @@ fsw_status_t fsw_shandle_open(struct fsw_dnode *dno, struct fsw_shandle *shand)
     shand->dnode = dno;
     shand->pos = 0;
     shand->extent.type = FSW_EXTENT_TYPE_INVALID;
+    shand->ra_next_pos = 0;
+    shand->ra_window = 0;
+    shand->ra_start = 0;
+    shand->ra_len = 0;
+    shand->ra_size = 0;
+    shand->ra_buffer = NULL;
 
     return FSW_SUCCESS;
 }
@@ -850,9 +1800,259 @@ void fsw_shandle_close(struct fsw_shandle *shand)
 {
     if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER)
         fsw_free(shand->extent.buffer);
+    if (shand->ra_buffer != NULL)
+        fsw_free(shand->ra_buffer);
     fsw_dnode_release(shand->dnode);
 }
 
+/**
+ * Free a dnode's extent map. The first allocation comes from the volume's extent
+ * slab, larger ones from the host allocator.
+ */
+
+static void fsw_extent_map_free(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    if (dno->extent_map_size == FSW_EXTENT_MAP_INITIAL)
+        fsw_slab_free(vol, &vol->extent_slab, dno->extent_map);
+    else
+        fsw_free(dno->extent_map);
+    dno->extent_map = NULL;
+}
+
+/**
+ * Find the entry of a dnode's extent map that covers a logical block. Returns the
+ * index of the first entry starting after log_bno if there is none.
+ */
+
+static fsw_u32 fsw_extent_map_search(struct fsw_dnode *dno, fsw_u64 log_bno)
+{
+    fsw_u32 lo = 0, hi = dno->extent_map_count, mid;
+
+    // find the first entry that starts after log_bno
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (dno->extent_map[mid].log_start <= log_bno)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && log_bno < dno->extent_map[lo - 1].log_start + dno->extent_map[lo - 1].log_count)
+        return lo - 1;
+    return lo;
+}
+
+/**
+ * Check if two extents, the first one directly followed by the second one in logical
+ * block order, describe one contiguous run on disk.
+ */
+
+static int fsw_extent_map_adjacent(struct fsw_volume *vol, struct fsw_extent *a, struct fsw_extent *b)
+{
+    if (a->type != b->type || a->log_start + a->log_count != b->log_start ||
+        a->log_count + b->log_count < a->log_count)
+        return 0;
+    if (a->type == FSW_EXTENT_TYPE_PHYSBLOCK)
+        return a->phys_start + (fsw_u64)a->log_count * (vol->log_blocksize / vol->phys_blocksize) == b->phys_start;
+    return 1;
+}
+
+/**
+ * Remember an extent returned by the file system driver in the dnode's extent map,
+ * so that other shandles and later reads on the same dnode need not ask the driver
+ * again. Only sparse and physical extents are kept. The new extent is trimmed to
+ * the gap between its neighbours and merged with them when contiguous. This is best
+ * effort; if memory is short or the map is full, the extent is simply not kept.
+ */
+
+static void fsw_extent_map_insert(struct fsw_dnode *dno, struct fsw_extent *extent)
+{
+    fsw_status_t    status;
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_extent new_extent = *extent, *new_map;
+    fsw_u32         i, trim;
+
+    if (new_extent.type != FSW_EXTENT_TYPE_PHYSBLOCK && new_extent.type != FSW_EXTENT_TYPE_SPARSE)
+        return;
+    new_extent.buffer = NULL;
+
+    // trim against the neighbours
+    i = fsw_extent_map_search(dno, new_extent.log_start);
+    if (i < dno->extent_map_count && dno->extent_map[i].log_start <= new_extent.log_start) {
+        trim = (fsw_u32)(dno->extent_map[i].log_start + dno->extent_map[i].log_count - new_extent.log_start);
+        if (trim >= new_extent.log_count)
+            return;
+        new_extent.log_start += trim;
+        new_extent.log_count -= trim;
+        new_extent.phys_start += (fsw_u64)trim * (vol->log_blocksize / vol->phys_blocksize);
+        i++;
+    }
+    if (i < dno->extent_map_count && dno->extent_map[i].log_start < new_extent.log_start + new_extent.log_count)
+        new_extent.log_count = (fsw_u32)(dno->extent_map[i].log_start - new_extent.log_start);
+    if (new_extent.log_count == 0)
+        return;
+
+    // merge with the neighbours if possible
+    if (i > 0 && fsw_extent_map_adjacent(vol, &dno->extent_map[i - 1], &new_extent)) {
+        dno->extent_map[i - 1].log_count += new_extent.log_count;
+        if (i < dno->extent_map_count && fsw_extent_map_adjacent(vol, &dno->extent_map[i - 1], &dno->extent_map[i])) {
+            dno->extent_map[i - 1].log_count += dno->extent_map[i].log_count;
+            dno->extent_map_count--;
+            fsw_memmove(&dno->extent_map[i], &dno->extent_map[i + 1],
+                        (dno->extent_map_count - i) * sizeof (struct fsw_extent));
+        }
+        return;
+    }
+    if (i < dno->extent_map_count && fsw_extent_map_adjacent(vol, &new_extent, &dno->extent_map[i])) {
+        dno->extent_map[i].log_start = new_extent.log_start;
+        dno->extent_map[i].phys_start = new_extent.phys_start;
+        dno->extent_map[i].log_count += new_extent.log_count;
+        return;
+    }
+
+    // insert a new entry
+    if (dno->extent_map_count >= dno->extent_map_size) {
+        if (dno->extent_map_size >= FSW_EXTENT_MAP_MAX)
+            return;
+        if (dno->extent_map_size == 0)
+            status = fsw_slab_alloc(vol, &vol->extent_slab, (void **)&new_map);
+        else
+            status = fsw_alloc(dno->extent_map_size * 2 * sizeof (struct fsw_extent), &new_map);
+        if (status)
+            return;
+        if (dno->extent_map != NULL) {
+            fsw_memcpy(new_map, dno->extent_map, dno->extent_map_count * sizeof (struct fsw_extent));
+            fsw_extent_map_free(vol, dno);
+        }
+        dno->extent_map = new_map;
+        dno->extent_map_size = dno->extent_map_size ? dno->extent_map_size * 2 : FSW_EXTENT_MAP_INITIAL;
+    }
+    fsw_memmove(&dno->extent_map[i + 1], &dno->extent_map[i],
+                (dno->extent_map_count - i) * sizeof (struct fsw_extent));
+    dno->extent_map[i] = new_extent;
+    dno->extent_map_count++;
+}
+
+/**
+ * Make sure the shandle's current extent covers a logical block. The dnode's extent
+ * map is consulted first; only if it does not know the block, the file system driver
+ * is asked for the proper extent.
+ */
+
+static fsw_status_t fsw_shandle_map(struct fsw_shandle *shand, fsw_u64 log_bno)
+{
+    fsw_status_t    status;
+    struct fsw_dnode *dno = shand->dnode;
+    struct fsw_volume *vol = dno->vol;
+    fsw_u32         i;
+
+    if (shand->extent.type != FSW_EXTENT_TYPE_INVALID &&
+        log_bno >= shand->extent.log_start &&
+        log_bno < shand->extent.log_start + shand->extent.log_count)
+        return FSW_SUCCESS;
+
+    if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER)
+        fsw_free(shand->extent.buffer);
+
+    // check the dnode's extent map
+    i = fsw_extent_map_search(dno, log_bno);
+    if (i < dno->extent_map_count && dno->extent_map[i].log_start <= log_bno) {
+        shand->extent = dno->extent_map[i];
+        vol->perf.extent_map_hits++;
+        return FSW_SUCCESS;
+    }
+
+    // ask the file system for the proper extent
+    shand->extent.log_start = log_bno;
+    vol->perf.get_extent_calls++;
+    status = vol->fstype_table->get_extent(vol, dno, &shand->extent);
+    if (status) {
+        shand->extent.type = FSW_EXTENT_TYPE_INVALID;
+        return status;
+    }
+    fsw_extent_map_insert(dno, &shand->extent);
+    return FSW_SUCCESS;
+}
+
+/**
+ * Fill the shandle's readahead buffer starting at the physical block that contains
+ * pos. The window doubles on every refill, from vol->ra_min_window up to
+ * vol->ra_max_window. The data is gathered extent by extent as reported by the
+ * file system driver, so only blocks belonging to the file are ever read, with
+ * one host read per physically contiguous run, several of them in flight at once
+ * when the host reads asynchronously.
+ */
+
+static fsw_status_t fsw_shandle_readahead(struct fsw_shandle *shand, fsw_u64 pos)
+{
+    fsw_status_t    status;
+    struct fsw_dnode *dno = shand->dnode;
+    struct fsw_volume *vol = dno->vol;
+    fsw_u64         start, end, fill, pos_in_extent, len;
+    struct fsw_io_queue queue;
+
+    // grow the window
+    if (shand->ra_window < vol->ra_min_window)
+        shand->ra_window = vol->ra_min_window;
+    else if (shand->ra_window < vol->ra_max_window)
+        shand->ra_window <<= 1;
+    if (shand->ra_window > vol->ra_max_window)
+        shand->ra_window = vol->ra_max_window;
+    shand->ra_window &= ~(vol->log_blocksize - 1);
+    if (shand->ra_window == 0)
+        return FSW_UNSUPPORTED;
+
+    if (shand->ra_size < shand->ra_window) {
+        if (shand->ra_buffer != NULL)
+            fsw_free(shand->ra_buffer);
+        shand->ra_size = 0;
+        status = fsw_alloc(shand->ra_window, &shand->ra_buffer);
+        if (status) {
+            shand->ra_buffer = NULL;
+            return status;
+        }
+        shand->ra_size = shand->ra_window;
+    }
+    shand->ra_len = 0;
+
+    start = pos - (pos & (vol->phys_blocksize - 1));
+    end = start + shand->ra_window;
+    if (end > dno->size)
+        end = dno->size;
+
+    fsw_io_queue_init(&queue);
+    for (fill = start; fill < end; fill += len) {
+        status = fsw_shandle_map(shand, FSW_U64_DIV(fill, vol->log_blocksize));
+        if (status)
+            break;
+
+        pos_in_extent = fill - shand->extent.log_start * vol->log_blocksize;
+        len = shand->extent.log_count * vol->log_blocksize - pos_in_extent;
+        if (len > end - fill)
+            len = end - fill;
+
+        if (shand->extent.type == FSW_EXTENT_TYPE_PHYSBLOCK) {
+            status = fsw_io_queue_read(vol, &queue,
+                                       shand->extent.phys_start + FSW_U64_DIV(pos_in_extent, vol->phys_blocksize),
+                                       (fsw_u32)FSW_U64_DIV(len + vol->phys_blocksize - 1, vol->phys_blocksize),
+                                       shand->ra_buffer + (fill - start));
+            if (status)
+                break;
+        } else if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER) {
+            fsw_memcpy(shand->ra_buffer + (fill - start), (fsw_u8 *)shand->extent.buffer + pos_in_extent, len);
+        } else {
+            fsw_memzero(shand->ra_buffer + (fill - start), len);
+        }
+    }
+    if (fsw_io_queue_wait(vol, &queue) && status == FSW_SUCCESS)
+        status = queue.status;
+    if (status)
+        return status;
+
+    shand->ra_start = start;
+    shand->ra_len = (fsw_u32)(end - start);
+    return FSW_SUCCESS;
+}
+
 /**
  * Read data from a shandle (storage handle for a dnode). This function is called by the
  * host driver or internally when data is read from a file. TODO: more
@@ -860,13 +2060,15 @@ void fsw_shandle_close(struct fsw_shandle *shand)
 
 fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_inout, void *buffer_in)
 {
-    fsw_status_t    status;
+    fsw_status_t    status = FSW_SUCCESS;
     struct fsw_dnode *dno = shand->dnode;
     struct fsw_volume *vol = dno->vol;
     fsw_u8          *buffer, *block_buffer;
     fsw_u64         buflen, copylen, pos;
-    fsw_u64         log_bno, pos_in_extent, phys_bno, pos_in_physblock;
+    fsw_u64         log_bno, pos_in_extent, phys_bno, pos_in_physblock, run, maxrun;
     fsw_u32         cache_level;
+    int             readahead;
+    struct fsw_io_queue queue;
 
     if (shand->pos >= dno->size) {   // already at EOF
         *buffer_size_inout = 0;
@@ -876,30 +2078,46 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
     // initialize vars
     buffer = buffer_in;
     buflen = *buffer_size_inout;
-    pos = (fsw_u32)shand->pos;
+    pos = shand->pos;
     cache_level = (dno->type != FSW_DNODE_TYPE_FILE) ? 1 : 0;
     // restrict read to file size
     if (buflen > dno->size - pos)
         buflen = (fsw_u32)(dno->size - pos);
 
+    // detect sequential streams of file reads; a seek resets the window
+    readahead = 0;
+    if (cache_level == 0 && vol->ra_max_window > 0 && vol->host_table->read_blocks != NULL) {
+        if (pos != 0 && pos == shand->ra_next_pos)
+            readahead = 1;
+        else
+            shand->ra_window = 0;
+    }
+
+    fsw_io_queue_init(&queue);
     while (buflen > 0) {
+        // serve from the readahead buffer, refilling it while a small-read stream goes on
+        if (readahead && (buflen < shand->ra_window || buflen < vol->ra_min_window) &&
+            (pos < shand->ra_start || pos >= shand->ra_start + shand->ra_len)) {
+            if (fsw_shandle_readahead(shand, pos))
+                readahead = 0;   // fall back to the plain path below
+        }
+        if (shand->ra_len > 0 && pos >= shand->ra_start && pos < shand->ra_start + shand->ra_len) {
+            copylen = shand->ra_start + shand->ra_len - pos;
+            if (copylen > buflen)
+                copylen = buflen;
+            fsw_memcpy(buffer, shand->ra_buffer + (pos - shand->ra_start), copylen);
+
+            buffer += copylen;
+            buflen -= copylen;
+            pos    += copylen;
+            continue;
+        }
+
         // get extent for the current logical block
         log_bno = FSW_U64_DIV(pos, vol->log_blocksize);
-        if (shand->extent.type == FSW_EXTENT_TYPE_INVALID ||
-            log_bno < shand->extent.log_start ||
-            log_bno >= shand->extent.log_start + shand->extent.log_count) {
-
-            if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER)
-                fsw_free(shand->extent.buffer);
-
-            // ask the file system for the proper extent
-            shand->extent.log_start = log_bno;
-            status = vol->fstype_table->get_extent(vol, dno, &shand->extent);
-            if (status) {
-                shand->extent.type = FSW_EXTENT_TYPE_INVALID;
-                return status;
-            }
-        }
+        status = fsw_shandle_map(shand, log_bno);
+        if (status)
+            break;
 
         pos_in_extent = pos - shand->extent.log_start * vol->log_blocksize;
 
@@ -908,18 +2126,49 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
             // convert to physical block number and offset
             phys_bno = shand->extent.phys_start + FSW_U64_DIV(pos_in_extent, vol->phys_blocksize);
             pos_in_physblock = pos_in_extent & (vol->phys_blocksize - 1);
-            copylen = vol->phys_blocksize - pos_in_physblock;
-            if (copylen > buflen)
-                copylen = buflen;
 
-            // get one physical block
-            status = fsw_block_get(vol, phys_bno, cache_level, (void **)&block_buffer);
-            if (status)
-                return status;
+            if (cache_level == 0 && pos_in_physblock == 0 && buflen >= vol->phys_blocksize &&
+                vol->host_table->read_blocks != NULL) {
+                // block-aligned file data: read the rest of the extent, as far as the
+                // caller's buffer reaches, straight into that buffer
+                run = (fsw_u64)shand->extent.log_count * (vol->log_blocksize / vol->phys_blocksize) -
+                      FSW_U64_DIV(pos_in_extent, vol->phys_blocksize);
+                maxrun = FSW_U64_DIV(buflen, vol->phys_blocksize);
+                if (run > maxrun)
+                    run = maxrun;
+
+                // carry the run on into the following extents as long as they are
+                // physically contiguous, so that it still takes a single host read;
+                // the runs are started asynchronously where the host supports it
+                while (run < maxrun && vol->log_blocksize == vol->phys_blocksize) {
+                    if (fsw_shandle_map(shand, shand->extent.log_start + shand->extent.log_count) ||
+                        shand->extent.type != FSW_EXTENT_TYPE_PHYSBLOCK ||
+                        shand->extent.phys_start != phys_bno + run)
+                        break;
+                    run += shand->extent.log_count;
+                    if (run > maxrun)
+                        run = maxrun;
+                }
+
+                status = fsw_io_queue_read(vol, &queue, phys_bno, (fsw_u32)run, buffer);
+                if (status)
+                    break;
+                copylen = run * vol->phys_blocksize;
 
-            // copy data from it
-            fsw_memcpy(buffer, block_buffer + pos_in_physblock, copylen);
-            fsw_block_release(vol, phys_bno, block_buffer);
+            } else {
+                copylen = vol->phys_blocksize - pos_in_physblock;
+                if (copylen > buflen)
+                    copylen = buflen;
+
+                // get one physical block
+                status = fsw_block_get(vol, phys_bno, cache_level, (void **)&block_buffer);
+                if (status)
+                    break;
+
+                // copy data from it
+                fsw_memcpy(buffer, block_buffer + pos_in_physblock, copylen);
+                fsw_block_release(vol, phys_bno, block_buffer);
+            }
 
         } else if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER) {
             copylen = shand->extent.log_count * vol->log_blocksize - pos_in_extent;
@@ -940,8 +2189,15 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
         pos    += copylen;
     }
 
+    // wait for the direct reads still in flight
+    if (fsw_io_queue_wait(vol, &queue) && status == FSW_SUCCESS)
+        status = queue.status;
+    if (status)
+        return status;
+
     *buffer_size_inout = (fsw_u32)(pos - shand->pos);
     shand->pos = pos;
+    shand->ra_next_pos = pos;
 
     return FSW_SUCCESS;
 }
@@ -53,9 +53,70 @@
 /** Expands to the name of a fstype dispatch table (fsw_fstype_table) for a named file system type. */
 #define FSW_FSTYPE_TABLE_NAME(t) FSW_CONCAT3(fsw_,t,_table)
 
+/** Maximum number of extents remembered in a dnode's extent map. */
+#ifndef FSW_EXTENT_MAP_MAX
+#define FSW_EXTENT_MAP_MAX (1024)
+#endif
+
+/** Highest cache_level accepted by fsw_block_get. */
+#define MAX_CACHE_LEVEL (5)
+
+/** Number of entries in a dnode's first extent map allocation. */
+#ifndef FSW_EXTENT_MAP_INITIAL
+#define FSW_EXTENT_MAP_INITIAL (8)
+#endif
+
+/** Size of the chunks the per-volume arena requests from the host allocator. */
+#ifndef FSW_ARENA_CHUNK_SIZE
+#define FSW_ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+
+/** Number of entries in the per-volume directory lookup cache (power of 2). */
+#ifndef FSW_DCACHE_SIZE
+#define FSW_DCACHE_SIZE (256)
+#endif
+
+/** Largest number of entries read and filled together by fsw_dnode_dir_read_plus. */
+#ifndef FSW_DIR_READ_PLUS_MAX
+#define FSW_DIR_READ_PLUS_MAX (32)
+#endif
+
+/** Largest gap in blocks bridged when reading the metadata of a directory batch together. */
+#ifndef FSW_DIR_READ_PLUS_GAP
+#define FSW_DIR_READ_PLUS_GAP (4)
+#endif
+
+/** Initial number of buckets in the per-volume dnode hash table. */
+#define FSW_DNODE_HASH_INITIAL (64)
+
+/** Initial readahead window for sequential reads, in bytes. */
+#ifndef FSW_READAHEAD_MIN
+#define FSW_READAHEAD_MIN (64 * 1024)
+#endif
+/** Maximum readahead window for sequential reads, in bytes. Zero disables readahead. */
+#ifndef FSW_READAHEAD_MAX
+#define FSW_READAHEAD_MAX (4 * 1024 * 1024)
+#endif
+
+/** Number of asynchronous host reads the core keeps in flight for one file read. */
+#ifndef FSW_IO_QUEUE_DEPTH
+#define FSW_IO_QUEUE_DEPTH (8)
+#endif
+
+/** Bytes at the start of a volume handed to the fstype probe functions; covers the
+    superblocks of all drivers, up to the btrfs one at 64 KiB. */
+#ifndef FSW_PROBE_SIZE
+#define FSW_PROBE_SIZE (68 * 1024)
+#endif
+
 /** Indicates that the block cache entry is empty. */
 #define FSW_INVALID_BNO 0xFFFFFFFFFFFFFFFF
 
+#ifndef FSW_BCACHE_BUDGET
+/** Default per-volume memory budget for block cache buffers, in bytes. */
+#define FSW_BCACHE_BUDGET (2 * 1024 * 1024)
+#endif
+
 
 //
 // Byte-swapping macros
@@ -205,18 +266,103 @@ enum {
 /* forward declarations */
 
 struct fsw_dnode;
+struct fsw_extent;
 struct fsw_host_table;
 struct fsw_fstype_table;
 
+/**
+ * Core: Per-volume performance counters. All counters start at zero when the volume
+ * is mounted; see fsw_volume_perf_snapshot and fsw_volume_perf_reset.
+ */
+
+struct fsw_volume_perf {
+    fsw_u64     read_block_calls;   //!< Calls into host_table->read_block
+    fsw_u64     read_blocks_calls;  //!< Calls into host_table->read_blocks
+    fsw_u64     read_async_calls;   //!< Reads started through host_table->submit_read
+    fsw_u64     read_async_peak;    //!< Largest number of asynchronous reads in flight at once
+    fsw_u64     bytes_read;         //!< Bytes transferred by all host read functions
+    fsw_u64     io_time;            //!< Time spent in host reads, in host_table->clock units
+    fsw_u64     bcache_hits[MAX_CACHE_LEVEL + 1];   //!< fsw_block_get calls served from the cache, by cache_level
+    fsw_u64     bcache_misses[MAX_CACHE_LEVEL + 1]; //!< fsw_block_get calls that read from the disk, by cache_level
+    fsw_u64     get_extent_calls;   //!< Calls into fstype_table->get_extent
+    fsw_u64     extent_map_hits;    //!< Extents served from a dnode's extent map
+    fsw_u64     dir_lookup_calls;   //!< Calls into fstype_table->dir_lookup
+    fsw_u64     dcache_hits;        //!< Lookups answered with a cached dnode
+    fsw_u64     dcache_negative_hits; //!< Lookups answered with a cached FSW_NOT_FOUND
+    fsw_u64     dnodes_created;     //!< Dnode structures allocated
+};
+
+/**
+ * Core: A driver-specific performance counter, see fsw_volume_driver_counters.
+ */
+
+struct fsw_perf_counter {
+    const char  *name;              //!< Short ASCII identifier, e.g. "node_cache_hits"
+    fsw_u64     value;              //!< Count since the mount or the last fsw_volume_perf_reset
+};
+
+/** Most driver-specific counters a file system driver may report. */
+#define FSW_PERF_COUNTERS_MAX (16)
+
+/**
+ * Core: Per-volume memory arena. Memory is requested from the host allocator in
+ * large chunks and only handed back when the volume is unmounted.
+ */
+
+struct fsw_arena {
+    void        *chunks;            //!< Singly-linked list of chunks obtained from fsw_alloc
+    fsw_u8      *free_ptr;          //!< Start of the unused tail of the newest chunk
+    fsw_u32     free_bytes;         //!< Size of the unused tail of the newest chunk
+    fsw_u32     chunk_count;        //!< Number of chunks obtained from fsw_alloc
+    fsw_u64     bytes;              //!< Total bytes obtained from fsw_alloc
+    fsw_u64     live_bytes;         //!< Bytes currently handed out by the slabs
+    fsw_u64     peak_bytes;         //!< Highest value live_bytes has reached
+};
+
+/**
+ * Core: Slab of fixed-size objects carved from the volume's arena. Freed objects
+ * are kept on a free list for reuse.
+ */
+
+struct fsw_slab {
+    fsw_u32     object_size;        //!< Size of each object in bytes (multiple of 8)
+    fsw_u32     in_use;             //!< Number of objects currently handed out
+    void        *free_list;         //!< Singly-linked list of free objects
+    fsw_u64     allocs;             //!< Number of objects handed out since mount
+};
+
 struct fsw_blockcache {
     fsw_u32     refcount;           //!< Reference count
     fsw_u32     cache_level;        //!< Level of importance of this block
+    fsw_u32     clock_weight;       //!< Remaining passes of the CLOCK hand before eviction
     fsw_u64     phys_bno;           //!< Physical block number
     void        *data;              //!< Block data buffer
 };
 
+/**
+ * Core: Directory lookup cache entry. Maps a name in a parent directory to the
+ * child dnode, or records that the name does not exist. Both dnodes are retained
+ * for as long as the entry is cached.
+ */
+
+struct fsw_dentry {
+    struct fsw_dentry *hash_next;   //!< Next entry in the same hash bucket
+    struct fsw_dnode *parent;       //!< Directory the name was looked up in (NULL if the slot is free)
+    struct fsw_dnode *child;        //!< Dnode found, or NULL for a negative entry
+    fsw_u32     hash;               //!< Hash of parent and name
+    fsw_u32     referenced;         //!< Set on use, cleared by the eviction hand
+    struct fsw_string name;         //!< The name as it was looked up
+};
+
 /**
  * Core: Represents a mounted volume.
+ *
+ * The core keeps all of its state in the volume, so different volumes may be
+ * used from different threads at the same time. A volume and everything opened
+ * on it (dnodes, shandles) must only be used by one thread at a time; the core
+ * does not lock. Driver state shared between volumes is guarded with
+ * fsw_host_lock, and volumes joined into one multi-device file system count as
+ * a single volume.
  */
 
 struct fsw_volume {
@@ -227,9 +373,31 @@ struct fsw_volume {
     struct fsw_string label;        //!< Volume label
 
     struct fsw_dnode *dnode_head;   //!< List of all dnodes allocated for this volume
+    struct fsw_dnode **dnode_hash;  //!< Hash table of all dnodes by (tree_id, dnode_id)
+    fsw_u32     dnode_hash_size;    //!< Number of buckets in dnode_hash (power of 2)
+    fsw_u32     dnode_count;        //!< Number of dnodes currently registered
 
     struct fsw_blockcache *bcache;  //!< Array of block cache entries
     fsw_u32     bcache_size;        //!< Number of entries in the block cache array
+    fsw_u32     bcache_used;        //!< Number of entries handed out so far
+    fsw_u32     bcache_hand;        //!< CLOCK hand for eviction
+    fsw_u32     bcache_budget;      //!< Memory budget for block buffers in bytes
+    fsw_u32     *bcache_hash;       //!< Open-addressed index by phys_bno (entry index + 1, 0 if empty)
+    fsw_u32     bcache_hash_bits;   //!< Log2 of the number of slots in bcache_hash
+
+    struct fsw_dentry *dcache;      //!< Directory lookup cache entries (NULL until first used)
+    struct fsw_dentry **dcache_hash; //!< Hash buckets of the directory lookup cache
+    fsw_u32     dcache_hand;        //!< Eviction hand of the directory lookup cache
+
+    struct fsw_volume_perf perf;    //!< Performance counters
+
+    struct fsw_arena arena;         //!< Backing memory for the slabs below
+    struct fsw_slab dnode_slab;     //!< Slab for dnode structures (fstype dnode_struct_size)
+    struct fsw_slab block_slab;     //!< Slab for block cache buffers (phys_blocksize)
+    struct fsw_slab extent_slab;    //!< Slab for initial dnode extent maps
+
+    fsw_u32     ra_min_window;      //!< Initial readahead window for sequential file reads
+    fsw_u32     ra_max_window;      //!< Maximum readahead window (0 disables readahead)
 
     void        *host_data;         //!< Hook for a host-specific data structure
     struct fsw_host_table *host_table;      //!< Dispatch table for host-specific functions
@@ -255,6 +423,11 @@ struct fsw_dnode {
 
     struct fsw_dnode *next;         //!< Doubly-linked list of all dnodes: previous dnode
     struct fsw_dnode *prev;         //!< Doubly-linked list of all dnodes: next dnode
+    struct fsw_dnode *hash_next;    //!< Next dnode in the same dnode_hash bucket
+
+    struct fsw_extent *extent_map;  //!< Extents resolved so far, sorted by log_start
+    fsw_u32     extent_map_count;   //!< Number of entries in extent_map
+    fsw_u32     extent_map_size;    //!< Allocated number of entries in extent_map
 };
 
 /**
@@ -302,6 +475,13 @@ struct fsw_shandle {
 
     fsw_u64     pos;                //!< Current file pointer in bytes
     struct fsw_extent extent;       //!< Current extent
+
+    fsw_u64     ra_next_pos;        //!< File position a sequential reader would continue at
+    fsw_u32     ra_window;          //!< Current readahead window in bytes (0 until a stream is seen)
+    fsw_u64     ra_start;           //!< File position of the first byte in ra_buffer
+    fsw_u32     ra_len;             //!< Number of valid bytes in ra_buffer
+    fsw_u32     ra_size;            //!< Allocated size of ra_buffer
+    fsw_u8      *ra_buffer;         //!< Readahead buffer (NULL until first needed)
 };
 
 /**
@@ -331,6 +511,20 @@ enum {
     FSW_DNODE_STAT_ATIME
 };
 
+/**
+ * Core: An asynchronous read of consecutive blocks, see host_table->submit_read.
+ * The request belongs to the core; the host may use host_data and next while the
+ * request is in flight, i.e. between submit_read and the end of complete_read.
+ */
+
+struct fsw_io_request {
+    fsw_u64     phys_bno;           //!< First block to read
+    fsw_u32     count;              //!< Number of blocks
+    void        *buffer;            //!< Destination, count * phys_blocksize bytes
+    void        *host_data;         //!< For the host's use while in flight
+    struct fsw_io_request *next;    //!< For the host's use while in flight
+};
+
 /**
  * Core: Function table for a host environment.
  */
@@ -343,6 +537,20 @@ struct fsw_host_table
                                      fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                                      fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
     fsw_status_t EFIAPI (*read_block)(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+    fsw_status_t EFIAPI (*read_blocks)(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer);
+                                    //!< Optional: read count consecutive blocks, bypassing all caches
+    fsw_u64      EFIAPI (*clock)(void);
+                                    //!< Optional: monotonic clock used to time host reads (host-defined units)
+    fsw_status_t EFIAPI (*submit_read)(struct fsw_volume *vol, struct fsw_io_request *req);
+                                    //!< Optional: start a read like read_blocks and return at once; any error
+                                    //!< means the request was not started and the core reads synchronously
+    fsw_status_t EFIAPI (*complete_read)(struct fsw_volume *vol, struct fsw_io_request *req);
+                                    //!< Wait for a submitted request to finish and return its status
+    void         EFIAPI (*lock)(void);
+                                    //!< Optional: take the lock for driver state shared between volumes;
+                                    //!< only needed on hosts that use volumes from several threads
+    void         EFIAPI (*unlock)(void);
+                                    //!< Optional: release the lock taken by lock
 };
 
 /**
@@ -372,6 +580,16 @@ struct fsw_fstype_table
                              struct fsw_shandle *shand, struct DNODESTRUCTNAME **child_dno);
     fsw_status_t (*readlink)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno,
                              struct fsw_string *link_target);
+    fsw_status_t (*dnode_locate)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno,
+                                 fsw_u64 *phys_bno_out);
+                                    //!< Optional: disk block holding an unfilled dnode's metadata
+    fsw_status_t (*probe)(void *buffer, fsw_u32 size);
+                                    //!< Optional: FSW_UNSUPPORTED if the first size bytes of the volume
+                                    //!< (FSW_PROBE_SIZE, less on tiny volumes) can't hold this file system
+    fsw_u32      (*perf_counters)(struct VOLSTRUCTNAME *vol, const char * const **names_out,
+                                  fsw_u64 **values_out);
+                                    //!< Optional: number of driver-specific performance counters
+                                    //!< (at most FSW_PERF_COUNTERS_MAX), their names and live values
 };
 
 
@@ -384,12 +602,25 @@ fsw_status_t fsw_mount(void *host_data,
                        struct fsw_host_table *host_table,
                        struct fsw_fstype_table *fstype_table,
                        struct fsw_volume **vol_out);
+fsw_status_t fsw_mount_any(void *host_data,
+                           struct fsw_host_table *host_table,
+                           struct fsw_fstype_table **fstype_tables,
+                           void *probe_buffer, fsw_u32 probe_size,
+                           struct fsw_volume **vol_out);
+fsw_status_t fsw_probe(struct fsw_fstype_table *fstype_table, void *buffer, fsw_u32 size);
 void         fsw_unmount(struct fsw_volume *vol);
 fsw_status_t fsw_volume_stat(struct fsw_volume *vol, struct fsw_volume_stat *sb);
+void         fsw_volume_perf_snapshot(struct fsw_volume *vol, struct fsw_volume_perf *perf_out);
+void         fsw_volume_perf_reset(struct fsw_volume *vol);
+fsw_u32      fsw_volume_driver_counters(struct fsw_volume *vol, struct fsw_perf_counter *counters_out,
+                                        fsw_u32 max);
+void         fsw_host_lock(struct VOLSTRUCTNAME *vol);
+void         fsw_host_unlock(struct VOLSTRUCTNAME *vol);
 
 void         fsw_set_blocksize(struct VOLSTRUCTNAME *vol, fsw_u32 phys_blocksize, fsw_u32 log_blocksize);
 fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level, void **buffer_out);
 void         fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer);
+void         fsw_block_prefetch(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 count, fsw_u32 cache_level);
 
 /*@}*/
 
@@ -417,6 +648,7 @@ fsw_status_t fsw_dnode_lookup_path(struct fsw_dnode *dno,
                                    struct fsw_string *lookup_path, char separator,
                                    struct fsw_dnode **child_dno_out);
 fsw_status_t fsw_dnode_dir_read(struct fsw_shandle *shand, struct fsw_dnode **child_dno_out);
+fsw_status_t fsw_dnode_dir_read_plus(struct fsw_shandle *shand, struct fsw_dnode **child_dnos, fsw_u32 *count_inout);
 fsw_status_t fsw_dnode_readlink(struct fsw_dnode *dno, struct fsw_string *link_target);
 fsw_status_t fsw_dnode_readlink_data(struct DNODESTRUCTNAME *dno, struct fsw_string *link_target);
 fsw_status_t fsw_dnode_resolve(struct fsw_dnode *dno, struct fsw_dnode **target_dno_out);
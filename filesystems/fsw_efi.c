@@ -75,7 +75,9 @@
 EFI_GUID gMyEfiDriverBindingProtocolGuid       = REFINDPLUS_EFI_DRIVER_BINDING_PROTOCOL_GUID;
 EFI_GUID gMyEfiComponentNameProtocolGuid       = REFINDPLUS_EFI_COMPONENT_NAME_PROTOCOL_GUID;
 EFI_GUID gMyEfiDiskIoProtocolGuid              = REFINDPLUS_EFI_DISK_IO_PROTOCOL_GUID;
+EFI_GUID gMyEfiDiskIo2ProtocolGuid             = REFINDPLUS_EFI_DISK_IO2_PROTOCOL_GUID;
 EFI_GUID gMyEfiBlockIoProtocolGuid             = REFINDPLUS_EFI_BLOCK_IO_PROTOCOL_GUID;
+EFI_GUID gMyEfiLoadedImageProtocolGuid         = REFINDPLUS_EFI_LOADED_IMAGE_PROTOCOL_GUID;
 EFI_GUID gMyEfiFileInfoGuid                    = EFI_FILE_INFO_ID;
 EFI_GUID gMyEfiFileSystemInfoGuid              = EFI_FILE_SYSTEM_INFO_ID;
 EFI_GUID gMyEfiFileSystemVolumeLabelInfoIdGuid = EFI_FILE_SYSTEM_VOLUME_LABEL_INFO_ID;
@@ -127,6 +129,21 @@ fsw_status_t EFIAPI fsw_efi_read_block(
     fsw_u64 phys_bno,
     void *buffer
 );
+fsw_status_t EFIAPI fsw_efi_read_blocks(
+    struct fsw_volume *vol,
+    fsw_u64 phys_bno,
+    fsw_u32 count,
+    void *buffer
+);
+fsw_u64 EFIAPI fsw_efi_clock(void);
+fsw_status_t EFIAPI fsw_efi_submit_read(
+    struct fsw_volume *vol,
+    struct fsw_io_request *req
+);
+fsw_status_t EFIAPI fsw_efi_complete_read(
+    struct fsw_volume *vol,
+    struct fsw_io_request *req
+);
 EFI_STATUS fsw_efi_map_status(
     fsw_status_t     fsw_status,
     FSW_VOLUME_DATA *Volume
@@ -168,6 +185,9 @@ EFI_STATUS fsw_efi_dir_setpos(
     IN FSW_FILE_DATA *File,
     IN UINT64 Position
 );
+VOID fsw_efi_dir_release_batch(
+    IN FSW_FILE_DATA *File
+);
 EFI_STATUS fsw_efi_dnode_getinfo(
     IN FSW_FILE_DATA *File,
     IN EFI_GUID *InformationType,
@@ -180,22 +200,19 @@ EFI_STATUS fsw_efi_dnode_fill_FileInfo(
     IN OUT UINTN *BufferSize,
     OUT VOID *Buffer
 );
+#if DEBUG_LEVEL
+static VOID fsw_efi_log_perf(
+    struct fsw_volume *vol
+);
+#endif
 
 /**
- * Structure for holding disk cache data.
+ * Geometry of the per-volume read caches. Set from the driver's load options
+ * by fsw_efi_main and copied into each volume when its cache is first used.
  */
 
-#define CACHE_SIZE 131072 /* 128KiB */
-struct cache_data {
-   fsw_u8            *Cache;
-   fsw_u64           CacheStart;
-   BOOLEAN           CacheValid;
-   FSW_VOLUME_DATA   *Volume; // NOTE: Do not deallocate; copied here to ID volume
-};
-
-#define NUM_CACHES 2 /* Don't increase without modifying fsw_efi_read_block() */
-static struct cache_data    Caches[NUM_CACHES];
-static int LastRead = -1;
+static UINTN CacheWays   = FSW_EFI_CACHE_WAYS;
+static UINTN CacheWindow = FSW_EFI_CACHE_WINDOW;
 
 /**
  * Interface structure for the EFI Driver Binding protocol.
@@ -225,29 +242,133 @@ REFINDPLUS_EFI_COMPONENT_NAME_PROTOCOL fsw_efi_ComponentName_table = {
 struct fsw_host_table   fsw_efi_host_table = {
     FSW_STRING_TYPE_UTF16,
     fsw_efi_change_blocksize,
-    fsw_efi_read_block
+    fsw_efi_read_block,
+    fsw_efi_read_blocks,
+    fsw_efi_clock,
+    fsw_efi_submit_read,
+    fsw_efi_complete_read
 };
 
+#ifdef FSW_EFI_MULTIFS
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext4);
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext2);
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(btrfs);
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ntfs);
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(hfs);
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(iso9660);
+extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(reiserfs);
+
+/**
+ * File system types served by the combined driver, in the order they are tried.
+ * The ext4 driver also reads ext2 and ext3, so the ext2 driver only sees volumes
+ * that ext4 rejects.
+ */
+
+static struct fsw_fstype_table *FsTypes[] = {
+    &FSW_FSTYPE_TABLE_NAME(ext4),
+    &FSW_FSTYPE_TABLE_NAME(ext2),
+    &FSW_FSTYPE_TABLE_NAME(btrfs),
+    &FSW_FSTYPE_TABLE_NAME(ntfs),
+    &FSW_FSTYPE_TABLE_NAME(hfs),
+    &FSW_FSTYPE_TABLE_NAME(iso9660),
+    &FSW_FSTYPE_TABLE_NAME(reiserfs),
+    NULL
+};
+#else
 extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(FSTYPE);
+#endif
+
 
+/**
+ * Drop the read cache of one volume and release its buffers. Caches of other
+ * volumes are not touched. The hit and miss counters are kept.
+ */
 
-VOID EFIAPI fsw_efi_clear_cache(VOID) {
-   int i;
+VOID EFIAPI fsw_efi_clear_cache(FSW_VOLUME_DATA *Volume) {
+   UINTN i;
 
-   // clear the cache
-   for (i = 0; i < NUM_CACHES; i++) {
-      if (Caches[i].Cache != NULL) {
-         FreePool(Caches[i].Cache);
-         Caches[i].Cache = NULL;
-      } // if
+   if (Volume == NULL || Volume->Cache == NULL)
+      return;
 
-      Caches[i].CacheStart = 0;
-      Caches[i].CacheValid = FALSE;
-      Caches[i].Volume     = NULL;
+   for (i = 0; i < Volume->CacheWays; i++) {
+      if (Volume->Cache[i].Buffer != NULL) {
+         FreePool(Volume->Cache[i].Buffer);
+      } // if
    }
-   LastRead = -1;
+   FreePool(Volume->Cache);
+   Volume->Cache      = NULL;
+   Volume->CacheWays  = 0;
+   Volume->CacheClock = 0;
 } // VOID EFIAPI fsw_efi_clear_cache();
 
+/**
+ * Look for "Name<number>" as a word in the driver's load options and return
+ * the number. Returns FALSE if the option is not present.
+ */
+
+static BOOLEAN fsw_efi_get_option(
+    IN  CHAR16  *Options,
+    IN  UINTN    Length,
+    IN  CHAR16  *Name,
+    OUT UINTN   *Value
+) {
+   UINTN i, j;
+
+   for (i = 0; i < Length; i++) {
+      if (i > 0 && Options[i - 1] != L' ')
+         continue;
+      for (j = 0; Name[j] != 0 && i + j < Length && Options[i + j] == Name[j]; j++)
+         ;
+      if (Name[j] != 0)
+         continue;
+
+      *Value = 0;
+      for (i += j; i < Length && Options[i] >= L'0' && Options[i] <= L'9'; i++)
+         *Value = *Value * 10 + (Options[i] - L'0');
+      return TRUE;
+   }
+   return FALSE;
+} // static BOOLEAN fsw_efi_get_option()
+
+/**
+ * Apply the driver's load options. "cache_ways=N" sets the number of read cache
+ * windows per volume (0 disables the cache) and "cache_window=N" their size in
+ * KiB, rounded down to a power of two.
+ */
+
+static VOID fsw_efi_read_options(IN EFI_HANDLE ImageHandle) {
+   EFI_STATUS         Status;
+   EFI_LOADED_IMAGE  *LoadedImage;
+   CHAR16            *Options;
+   UINTN              Length, Value;
+
+   Status = refit_call3_wrapper(
+       gBS->HandleProtocol,
+       ImageHandle,
+       &gMyEfiLoadedImageProtocolGuid,
+       (VOID **) &LoadedImage
+   );
+   if (EFI_ERROR (Status) || LoadedImage->LoadOptions == NULL)
+      return;
+
+   Options = (CHAR16 *) LoadedImage->LoadOptions;
+   Length  = LoadedImage->LoadOptionsSize / sizeof (CHAR16);
+
+   if (fsw_efi_get_option(Options, Length, L"cache_ways=", &Value) && Value <= FSW_EFI_CACHE_WAYS_MAX)
+      CacheWays = Value;
+
+   if (fsw_efi_get_option(Options, Length, L"cache_window=", &Value)) {
+      Value *= 1024;
+      if (Value < FSW_EFI_CACHE_WINDOW_MIN)
+         Value = FSW_EFI_CACHE_WINDOW_MIN;
+      if (Value > FSW_EFI_CACHE_WINDOW_MAX)
+         Value = FSW_EFI_CACHE_WINDOW_MAX;
+      while (Value & (Value - 1))
+         Value &= Value - 1;
+      CacheWindow = Value;
+   }
+} // static VOID fsw_efi_read_options()
+
 /**
  * Image entry point. Installs the Driver Binding and Component Name protocols
  * on the image's handle. Actually mounting a file system is initiated through
@@ -264,6 +385,8 @@ EFI_STATUS EFIAPI fsw_efi_main(
     InitializeLib(ImageHandle, SystemTable);
 #endif
 
+    fsw_efi_read_options(ImageHandle);
+
     // complete Driver Binding protocol instance
     fsw_efi_DriverBinding_table.ImageHandle          = ImageHandle;
     fsw_efi_DriverBinding_table.DriverBindingHandle  = ImageHandle;
@@ -300,11 +423,120 @@ EFI_STATUS EFIAPI fsw_efi_main(
 EFI_DRIVER_ENTRY_POINT(fsw_efi_main)
 #endif
 
+/**
+ * Read the start of a disk for the fstype probe functions: FSW_PROBE_SIZE bytes,
+ * or the whole disk if it is smaller. Returns NULL if there is no media or the
+ * read fails; otherwise the caller frees the buffer.
+ */
+
+static VOID * fsw_efi_read_probe(
+    IN  EFI_DISK_IO   *DiskIo,
+    IN  EFI_BLOCK_IO  *BlockIo,
+    OUT UINTN         *Size
+) {
+   EFI_STATUS  Status;
+   VOID       *Buffer;
+   UINT64      DiskSize;
+
+   if (!BlockIo->Media->MediaPresent || BlockIo->Media->BlockSize == 0)
+      return NULL;
+
+   DiskSize = MultU64x32(BlockIo->Media->LastBlock + 1, BlockIo->Media->BlockSize);
+   *Size = (DiskSize < FSW_PROBE_SIZE) ? (UINTN) DiskSize : FSW_PROBE_SIZE;
+
+   Buffer = AllocatePool(*Size);
+   if (Buffer == NULL)
+      return NULL;
+
+   Status = refit_call5_wrapper(
+       DiskIo->ReadDisk,
+       DiskIo,
+       BlockIo->Media->MediaId,
+       0,
+       *Size,
+       Buffer
+   );
+   if (EFI_ERROR (Status)) {
+      FreePool(Buffer);
+      return NULL;
+   }
+
+   return Buffer;
+} // static VOID * fsw_efi_read_probe()
+
+/**
+ * The superblock area read by the last Supported call that accepted a device. The
+ * Start call that follows on the same handle takes it over, so that binding a
+ * partition reads it from the disk only once.
+ */
+
+static struct {
+    EFI_HANDLE  Handle;
+    UINT32      MediaId;
+    VOID        *Buffer;
+    UINTN       Size;
+} LastProbe;
+
+static VOID fsw_efi_keep_probe(
+    IN EFI_HANDLE  Handle,
+    IN UINT32      MediaId,
+    IN VOID       *Buffer,
+    IN UINTN       Size
+) {
+   if (LastProbe.Buffer != NULL)
+      FreePool(LastProbe.Buffer);
+   LastProbe.Handle  = Handle;
+   LastProbe.MediaId = MediaId;
+   LastProbe.Buffer  = Buffer;
+   LastProbe.Size    = Size;
+} // static VOID fsw_efi_keep_probe()
+
+static VOID * fsw_efi_take_probe(
+    IN  EFI_HANDLE  Handle,
+    IN  UINT32      MediaId,
+    OUT UINTN      *Size
+) {
+   VOID       *Buffer = LastProbe.Buffer;
+
+   if (Buffer == NULL || LastProbe.Handle != Handle || LastProbe.MediaId != MediaId)
+      return NULL;
+   *Size = LastProbe.Size;
+   LastProbe.Buffer = NULL;
+   return Buffer;
+} // static VOID * fsw_efi_take_probe()
+
+/**
+ * Run the probe functions of the served file system types on the start of a
+ * disk. Returns EFI_UNSUPPORTED only if every type rejects it.
+ */
+
+static EFI_STATUS fsw_efi_probe(
+    IN VOID   *Buffer,
+    IN UINTN   Size
+) {
+#ifdef FSW_EFI_MULTIFS
+   UINTN i;
+
+   for (i = 0; FsTypes[i] != NULL; i++) {
+      if (fsw_probe(FsTypes[i], Buffer, (fsw_u32) Size) != FSW_UNSUPPORTED)
+         return EFI_SUCCESS;
+   }
+   return EFI_UNSUPPORTED;
+#else
+   if (fsw_probe(&FSW_FSTYPE_TABLE_NAME(FSTYPE), Buffer, (fsw_u32) Size) == FSW_UNSUPPORTED)
+      return EFI_UNSUPPORTED;
+   return EFI_SUCCESS;
+#endif
+} // static EFI_STATUS fsw_efi_probe()
+
 /**
  * Driver Binding EFI protocol, Supported function. This function is called by EFI
- * to test if this driver can handle a certain device. Our implementation only checks
- * if the device is a disk (i.e. that it supports the Block I/O and Disk I/O protocols)
- * and implicitly checks if the disk is already in use by another driver.
+ * to test if this driver can handle a certain device. Our implementation checks
+ * if the device is a disk (i.e. that it supports the Block I/O and Disk I/O protocols),
+ * implicitly checks if the disk is already in use by another driver, and reads the
+ * superblock area once so that the file system probe functions can turn down foreign
+ * partitions without a trial mount in the Start function. An accepted superblock area
+ * is kept for Start, which mounts from it instead of reading it again.
  */
 
 EFI_STATUS EFIAPI fsw_efi_DriverBinding_Supported(
@@ -314,6 +546,9 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Supported(
 ) {
     EFI_STATUS          Status;
     EFI_DISK_IO         *DiskIo;
+    EFI_BLOCK_IO        *BlockIo;
+    VOID                *ProbeBuffer;
+    UINTN               ProbeSize;
 
     // we check for both DiskIO and BlockIO protocols
 
@@ -331,6 +566,31 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Supported(
         return Status;
     }
 
+    // next, get BlockIO for the MediaId and the disk size
+    Status = refit_call6_wrapper(
+        gBS->OpenProtocol,
+        ControllerHandle,
+        &gMyEfiBlockIoProtocolGuid,
+        (VOID **) &BlockIo,
+        This->DriverBindingHandle,
+        ControllerHandle,
+        EFI_OPEN_PROTOCOL_GET_PROTOCOL
+    );
+
+    // one read of the superblock area serves the probes of all file system types,
+    // and is kept for the Start function; if it fails, Start gets to report the error
+    if (!EFI_ERROR (Status)) {
+        ProbeBuffer = fsw_efi_read_probe(DiskIo, BlockIo, &ProbeSize);
+        if (ProbeBuffer != NULL) {
+            Status = fsw_efi_probe(ProbeBuffer, ProbeSize);
+            if (EFI_ERROR (Status)) {
+                FreePool(ProbeBuffer);
+            } else {
+                fsw_efi_keep_probe(ControllerHandle, BlockIo->Media->MediaId, ProbeBuffer, ProbeSize);
+            }
+        }
+    }
+
     // we were just checking, close it again
     refit_call4_wrapper(
         gBS->CloseProtocol,
@@ -340,17 +600,6 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Supported(
         ControllerHandle
     );
 
-    // next, check BlockIO without actually opening it
-    Status = refit_call6_wrapper(
-        gBS->OpenProtocol,
-        ControllerHandle,
-        &gMyEfiBlockIoProtocolGuid,
-        NULL,
-        This->DriverBindingHandle,
-        ControllerHandle,
-        EFI_OPEN_PROTOCOL_TEST_PROTOCOL
-    );
-
     return Status;
 }
 
@@ -362,7 +611,8 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Supported(
  *
  * This function allocates memory for a per-volume structure, opens the
  * required protocols (just Disk I/O in our case, Block I/O is only looked
- * at to get the MediaId field), and lets the FSW core mount the file system.
+ * at to get the MediaId and the size of the media), and lets the FSW core
+ * mount the file system.
  * If successful, an EFI Simple File System protocol is exported on the
  * device handle.
  */
@@ -419,18 +669,57 @@ fsw_efi_DriverBinding_Start(
     Volume->Handle          = ControllerHandle;
     Volume->DiskIo          = DiskIo;
     Volume->MediaId         = BlockIo->Media->MediaId;
+    Volume->DiskSize        = MultU64x32(BlockIo->Media->LastBlock + 1, BlockIo->Media->BlockSize);
     Volume->LastIOStatus    = EFI_SUCCESS;
 
-    // mount the filesystem
+#ifdef __MAKEWITH_TIANO
+    // Disk I/O 2 is optional; without it all reads are synchronous
+    if (EFI_ERROR (refit_call6_wrapper(
+        gBS->OpenProtocol,
+        ControllerHandle,
+        &gMyEfiDiskIo2ProtocolGuid,
+        (VOID **) &Volume->DiskIo2,
+        This->DriverBindingHandle,
+        ControllerHandle,
+        EFI_OPEN_PROTOCOL_BY_DRIVER
+    ))) {
+        Volume->DiskIo2 = NULL;
+    }
+#endif
+
+    // mount the filesystem; the superblock area read by Supported serves the
+    // mount's reads within it, and the combined driver tries each type whose
+    // probe accepts it
+    Volume->Probe = fsw_efi_take_probe(ControllerHandle, Volume->MediaId, &Volume->ProbeSize);
+#ifdef FSW_EFI_MULTIFS
+    if (Volume->Probe == NULL) {
+        Volume->Probe = fsw_efi_read_probe(DiskIo, BlockIo, &Volume->ProbeSize);
+    }
+#endif
     Status = fsw_efi_map_status(
+#ifdef FSW_EFI_MULTIFS
+        fsw_mount_any(
+            Volume,
+            &fsw_efi_host_table,
+            FsTypes,
+            Volume->Probe,
+            (fsw_u32) Volume->ProbeSize,
+            &Volume->vol
+        ),
+#else
         fsw_mount(
             Volume,
             &fsw_efi_host_table,
             &FSW_FSTYPE_TABLE_NAME(FSTYPE),
             &Volume->vol
         ),
+#endif
         Volume
     );
+    if (Volume->Probe != NULL) {
+        FreePool(Volume->Probe);
+        Volume->Probe = NULL;
+    }
     if (!EFI_ERROR (Status)) {
         // register the SimpleFileSystem protocol
         Volume->FileSystem.Revision     = EFI_FILE_IO_INTERFACE_REVISION;
@@ -450,6 +739,18 @@ fsw_efi_DriverBinding_Start(
         if (Volume->vol != NULL) {
             fsw_unmount(Volume->vol);
         }
+        fsw_efi_clear_cache(Volume);
+#ifdef __MAKEWITH_TIANO
+        if (Volume->DiskIo2 != NULL) {
+            refit_call4_wrapper(
+                gBS->CloseProtocol,
+                ControllerHandle,
+                &gMyEfiDiskIo2ProtocolGuid,
+                This->DriverBindingHandle,
+                ControllerHandle
+            );
+        }
+#endif
         FreePool(Volume);
 
         refit_call4_wrapper(
@@ -522,8 +823,23 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Stop(
 
     // release private data structure
     if (Volume->vol != NULL) {
+#if DEBUG_LEVEL
+        fsw_efi_log_perf(Volume->vol);
+#endif
         fsw_unmount(Volume->vol);
     }
+    fsw_efi_clear_cache(Volume);
+#ifdef __MAKEWITH_TIANO
+    if (Volume->DiskIo2 != NULL) {
+        refit_call4_wrapper(
+            gBS->CloseProtocol,
+            ControllerHandle,
+            &gMyEfiDiskIo2ProtocolGuid,
+            This->DriverBindingHandle,
+            ControllerHandle
+        );
+    }
+#endif
     FreePool(Volume);
 
     // close the consumed protocols
@@ -535,9 +851,6 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Stop(
         ControllerHandle
     );
 
-    // clear the cache
-    fsw_efi_clear_cache();
-
     return Status;
 }
 
@@ -598,12 +911,12 @@ void EFIAPI fsw_efi_change_blocksize(
 /**
  * FSW interface function to read data blocks. This function is called by the FSW core
  * to read a block of data from the device. The buffer is allocated by the core code.
- * Two caches are maintained, so as to improve performance on some systems. (VirtualBox
- * is particularly susceptible to performance problems with an uncached driver -- the
- * ext2 driver can take 200 seconds to load a Linux kernel under VirtualBox, whereas
- * the time is more like 3 seconds with a cache!) Two independent caches are maintained
- * because the ext2fs driver tends to alternate between accessing two parts of the
- * disk.
+ * Each volume keeps a small set of aligned read windows, replaced least recently used
+ * first, so as to improve performance on some systems. (VirtualBox is particularly
+ * susceptible to performance problems with an uncached driver -- the ext2 driver can
+ * take 200 seconds to load a Linux kernel under VirtualBox, whereas the time is more
+ * like 3 seconds with a cache!) Several windows are kept because drivers tend to
+ * alternate between metadata and data in different parts of the disk.
  */
 
 fsw_status_t EFIAPI fsw_efi_read_block(
@@ -611,93 +924,293 @@ fsw_status_t EFIAPI fsw_efi_read_block(
     fsw_u64            phys_bno,
     void              *buffer
 ) {
-   int              i, ReadCache = -1;
-   FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
-   EFI_STATUS       Status = EFI_SUCCESS;
-   BOOLEAN          ReadOneBlock = FALSE;
-   UINT64           StartRead = (UINT64) phys_bno * (UINT64) vol->phys_blocksize;
+   UINTN               i;
+   FSW_VOLUME_DATA     *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   FSW_EFI_CACHE_SLOT  *Slot = NULL;
+   EFI_STATUS          Status = EFI_SUCCESS;
+   UINT64              StartRead = (UINT64) phys_bno * (UINT64) vol->phys_blocksize;
+   UINT64              WindowStart;
+   UINTN               WindowSize;
 
    if (buffer == NULL)
       return (fsw_status_t) EFI_BAD_BUFFER_SIZE;
 
-   // Initialize static data structures, if necessary....
-   if (LastRead < 0) {
-      fsw_efi_clear_cache();
-   } // if
+   // While mounting, the superblock area read by Supported is still at hand....
+   if (Volume->Probe != NULL && StartRead + vol->phys_blocksize <= Volume->ProbeSize) {
+      CopyMem(buffer, (UINT8 *) Volume->Probe + (UINTN) StartRead, vol->phys_blocksize);
+      Volume->LastIOStatus = EFI_SUCCESS;
+      return FSW_SUCCESS;
+   }
 
-   // Look for a cache hit on the current query....
-   i = 0;
-   do {
-      if ((Caches[i].Volume == Volume) &&
-          Caches[i].CacheValid &&
-          (StartRead >= Caches[i].CacheStart) &&
-          ((StartRead + vol->phys_blocksize) <= (Caches[i].CacheStart + CACHE_SIZE))) {
-         ReadCache = i;
-      }
-      i++;
-   } while ((i < NUM_CACHES) && (ReadCache < 0));
-
-   // No cache hit found; load new cache and pass it on....
-   if (ReadCache < 0) {
-      if (LastRead == -1)
-         LastRead = 1;
-      ReadCache = 1 - LastRead; // NOTE: If NUM_CACHES > 2, this must become more complex
-      Caches[ReadCache].CacheValid = FALSE;
-      if (Caches[ReadCache].Cache == NULL) {
-          Caches[ReadCache].Cache = AllocatePool(CACHE_SIZE);
+   // Set up the volume's cache on first use....
+   if (Volume->Cache == NULL && CacheWays > 0) {
+      Volume->Cache = AllocateZeroPool(CacheWays * sizeof (FSW_EFI_CACHE_SLOT));
+      if (Volume->Cache != NULL) {
+         Volume->CacheWays   = CacheWays;
+         Volume->CacheWindow = CacheWindow;
       }
-      if (Caches[ReadCache].Cache != NULL) {
-         // TODO: Below call hangs on my 32-bit Mac Mini when compiled with GNU-EFI.
-         // The same binary is fine under VirtualBox, and the same call is fine when
-         // compiled with Tianocore. Further clue: Omitting "Status =" avoids the
-         // hang but produces a failure to mount the filesystem, even when the same
-         // change is made to later similar call. Calling Volume->DiskIo->ReadDisk()
-         // directly (without refit_call5_wrapper()) changes nothing. Placing Print()
-         // statements at the start and end of the function, and before and after the
-         // ReadDisk() call, suggests that when it fails, the program is executing
-         // code starting mid-function, so there seems to be something messed up in
-         // the way the function is being called. FIGURE THIS OUT!
-         Status = refit_call5_wrapper(
-             Volume->DiskIo->ReadDisk,
-             Volume->DiskIo,
-             Volume->MediaId,
-             StartRead,
-             (UINTN) CACHE_SIZE,
-             (VOID*) Caches[ReadCache].Cache
-         );
-         if (!EFI_ERROR (Status)) {
-            Caches[ReadCache].CacheStart = StartRead;
-            Caches[ReadCache].CacheValid = TRUE;
-            Caches[ReadCache].Volume = Volume;
-            LastRead = ReadCache;
-         } else {
-            ReadOneBlock = TRUE;
+   } // if
+
+   // The last window of the media is cut short at its end, so that the tail of
+   // the partition is cached like the rest....
+   WindowStart = StartRead & ~((UINT64) Volume->CacheWindow - 1);
+   WindowSize  = Volume->CacheWindow;
+   if (Volume->DiskSize > WindowStart && Volume->DiskSize - WindowStart < WindowSize) {
+      WindowSize = (UINTN) (Volume->DiskSize - WindowStart);
+   }
+   if (Volume->Cache != NULL && vol->phys_blocksize > 0 &&
+       StartRead + vol->phys_blocksize <= WindowStart + WindowSize) {
+      // Look for a cache hit, remembering the least recently used window on the way....
+      Volume->CacheClock++;
+      for (i = 0; i < Volume->CacheWays; i++) {
+         if (Volume->Cache[i].Valid && Volume->Cache[i].Start == WindowStart) {
+            Slot = &Volume->Cache[i];
+            break;
          }
+         if (Slot == NULL || !Volume->Cache[i].Valid ||
+             (Slot->Valid && Volume->Cache[i].LastUse < Slot->LastUse)) {
+            Slot = &Volume->Cache[i];
+         }
+      }
+
+      if (Slot->Valid && Slot->Start == WindowStart) {
+         Volume->CacheHits++;
       } else {
-         ReadOneBlock = TRUE;
-      } // if cache memory allocated
-   } // if (ReadCache < 0)
-
-   if (Caches[ReadCache].Cache != NULL && Caches[ReadCache].CacheValid && vol->phys_blocksize > 0) {
-      CopyMem(buffer, &Caches[ReadCache].Cache[StartRead - Caches[ReadCache].CacheStart], vol->phys_blocksize);
-   } else {
-      ReadOneBlock = TRUE;
-   }
+         // No cache hit found; load the window into the replaced slot....
+         Slot->Valid = FALSE;
+         if (Slot->Buffer == NULL) {
+            Slot->Buffer = AllocatePool(Volume->CacheWindow);
+         }
+         if (Slot->Buffer != NULL) {
+            // TODO: Below call hangs on my 32-bit Mac Mini when compiled with GNU-EFI.
+            // The same binary is fine under VirtualBox, and the same call is fine when
+            // compiled with Tianocore. Further clue: Omitting "Status =" avoids the
+            // hang but produces a failure to mount the filesystem, even when the same
+            // change is made to later similar call. Calling Volume->DiskIo->ReadDisk()
+            // directly (without refit_call5_wrapper()) changes nothing. Placing Print()
+            // statements at the start and end of the function, and before and after the
+            // ReadDisk() call, suggests that when it fails, the program is executing
+            // code starting mid-function, so there seems to be something messed up in
+            // the way the function is being called. FIGURE THIS OUT!
+            Status = refit_call5_wrapper(
+                Volume->DiskIo->ReadDisk,
+                Volume->DiskIo,
+                Volume->MediaId,
+                WindowStart,
+                WindowSize,
+                (VOID*) Slot->Buffer
+            );
+            if (!EFI_ERROR (Status)) {
+               Slot->Start = WindowStart;
+               Slot->Valid = TRUE;
+               Volume->CacheMisses++;
+            }
+         } // if cache memory allocated
+      } // if cache hit
+
+      if (Slot->Valid) {
+         Slot->LastUse = Volume->CacheClock;
+         CopyMem(buffer, Slot->Buffer + (UINTN) (StartRead - WindowStart), vol->phys_blocksize);
+         Volume->LastIOStatus = EFI_SUCCESS;
+         return FSW_SUCCESS;
+      }
+   } // if cache usable
+
+   // No cache, or the window could not be read, so do a simple disk read of
+   // one block....
+   Status = refit_call5_wrapper(
+       Volume->DiskIo->ReadDisk,
+       Volume->DiskIo,
+       Volume->MediaId,
+       StartRead,
+       (UINTN) vol->phys_blocksize,
+       (VOID*) buffer
+   );
+   Volume->LastIOStatus = Status;
+
+   return Status;
+} // fsw_status_t *fsw_efi_read_block()
+
+/**
+ * FSW interface function to read a run of consecutive data blocks. This function is
+ * called by the FSW core for block-aligned file data and reads straight into the
+ * caller's buffer with a single Disk I/O call, bypassing the caches above.
+ */
+
+fsw_status_t EFIAPI fsw_efi_read_blocks(
+    struct fsw_volume *vol,
+    fsw_u64            phys_bno,
+    fsw_u32            count,
+    void              *buffer
+) {
+   FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   EFI_STATUS       Status;
+
+   if (buffer == NULL)
+      return FSW_IO_ERROR;
+
+   Status = refit_call5_wrapper(
+       Volume->DiskIo->ReadDisk,
+       Volume->DiskIo,
+       Volume->MediaId,
+       phys_bno * vol->phys_blocksize,
+       (UINTN) count * vol->phys_blocksize,
+       (VOID*) buffer
+   );
+   Volume->LastIOStatus = Status;
+
+   return EFI_ERROR (Status) ? FSW_IO_ERROR : FSW_SUCCESS;
+} // fsw_status_t EFIAPI fsw_efi_read_blocks()
+
+/**
+ * FSW interface function returning a monotonic clock for timing host reads. Uses
+ * the time stamp counter where there is one; elsewhere I/O time is not accounted.
+ */
+
+fsw_u64 EFIAPI fsw_efi_clock(void) {
+#if defined(__MAKEWITH_TIANO) && (defined(MDE_CPU_IA32) || defined(MDE_CPU_X64))
+   return AsmReadTsc();
+#else
+   return 0;
+#endif
+} // fsw_u64 EFIAPI fsw_efi_clock()
 
-   if (ReadOneBlock) { // Something's failed, so try a simple disk read of one block....
-      Status = refit_call5_wrapper(
-          Volume->DiskIo->ReadDisk,
-          Volume->DiskIo,
+#ifdef __MAKEWITH_TIANO
+/**
+ * Return the TPL the caller runs at. The boot services have no direct query, so
+ * raise to the highest level and restore the old one.
+ */
+
+static EFI_TPL fsw_efi_current_tpl(VOID) {
+   EFI_TPL             OldTpl;
+
+   OldTpl = refit_call1_wrapper(gBS->RaiseTPL, TPL_HIGH_LEVEL);
+   refit_call1_wrapper(gBS->RestoreTPL, OldTpl);
+   return OldTpl;
+} // static EFI_TPL fsw_efi_current_tpl()
+#endif
+
+/**
+ * FSW interface function to start an asynchronous read of consecutive blocks with
+ * Disk I/O 2. The token and its event are kept in req->host_data until
+ * fsw_efi_complete_read. Fails without Disk I/O 2 (including all GNU-EFI builds)
+ * and above TPL_APPLICATION, where fsw_efi_complete_read could not wait for the
+ * event; the core then reads synchronously through Disk I/O.
+ */
+
+fsw_status_t EFIAPI fsw_efi_submit_read(
+    struct fsw_volume     *vol,
+    struct fsw_io_request *req
+) {
+#ifdef __MAKEWITH_TIANO
+   FSW_VOLUME_DATA     *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   EFI_DISK_IO2_TOKEN  *Token;
+   EFI_STATUS          Status;
+
+   if (Volume->DiskIo2 == NULL || req->buffer == NULL || fsw_efi_current_tpl() != TPL_APPLICATION)
+      return FSW_UNSUPPORTED;
+
+   Token = AllocateZeroPool(sizeof (EFI_DISK_IO2_TOKEN));
+   if (Token == NULL)
+      return FSW_OUT_OF_MEMORY;
+
+   // A plain event to wait on; Disk I/O 2 signals it when the read is done
+   Status = refit_call5_wrapper(gBS->CreateEvent, 0, TPL_CALLBACK, NULL, NULL, &Token->Event);
+   if (!EFI_ERROR (Status)) {
+      Status = refit_call6_wrapper(
+          Volume->DiskIo2->ReadDiskEx,
+          Volume->DiskIo2,
           Volume->MediaId,
-          phys_bno * vol->phys_blocksize,
-          (UINTN) vol->phys_blocksize,
-          (VOID*) buffer
+          req->phys_bno * vol->phys_blocksize,
+          Token,
+          (UINTN) req->count * vol->phys_blocksize,
+          (VOID*) req->buffer
       );
+      if (EFI_ERROR (Status))
+         refit_call1_wrapper(gBS->CloseEvent, Token->Event);
+   }
+   if (EFI_ERROR (Status)) {
+      FreePool(Token);
+      return FSW_UNSUPPORTED;
    }
+
+   req->host_data = Token;
+   return FSW_SUCCESS;
+#else
+   return FSW_UNSUPPORTED;
+#endif
+} // fsw_status_t EFIAPI fsw_efi_submit_read()
+
+/**
+ * FSW interface function to wait for a read started with fsw_efi_submit_read and
+ * release its token. Reads are only started at TPL_APPLICATION, where WaitForEvent
+ * may be used.
+ */
+
+fsw_status_t EFIAPI fsw_efi_complete_read(
+    struct fsw_volume     *vol,
+    struct fsw_io_request *req
+) {
+#ifdef __MAKEWITH_TIANO
+   FSW_VOLUME_DATA     *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   EFI_DISK_IO2_TOKEN  *Token = (EFI_DISK_IO2_TOKEN *)req->host_data;
+   EFI_STATUS          Status;
+   UINTN               Index;
+
+   if (Token == NULL)
+      return FSW_IO_ERROR;
+
+   Status = refit_call3_wrapper(gBS->WaitForEvent, 1, &Token->Event, &Index);
+   if (!EFI_ERROR (Status))
+      Status = Token->TransactionStatus;
+   refit_call1_wrapper(gBS->CloseEvent, Token->Event);
+   FreePool(Token);
+   req->host_data = NULL;
    Volume->LastIOStatus = Status;
 
-   return Status;
-} // fsw_status_t *fsw_efi_read_block()
+   return EFI_ERROR (Status) ? FSW_IO_ERROR : FSW_SUCCESS;
+#else
+   return FSW_IO_ERROR;
+#endif
+} // fsw_status_t EFIAPI fsw_efi_complete_read()
+
+#if DEBUG_LEVEL
+/**
+ * Write the performance counters of a volume to the debug log. Called before the
+ * volume is unmounted.
+ */
+
+static VOID fsw_efi_log_perf(struct fsw_volume *vol) {
+   FSW_VOLUME_DATA        *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   struct fsw_volume_perf perf;
+   struct fsw_perf_counter counters[FSW_PERF_COUNTERS_MAX];
+   fsw_u32                count;
+   fsw_u64                hits = 0, misses = 0;
+   UINTN                  i;
+
+   fsw_volume_perf_snapshot(vol, &perf);
+   count = fsw_volume_driver_counters(vol, counters, FSW_PERF_COUNTERS_MAX);
+   for (i = 0; i <= MAX_CACHE_LEVEL; i++) {
+      hits += perf.bcache_hits[i];
+      misses += perf.bcache_misses[i];
+   }
+
+   Print(L"fsw_efi: I/O %ld read_block, %ld read_blocks, %ld bytes, %ld ticks\n",
+         (UINT64)perf.read_block_calls, (UINT64)perf.read_blocks_calls,
+         (UINT64)perf.bytes_read, (UINT64)perf.io_time);
+   Print(L"fsw_efi: async I/O %ld reads, up to %ld in flight\n",
+         (UINT64)perf.read_async_calls, (UINT64)perf.read_async_peak);
+   Print(L"fsw_efi: block cache %ld hits, %ld misses; %ld get_extent, %ld dir_lookup, %ld dnodes\n",
+         (UINT64)hits, (UINT64)misses, (UINT64)perf.get_extent_calls,
+         (UINT64)perf.dir_lookup_calls, (UINT64)perf.dnodes_created);
+   Print(L"fsw_efi: read cache %ld x %ld bytes, %ld hits, %ld misses\n",
+         (UINT64)Volume->CacheWays, (UINT64)Volume->CacheWindow,
+         (UINT64)Volume->CacheHits, (UINT64)Volume->CacheMisses);
+   for (i = 0; i < count; i++) {
+      Print(L"fsw_efi: %a %ld\n", counters[i].name, (UINT64)counters[i].value);
+   }
+} // static VOID fsw_efi_log_perf()
+#endif
 
 /**
  * Map FSW status codes to EFI status codes. The FSW_IO_ERROR code is only produced
@@ -743,7 +1256,7 @@ EFI_STATUS EFIAPI fsw_efi_FileSystem_OpenVolume(
     Print(L"fsw_efi_FileSystem_OpenVolume\n");
 #endif
 
-    fsw_efi_clear_cache();
+    fsw_efi_clear_cache(Volume);
     Status = fsw_efi_dnode_to_FileHandle(Volume->vol->root, Root);
 
     return Status;
@@ -781,6 +1294,8 @@ EFI_STATUS EFIAPI fsw_efi_FileHandle_Close(IN EFI_FILE *This) {
     Print(L"fsw_efi_FileHandle_Close\n");
 #endif
 
+    if (File->Type == FSW_EFI_FILE_TYPE_DIR)
+        fsw_efi_dir_release_batch(File);
     fsw_shandle_close(&File->shand);
     FreePool(File);
 
@@ -987,7 +1502,9 @@ EFI_STATUS fsw_efi_file_read(
     Print(L"fsw_efi_file_read %d bytes\n", *BufferSize);
 #endif
 
-    buffer_size = (fsw_u32)*BufferSize;
+    // large reads go straight into Buffer, one Disk I/O call per contiguous
+    // run of blocks; the core takes at most 4 GiB at a time
+    buffer_size = (*BufferSize > 0xFFFFFFFF) ? 0xFFFFFFFF : (fsw_u32)*BufferSize;
     Status = fsw_efi_map_status(fsw_shandle_read(&File->shand, &buffer_size, Buffer),
                                 (FSW_VOLUME_DATA *)File->shand.dnode->vol->host_data);
     *BufferSize = buffer_size;
@@ -1087,14 +1604,22 @@ EFI_STATUS fsw_efi_dir_read(
     EFI_STATUS          Status;
     FSW_VOLUME_DATA     *Volume = (FSW_VOLUME_DATA *)File->shand.dnode->vol->host_data;
     struct fsw_dnode    *dno;
+    fsw_u32             count;
 
 #if DEBUG_LEVEL
     Print(L"fsw_efi_dir_read...\n");
 #endif
 
-    // read the next entry
-    Status = fsw_efi_map_status(fsw_dnode_dir_read(&File->shand, &dno), Volume);
-    if (Status == EFI_NOT_FOUND) {
+    // read and fill the next batch of entries
+    if (File->DirBatchIndex >= File->DirBatchCount) {
+        fsw_efi_dir_release_batch(File);
+        count = FSW_DIR_READ_PLUS_MAX;
+        Status = fsw_efi_map_status(fsw_dnode_dir_read_plus(&File->shand, File->DirBatch, &count), Volume);
+        if (EFI_ERROR (Status))
+            return Status;
+        File->DirBatchCount = count;
+    }
+    if (File->DirBatchCount == 0) {
         // end of directory
         *BufferSize = 0;
 #if DEBUG_LEVEL
@@ -1102,15 +1627,33 @@ EFI_STATUS fsw_efi_dir_read(
 #endif
         return EFI_SUCCESS;
     }
-    if (EFI_ERROR (Status))
-        return Status;
 
-    // get info into buffer
+    // get info into buffer; on a too small buffer the entry stays for the next call
+    dno = File->DirBatch[File->DirBatchIndex];
     Status = fsw_efi_dnode_fill_FileInfo(Volume, dno, BufferSize, Buffer);
-    fsw_dnode_release(dno);
+    if (Status != EFI_BUFFER_TOO_SMALL) {
+        fsw_dnode_release(dno);
+        File->DirBatch[File->DirBatchIndex++] = NULL;
+    }
     return Status;
 }
 
+/**
+ * Release the directory entries read ahead by fsw_efi_dir_read that were not
+ * returned yet.
+ */
+
+VOID fsw_efi_dir_release_batch(
+    IN FSW_FILE_DATA *File
+) {
+    while (File->DirBatchIndex < File->DirBatchCount) {
+        fsw_dnode_release(File->DirBatch[File->DirBatchIndex]);
+        File->DirBatch[File->DirBatchIndex++] = NULL;
+    }
+    File->DirBatchCount = 0;
+    File->DirBatchIndex = 0;
+}
+
 /**
  * Set file position for directories. The only allowed set position operation
  * for directories is to rewind the directory completely by setting the
@@ -1122,6 +1665,7 @@ EFI_STATUS fsw_efi_dir_setpos(
     IN UINT64 Position
 ) {
     if (Position == 0) {
+        fsw_efi_dir_release_batch(File);
         File->shand.pos = 0;
         return EFI_SUCCESS;
     } else {
@@ -49,11 +49,46 @@
     0xce345171, 0xba0b, 0x11d2, {0x8e, 0x4f, 0x0, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
   }
 
+#define REFINDPLUS_EFI_DISK_IO2_PROTOCOL_GUID \
+  { \
+    0x151c8eae, 0x7f2c, 0x472c, {0x9e, 0x54, 0x98, 0x28, 0x19, 0x4f, 0x6a, 0x88 } \
+  }
+
 #define REFINDPLUS_EFI_BLOCK_IO_PROTOCOL_GUID \
   { \
     0x964e5b21, 0x6459, 0x11d2, {0x8e, 0x39, 0x0, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
   }
 
+#define REFINDPLUS_EFI_LOADED_IMAGE_PROTOCOL_GUID \
+  { \
+    0x5b1b31a1, 0x9562, 0x11d2, {0x8e, 0x3f, 0x0, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
+  }
+
+/** Default number of windows in the per-volume read cache. */
+#ifndef FSW_EFI_CACHE_WAYS
+#define FSW_EFI_CACHE_WAYS 8
+#endif
+/** Upper limit for the number of cache windows accepted from the load options. */
+#define FSW_EFI_CACHE_WAYS_MAX 64
+/** Default size in bytes of one read cache window. Must be a power of two. */
+#ifndef FSW_EFI_CACHE_WINDOW
+#define FSW_EFI_CACHE_WINDOW 131072
+#endif
+/** Smallest and largest window size accepted from the load options. */
+#define FSW_EFI_CACHE_WINDOW_MIN 4096
+#define FSW_EFI_CACHE_WINDOW_MAX 1048576
+
+/**
+ * EFI Host: One window of the per-volume read cache.
+ */
+
+typedef struct {
+    UINT8                       *Buffer;        //!< Window data, allocated on first use
+    UINT64                      Start;          //!< Disk byte offset of the window
+    BOOLEAN                     Valid;          //!< Whether Buffer holds the data at Start
+    UINT64                      LastUse;        //!< Value of the volume's cache clock at the last access
+} FSW_EFI_CACHE_SLOT;
+
 /**
  * EFI Host: Private per-volume structure.
  */
@@ -65,11 +100,25 @@ typedef struct {
 
     EFI_HANDLE                  Handle;         //!< The device handle the protocol is attached to
     EFI_DISK_IO                 *DiskIo;        //!< The Disk I/O protocol we use for disk access
+#ifdef __MAKEWITH_TIANO
+    EFI_DISK_IO2                *DiskIo2;       //!< Disk I/O 2 protocol for asynchronous reads, if present
+#endif
     UINT32                      MediaId;        //!< The media ID from the Block I/O protocol
+    UINT64                      DiskSize;       //!< Size of the media in bytes, from the Block I/O protocol
     EFI_STATUS                  LastIOStatus;   //!< Last status from Disk I/O
 
     struct fsw_volume           *vol;           //!< FSW volume structure
 
+    VOID                        *Probe;         //!< Start of the disk as read by Supported, while mounting
+    UINTN                       ProbeSize;      //!< Size of Probe in bytes
+
+    FSW_EFI_CACHE_SLOT          *Cache;         //!< Read cache windows, allocated on first read
+    UINTN                       CacheWays;      //!< Number of entries in Cache
+    UINTN                       CacheWindow;    //!< Size of each window in bytes
+    UINT64                      CacheClock;     //!< Access counter used for LRU replacement
+    UINT64                      CacheHits;      //!< Blocks served from the read cache
+    UINT64                      CacheMisses;    //!< Windows read from the disk
+
 } FSW_VOLUME_DATA;
 
 /** Signature for the volume structure. */
@@ -89,6 +138,10 @@ typedef struct {
     UINT64                       Type;           //!< File type used for dispatching
     struct fsw_shandle          shand;          //!< FSW handle for this file
 
+    struct fsw_dnode            *DirBatch[FSW_DIR_READ_PLUS_MAX]; //!< Directory entries read ahead, filled
+    UINTN                       DirBatchCount;  //!< Number of entries in DirBatch
+    UINTN                       DirBatchIndex;  //!< Next entry of DirBatch to return
+
 } FSW_FILE_DATA;
 
 /** File type: regular file. */
@@ -110,6 +163,6 @@ VOID fsw_efi_decode_time(OUT EFI_TIME *EfiTime, IN UINT32 UnixTime);
 
 UINTN fsw_efi_strsize(struct fsw_string *s);
 VOID fsw_efi_strcpy(CHAR16 *Dest, struct fsw_string *src);
-VOID EFIAPI fsw_efi_clear_cache(VOID);
+VOID EFIAPI fsw_efi_clear_cache(FSW_VOLUME_DATA *Volume);
 
 #endif
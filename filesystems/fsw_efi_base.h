@@ -71,6 +71,7 @@ typedef UINT64  fsw_u64;
 
 #define fsw_memzero(dest,size) ZeroMem(dest,size)
 #define fsw_memcpy(dest,src,size) CopyMem(dest,src,size)
+#define fsw_memmove(dest,src,size) CopyMem(dest,src,size)
 #define fsw_memeq(p1,p2,size) (CompareMem(p1,p2,size) == 0)
 
 // message printing
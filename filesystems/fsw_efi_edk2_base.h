@@ -59,6 +59,8 @@
 # include <Protocol/SimpleFileSystem.h>
 # include <Protocol/BlockIo.h>
 # include <Protocol/DiskIo.h>
+# include <Protocol/DiskIo2.h>
+# include <Protocol/LoadedImage.h>
 # include <Guid/FileSystemInfo.h>
 # include <Guid/FileInfo.h>
 # include <Guid/FileSystemVolumeLabelInfo.h>
@@ -31,6 +31,8 @@ static void         fsw_ext2_volume_free(struct fsw_ext2_volume *vol);
 static fsw_status_t fsw_ext2_volume_stat(struct fsw_ext2_volume *vol, struct fsw_volume_stat *sb);
 
 static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno);
+static fsw_status_t fsw_ext2_dnode_locate(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                        fsw_u64 *phys_bno_out);
 static void         fsw_ext2_dnode_free(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno);
 static fsw_status_t fsw_ext2_dnode_stat(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
                                         struct fsw_dnode_stat *sb);
@@ -46,6 +48,9 @@ static fsw_status_t fsw_ext2_read_dentry(struct fsw_shandle *shand, struct ext2_
 static fsw_status_t fsw_ext2_readlink(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
                                       struct fsw_string *link);
 
+static fsw_status_t fsw_ext2_check_superblock(struct ext2_super_block *sb);
+static fsw_status_t fsw_ext2_probe(void *buffer, fsw_u32 size);
+
 //
 // Dispatch Table
 //
@@ -65,8 +70,41 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext2) = {
     fsw_ext2_dir_lookup,
     fsw_ext2_dir_read,
     fsw_ext2_readlink,
+    fsw_ext2_dnode_locate,
+    fsw_ext2_probe,
 };
 
+/**
+ * Check the magic, revision and incompatible feature flags of an ext2 superblock.
+ * Shared by the mount and probe functions, so that both accept the same volumes.
+ */
+
+static fsw_status_t fsw_ext2_check_superblock(struct ext2_super_block *sb)
+{
+    if (sb->s_magic != EXT2_SUPER_MAGIC)
+        return FSW_UNSUPPORTED;
+    if (sb->s_rev_level != EXT2_GOOD_OLD_REV &&
+        sb->s_rev_level != EXT2_DYNAMIC_REV)
+        return FSW_UNSUPPORTED;
+    if (sb->s_rev_level == EXT2_DYNAMIC_REV &&
+        (sb->s_feature_incompat & ~(EXT2_FEATURE_INCOMPAT_FILETYPE | EXT3_FEATURE_INCOMPAT_RECOVER)))
+        return FSW_UNSUPPORTED;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Probe for an ext2 volume in the first bytes of the disk, without mounting.
+ */
+
+static fsw_status_t fsw_ext2_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u32         offset = EXT2_SUPERBLOCK_BLOCKNO * EXT2_SUPERBLOCK_BLOCKSIZE;
+
+    if (size < offset + sizeof (struct ext2_super_block))
+        return FSW_UNSUPPORTED;
+    return fsw_ext2_check_superblock((struct ext2_super_block *)((fsw_u8 *)buffer + offset));
+}
+
 /**
  * Mount an ext2 volume. Reads the superblock and constructs the
  * root directory dnode.
@@ -96,14 +134,9 @@ static fsw_status_t fsw_ext2_volume_mount(struct fsw_ext2_volume *vol)
     fsw_block_release(vol, EXT2_SUPERBLOCK_BLOCKNO, buffer);
 
     // check the superblock
-    if (vol->sb->s_magic != EXT2_SUPER_MAGIC)
-        return FSW_UNSUPPORTED;
-    if (vol->sb->s_rev_level != EXT2_GOOD_OLD_REV &&
-        vol->sb->s_rev_level != EXT2_DYNAMIC_REV)
-        return FSW_UNSUPPORTED;
-    if (vol->sb->s_rev_level == EXT2_DYNAMIC_REV &&
-        (vol->sb->s_feature_incompat & ~(EXT2_FEATURE_INCOMPAT_FILETYPE | EXT3_FEATURE_INCOMPAT_RECOVER)))
-        return FSW_UNSUPPORTED;
+    status = fsw_ext2_check_superblock(vol->sb);
+    if (status)
+        return status;
 
     /*
      if (vol->sb->s_rev_level == EXT2_DYNAMIC_REV &&
@@ -234,6 +267,26 @@ static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_
     return FSW_SUCCESS;
 }
 
+/**
+ * Report the inode table block holding a dnode's inode without reading it. Used by
+ * the core to read the inodes of a directory listing together.
+ */
+
+static fsw_status_t fsw_ext2_dnode_locate(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                        fsw_u64 *phys_bno_out)
+{
+    fsw_u32         groupno, ino_in_group;
+
+    if (dno->g.dnode_id == 0 || dno->g.dnode_id > vol->sb->s_inodes_count)
+        return FSW_VOLUME_CORRUPTED;
+
+    groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
+    ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
+    *phys_bno_out = vol->inotab_bno[groupno] +
+        ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
+    return FSW_SUCCESS;
+}
+
 /**
  * Free the dnode data structure. Called by the core when deallocating a dnode
  * structure to release the memory used by the file system type specific part
@@ -32,6 +32,8 @@ static void         fsw_ext4_volume_free(struct fsw_ext4_volume *vol);
 static fsw_status_t fsw_ext4_volume_stat(struct fsw_ext4_volume *vol, struct fsw_volume_stat *sb);
 
 static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno);
+static fsw_status_t fsw_ext4_dnode_locate(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                        fsw_u64 *phys_bno_out);
 static void         fsw_ext4_dnode_free(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno);
 static fsw_status_t fsw_ext4_dnode_stat(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                         struct fsw_dnode_stat *sb);
@@ -47,10 +49,16 @@ static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_
 static fsw_status_t fsw_ext4_dir_read(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                       struct fsw_shandle *shand, struct fsw_ext4_dnode **child_dno);
 static fsw_status_t fsw_ext4_read_dentry(struct fsw_shandle *shand, struct ext4_dir_entry *entry);
+static fsw_status_t fsw_ext4_dx_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                      struct fsw_string *lookup_name, struct fsw_shandle *shand,
+                                      struct ext4_dir_entry *entry);
 
 static fsw_status_t fsw_ext4_readlink(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                       struct fsw_string *link);
 
+static fsw_status_t fsw_ext4_check_superblock(struct ext4_super_block *sb);
+static fsw_status_t fsw_ext4_probe(void *buffer, fsw_u32 size);
+
 //
 // Dispatch Table
 //
@@ -70,6 +78,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext4) = {
     fsw_ext4_dir_lookup,
     fsw_ext4_dir_read,
     fsw_ext4_readlink,
+    fsw_ext4_dnode_locate,
+    fsw_ext4_probe,
 };
 
 
@@ -100,6 +110,40 @@ fsw_ext4_group_first_block_no(struct ext4_super_block *sb, fsw_u32 group_no)
                 sb->s_first_data_block;
 }
 
+/**
+ * Check the magic, revision and incompatible feature flags of an ext4 superblock.
+ * Shared by the mount and probe functions, so that both accept the same volumes.
+ */
+
+static fsw_status_t fsw_ext4_check_superblock(struct ext4_super_block *sb)
+{
+    if (sb->s_magic != EXT4_SUPER_MAGIC)
+        return FSW_UNSUPPORTED;
+    if (sb->s_rev_level != EXT4_GOOD_OLD_REV &&
+        sb->s_rev_level != EXT4_DYNAMIC_REV)
+        return FSW_UNSUPPORTED;
+    if (sb->s_rev_level == EXT4_DYNAMIC_REV &&
+        (sb->s_feature_incompat & ~(EXT4_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_RECOVER |
+                                    EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_FLEX_BG |
+                                    EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_META_BG |
+                                    EXT4_FEATURE_INCOMPAT_ENCRYPT)))
+        return FSW_UNSUPPORTED;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Probe for an ext4 volume in the first bytes of the disk, without mounting.
+ */
+
+static fsw_status_t fsw_ext4_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u32         offset = EXT4_SUPERBLOCK_BLOCKNO * EXT4_SUPERBLOCK_BLOCKSIZE;
+
+    if (size < offset + sizeof (struct ext4_super_block))
+        return FSW_UNSUPPORTED;
+    return fsw_ext4_check_superblock((struct ext4_super_block *)((fsw_u8 *)buffer + offset));
+}
+
 /**
  * Mount an ext4 volume. Reads the superblock and constructs the
  * root directory dnode.
@@ -110,9 +154,7 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
     fsw_status_t    status;
     void            *buffer;
     fsw_u32         blocksize;
-    fsw_u32         groupcnt, groupno, gdesc_per_block, gdesc_index, metabg_of_gdesc;
-    fsw_u64         gdesc_bno;
-    struct ext4_group_desc *gdesc;
+    fsw_u64         blocks_count;
     int             i;
     struct fsw_string s;
 
@@ -130,20 +172,11 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
     fsw_block_release(vol, EXT4_SUPERBLOCK_BLOCKNO, buffer);
 
     // check the superblock
-    if (vol->sb->s_magic != EXT4_SUPER_MAGIC)
-        return FSW_UNSUPPORTED;
-    if (vol->sb->s_rev_level != EXT4_GOOD_OLD_REV &&
-        vol->sb->s_rev_level != EXT4_DYNAMIC_REV)
-        return FSW_UNSUPPORTED;
-
     FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_volume_mount: Incompat flag %x\n"), vol->sb->s_feature_incompat));
 
-    if (vol->sb->s_rev_level == EXT4_DYNAMIC_REV &&
-        (vol->sb->s_feature_incompat & ~(EXT4_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_RECOVER |
-                                         EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_FLEX_BG |
-                                         EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_META_BG |
-                                         EXT4_FEATURE_INCOMPAT_ENCRYPT)))
-        return FSW_UNSUPPORTED;
+    status = fsw_ext4_check_superblock(vol->sb);
+    if (status)
+        return status;
 
     if (vol->sb->s_rev_level == EXT4_DYNAMIC_REV &&
         (vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_RECOVER))
@@ -181,60 +214,109 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
     }
 
     // Calculate group descriptor count the way the kernel does it...
-    groupcnt = (vol->sb->s_blocks_count_lo - vol->sb->s_first_data_block +
-                vol->sb->s_blocks_per_group - 1) / vol->sb->s_blocks_per_group;
+    blocks_count = vol->sb->s_blocks_count_lo;
+    if (vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT)
+        blocks_count |= (fsw_u64)vol->sb->s_blocks_count_hi << 32;
+    if (vol->sb->s_blocks_per_group == 0 || blocks_count <= vol->sb->s_first_data_block)
+        return FSW_VOLUME_CORRUPTED;
+    vol->group_count = (fsw_u32)FSW_U64_DIV(blocks_count - vol->sb->s_first_data_block +
+                                            vol->sb->s_blocks_per_group - 1, vol->sb->s_blocks_per_group);
 
     // Descriptors in one block... s_desc_size needs to be set! (Usually 128 since normal block
     // descriptors are 32 byte and block size is 4096)
-    gdesc_per_block = EXT4_DESC_PER_BLOCK(vol->sb);
+    if (vol->sb->s_desc_size < EXT4_MIN_DESC_SIZE || vol->sb->s_desc_size > blocksize)
+        return FSW_UNSUPPORTED;
+    vol->gdesc_per_block = EXT4_DESC_PER_BLOCK(vol->sb);
 
-    // Read the group descriptors to get inode table offsets
-    status = fsw_alloc(sizeof (fsw_u64) * groupcnt, &vol->inotab_bno);
+    // The group descriptors are read when an inode of the group is first needed,
+    //  see fsw_ext4_inotab_bno
+
+    // setup the root dnode
+    status = fsw_dnode_create_root(vol, EXT4_ROOT_INO, &vol->g.root);
     if (status)
         return status;
 
-    // Loop through all block group descriptors in order to get inode table locations
-    for (groupno = 0; groupno < groupcnt; groupno++) {
-
-        // Calculate the block number which contains the block group descriptor we look for
-        if(vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_META_BG && groupno >= vol->sb->s_first_meta_bg)
-        {
-            // If option meta_bg is set, the block group descriptor is in meta block group...
-            metabg_of_gdesc = (fsw_u32)(groupno / gdesc_per_block) * gdesc_per_block;
-            gdesc_bno = fsw_ext4_group_first_block_no(vol->sb, metabg_of_gdesc);
-            // We need to know if the block group in question has a super block, if yes, the
-            // block group descriptors are in the next block number
-            if(!(vol->sb->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER) || fsw_ext4_group_sparse(metabg_of_gdesc))
-                gdesc_bno += 1;
-        }
-        else
-        {
-            // All group descriptors follow the super block (+1)
-            gdesc_bno = (vol->sb->s_first_data_block + 1) + groupno / gdesc_per_block;
+    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_volume_mount: success, blocksize %d\n"), blocksize));
+
+    return FSW_SUCCESS;
+}
+
+/**
+ * Get the block holding the group descriptor of a block group.
+ */
+
+static fsw_u64 fsw_ext4_gdesc_bno(struct fsw_ext4_volume *vol, fsw_u32 groupno)
+{
+    fsw_u32         metabg_of_gdesc;
+    fsw_u64         gdesc_bno;
+
+    // Calculate the block number which contains the block group descriptor we look for
+    if(vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_META_BG && groupno >= vol->sb->s_first_meta_bg)
+    {
+        // If option meta_bg is set, the block group descriptor is in meta block group...
+        metabg_of_gdesc = (fsw_u32)(groupno / vol->gdesc_per_block) * vol->gdesc_per_block;
+        gdesc_bno = fsw_ext4_group_first_block_no(vol->sb, metabg_of_gdesc);
+        // We need to know if the block group in question has a super block, if yes, the
+        // block group descriptors are in the next block number
+        if(!(vol->sb->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER) || fsw_ext4_group_sparse(metabg_of_gdesc))
+            gdesc_bno += 1;
+    }
+    else
+    {
+        // All group descriptors follow the super block (+1)
+        gdesc_bno = (vol->sb->s_first_data_block + 1) + groupno / vol->gdesc_per_block;
+    }
+    return gdesc_bno;
+}
+
+/**
+ * Get the first block of the inode table of a block group. Group descriptors are
+ * read on demand, a whole descriptor block at a time, and the inode table locations
+ * from the last EXT4_GDESC_CACHE_SIZE descriptor blocks are kept. Mounting a large
+ * volume thus doesn't read or keep the descriptors of all its groups.
+ */
+
+static fsw_status_t fsw_ext4_inotab_bno(struct fsw_ext4_volume *vol, fsw_u32 groupno, fsw_u64 *bno_out)
+{
+    fsw_status_t    status;
+    fsw_u32         dblock, first_group, i;
+    fsw_u64         gdesc_bno;
+    struct fsw_ext4_gdesc_cache *slot;
+    struct ext4_group_desc *gdesc;
+    fsw_u8          *buffer;
+
+    if (groupno >= vol->group_count)
+        return FSW_VOLUME_CORRUPTED;
+
+    dblock = groupno / vol->gdesc_per_block;
+    slot = &vol->gdesc_cache[dblock % EXT4_GDESC_CACHE_SIZE];
+    if (slot->dblock != dblock + 1) {
+        if (slot->inotab_bno == NULL) {
+            status = fsw_alloc(sizeof (fsw_u64) * vol->gdesc_per_block, &slot->inotab_bno);
+            if (status)
+                return status;
         }
-        gdesc_index = groupno % gdesc_per_block;
+        slot->dblock = 0;
 
-        // Get block if necessary...
+        first_group = dblock * vol->gdesc_per_block;
+        gdesc_bno = fsw_ext4_gdesc_bno(vol, first_group);
         status = fsw_block_get(vol, gdesc_bno, 1, (void **)&buffer);
         if (status)
             return status;
 
-        // Get group descriptor table and block number of inode table...
-        gdesc = (struct ext4_group_desc *)((char *)buffer + gdesc_index * vol->sb->s_desc_size);
-        vol->inotab_bno[groupno] = gdesc->bg_inode_table_lo;
-        if (vol->sb->s_desc_size >= EXT4_MIN_DESC_SIZE_64BIT)
-            vol->inotab_bno[groupno] |= (fsw_u64)gdesc->bg_inode_table_hi << 32;
+        // Get block number of inode table from each group descriptor in the block...
+        for (i = 0; i < vol->gdesc_per_block && first_group + i < vol->group_count; i++) {
+            gdesc = (struct ext4_group_desc *)(buffer + i * vol->sb->s_desc_size);
+            slot->inotab_bno[i] = gdesc->bg_inode_table_lo;
+            if (vol->sb->s_desc_size >= EXT4_MIN_DESC_SIZE_64BIT)
+                slot->inotab_bno[i] |= (fsw_u64)gdesc->bg_inode_table_hi << 32;
+        }
 
         fsw_block_release(vol, gdesc_bno, buffer);
+        slot->dblock = dblock + 1;
     }
 
-    // setup the root dnode
-    status = fsw_dnode_create_root(vol, EXT4_ROOT_INO, &vol->g.root);
-    if (status)
-        return status;
-
-    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_volume_mount: success, blocksize %d\n"), blocksize));
-
+    *bno_out = slot->inotab_bno[groupno % vol->gdesc_per_block];
     return FSW_SUCCESS;
 }
 
@@ -246,10 +328,13 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
 
 static void fsw_ext4_volume_free(struct fsw_ext4_volume *vol)
 {
+    int             i;
+
     if (vol->sb)
         fsw_free(vol->sb);
-    if (vol->inotab_bno)
-        fsw_free(vol->inotab_bno);
+    for (i = 0; i < EXT4_GDESC_CACHE_SIZE; i++)
+        if (vol->gdesc_cache[i].inotab_bno)
+            fsw_free(vol->gdesc_cache[i].inotab_bno);
 }
 
 /**
@@ -295,8 +380,10 @@ static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_
     // read the inode block
     groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
     ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
-    ino_bno = vol->inotab_bno[groupno] +
-        ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
+    status = fsw_ext4_inotab_bno(vol, groupno, &ino_bno);
+    if (status)
+        return status;
+    ino_bno += ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
     ino_index = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
     status = fsw_block_get(vol, ino_bno, 2, (void **)&buffer);
 
@@ -326,6 +413,29 @@ static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_
     return FSW_SUCCESS;
 }
 
+/**
+ * Report the inode table block holding a dnode's inode without reading it. Used by
+ * the core to read the inodes of a directory listing together.
+ */
+
+static fsw_status_t fsw_ext4_dnode_locate(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                        fsw_u64 *phys_bno_out)
+{
+    fsw_status_t    status;
+    fsw_u32         groupno, ino_in_group;
+
+    if (dno->g.dnode_id == 0 || dno->g.dnode_id > vol->sb->s_inodes_count)
+        return FSW_VOLUME_CORRUPTED;
+
+    groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
+    ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
+    status = fsw_ext4_inotab_bno(vol, groupno, phys_bno_out);
+    if (status)
+        return status;
+    *phys_bno_out += ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
+    return FSW_SUCCESS;
+}
+
 /**
  * Free the dnode data structure. Called by the core when deallocating a dnode
  * structure to release the memory used by the file system type specific part
@@ -393,14 +503,22 @@ static fsw_status_t fsw_ext4_get_extent(struct fsw_ext4_volume *vol, struct fsw_
 }
 
 /**
- * New ext4 extents...
+ * Map a logical block through the ext4 extent tree. In each node, a binary search
+ * finds the last entry starting at or before the block; for index nodes that is the
+ * only child that can cover it. Blocks not covered by any extent, and unwritten
+ * extents, are returned as sparse.
+ *
+ * The leaf reached last is remembered in the dnode with the range of logical blocks
+ * its index entries give it, so that lookups in that range, e.g. during a sequential
+ * read, go to the leaf directly instead of walking down from the inode again.
  */
 static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                         struct fsw_extent *extent)
 {
     fsw_status_t  status;
-    fsw_u32       bno, buf_offset;
-    int           ext_cnt;
+    fsw_u32       bno, count, lo, hi, mid, len, max_entries;
+    fsw_u64       phys_bno, start, end, next, file_bcnt;
+    int           depth;
     void          *buffer;
 
     struct ext4_extent_header  *ext4_extent_header;
@@ -410,59 +528,126 @@ static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct f
     // Logical block requested by core...
     bno = extent->log_start;
 
-    // First buffer is the i_block field from inode...
-    buffer = (void *)dno->raw->i_block;
-    buf_offset = 0;
-    while(1) {
-        ext4_extent_header = (struct ext4_extent_header *)((char *)buffer + buf_offset);
-        buf_offset += sizeof (struct ext4_extent_header);
-        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent header with %d entries\n"),
-                      ext4_extent_header->eh_entries));
-        if(ext4_extent_header->eh_magic != EXT4_EXT_MAGIC)
-            return FSW_VOLUME_CORRUPTED;
+    if (dno->leaf_bno != 0 && bno >= dno->leaf_start && bno < dno->leaf_end) {
+        // Same leaf as last time...
+        phys_bno = dno->leaf_bno;
+        start = dno->leaf_start;
+        end = dno->leaf_end;
+        status = fsw_block_get(vol, phys_bno, 1, &buffer);
+        if (status)
+            return status;
+        depth = 0;
+    } else {
+        // First buffer is the i_block field from inode...
+        phys_bno = 0;
+        buffer = (void *)dno->raw->i_block;
+        start = 0;
+        end = (fsw_u64)1 << 32;
+        depth = -1;
+    }
 
-        for(ext_cnt = 0;ext_cnt < ext4_extent_header->eh_entries;ext_cnt++)
-        {
-            if(ext4_extent_header->eh_depth == 0)
-            {
-                // Leaf node, the header follows actual extents
-                ext4_extent = (struct ext4_extent *)((char *)buffer + buf_offset);
-                buf_offset += sizeof (struct ext4_extent);
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent node cover %d...\n"), ext4_extent->ee_block));
-
-                // Is the requested block in this extent?
-                if(bno >= ext4_extent->ee_block && bno < ext4_extent->ee_block + ext4_extent->ee_len)
-                {
-                    extent->phys_start = ((fsw_u64)ext4_extent->ee_start_hi << 32) | ext4_extent->ee_start_lo;
-                    extent->phys_start += (bno - ext4_extent->ee_block);
-                    extent->log_count = ext4_extent->ee_len - (bno - ext4_extent->ee_block);
-                    return FSW_SUCCESS;
-                }
+    while (1) {
+        ext4_extent_header = (struct ext4_extent_header *)buffer;
+        max_entries = ((phys_bno ? vol->g.log_blocksize : sizeof (dno->raw->i_block))
+                       - sizeof (struct ext4_extent_header)) / sizeof (struct ext4_extent);
+        if (ext4_extent_header->eh_magic != EXT4_EXT_MAGIC ||
+            ext4_extent_header->eh_entries > ext4_extent_header->eh_max ||
+            ext4_extent_header->eh_max > max_entries ||
+            ext4_extent_header->eh_depth > EXT4_MAX_EXTENT_DEPTH ||
+            (depth >= 0 && ext4_extent_header->eh_depth != depth)) {
+            status = FSW_VOLUME_CORRUPTED;
+            break;
+        }
+        count = ext4_extent_header->eh_entries;
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent header with %d entries, depth %d\n"),
+                      count, ext4_extent_header->eh_depth));
+
+        if (ext4_extent_header->eh_depth == 0) {
+            // Leaf node, the header is followed by the actual extents
+            ext4_extent = (struct ext4_extent *)(ext4_extent_header + 1);
+            lo = 0;
+            hi = count;
+            while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (ext4_extent[mid].ee_block <= bno)
+                    lo = mid + 1;
+                else
+                    hi = mid;
             }
-            else
-            {
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index extents, depth %d\n"),
-                          ext4_extent_header->eh_depth));
-                ext4_extent_idx = (struct ext4_extent_idx *)((char *)buffer + buf_offset);
-                buf_offset += sizeof (struct ext4_extent_idx);
-
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index node covers block %d...\n"),
-                          ext4_extent_idx->ei_block));
-                if(bno >= ext4_extent_idx->ei_block)
-                {
-                    // Follow extent tree...
-                    fsw_u64 phys_bno = ((fsw_u64)ext4_extent_idx->ei_leaf_hi << 32) | ext4_extent_idx->ei_leaf_lo;
-                    status = fsw_block_get(vol, phys_bno, 1, (void **)&buffer);
-                    if (status)
-                        return status;
-                    buf_offset = 0;
+
+            if (phys_bno != 0) {
+                dno->leaf_bno = phys_bno;
+                dno->leaf_start = (fsw_u32)start;
+                dno->leaf_end = end;
+            }
+
+            // lo - 1 is the last extent starting at or before bno, if any
+            status = FSW_SUCCESS;
+            if (lo > 0) {
+                ext4_extent += lo - 1;
+                len = ext4_extent->ee_len;
+                if (len > EXT_INIT_MAX_LEN)
+                    len -= EXT_INIT_MAX_LEN;
+                if (bno - ext4_extent->ee_block < len) {
+                    extent->log_count = len - (bno - ext4_extent->ee_block);
+                    if (ext4_extent->ee_len > EXT_INIT_MAX_LEN) {
+                        extent->type = FSW_EXTENT_TYPE_SPARSE;
+                    } else {
+                        extent->phys_start = ((fsw_u64)ext4_extent->ee_start_hi << 32) | ext4_extent->ee_start_lo;
+                        extent->phys_start += (bno - ext4_extent->ee_block);
+                    }
                     break;
                 }
+                ext4_extent -= lo - 1;
             }
+
+            // A hole, up to the next extent, the end of this leaf's range or the end of file
+            next = (lo < count) ? ext4_extent[lo].ee_block : end;
+            file_bcnt = FSW_U64_DIV(dno->g.size + vol->g.log_blocksize - 1, vol->g.log_blocksize);
+            if (next > file_bcnt)
+                next = file_bcnt;
+            extent->type = FSW_EXTENT_TYPE_SPARSE;
+            extent->log_count = (next > bno) ? (fsw_u32)(next - bno) : 1;
+            break;
+        }
+
+        // Index node, follow the last index starting at or before bno; the first
+        //  one also covers blocks before its ei_block
+        ext4_extent_idx = (struct ext4_extent_idx *)(ext4_extent_header + 1);
+        if (count == 0) {
+            status = FSW_VOLUME_CORRUPTED;
+            break;
         }
+        lo = 1;
+        hi = count;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (ext4_extent_idx[mid].ei_block <= bno)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        ext4_extent_idx += lo - 1;
+        if (ext4_extent_idx->ei_block > start)
+            start = ext4_extent_idx->ei_block;
+        if (lo < count && ext4_extent_idx[1].ei_block < end)
+            end = ext4_extent_idx[1].ei_block;
+        depth = ext4_extent_header->eh_depth - 1;
+
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index node covers block %d...\n"),
+                      ext4_extent_idx->ei_block));
+        next = ((fsw_u64)ext4_extent_idx->ei_leaf_hi << 32) | ext4_extent_idx->ei_leaf_lo;
+        if (phys_bno != 0)
+            fsw_block_release(vol, phys_bno, buffer);
+        phys_bno = next;
+        status = fsw_block_get(vol, phys_bno, 1, &buffer);
+        if (status)
+            return status;
     }
 
-    return FSW_NOT_FOUND;
+    if (phys_bno != 0)
+        fsw_block_release(vol, phys_bno, buffer);
+    return status;
 }
 
 /**
@@ -554,6 +739,359 @@ static fsw_status_t fsw_ext4_get_by_blkaddr(struct fsw_ext4_volume *vol, struct
     return FSW_SUCCESS;
 }
 
+//
+// Hashed directory (htree) lookup, after fs/ext4/hash.c and namei.c in Linux
+//
+
+#define EXT4_DX_ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+static void fsw_ext4_dx_tea_transform(fsw_u32 buf[4], const fsw_u32 in[4])
+{
+    fsw_u32         sum = 0;
+    fsw_u32         b0 = buf[0], b1 = buf[1];
+    fsw_u32         a = in[0], b = in[1], c = in[2], d = in[3];
+    int             n = 16;
+
+    do {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+#define EXT4_DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT4_DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT4_DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define EXT4_DX_ROUND(f, a, b, c, d, x, s) \
+    (a += f(b, c, d) + (x), a = EXT4_DX_ROL32(a, s))
+#define EXT4_DX_K2 013240474631UL
+#define EXT4_DX_K3 015666365641UL
+
+static void fsw_ext4_dx_half_md4_transform(fsw_u32 buf[4], const fsw_u32 in[8])
+{
+    fsw_u32         a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    // round 1
+    EXT4_DX_ROUND(EXT4_DX_F, a, b, c, d, in[0],  3);
+    EXT4_DX_ROUND(EXT4_DX_F, d, a, b, c, in[1],  7);
+    EXT4_DX_ROUND(EXT4_DX_F, c, d, a, b, in[2], 11);
+    EXT4_DX_ROUND(EXT4_DX_F, b, c, d, a, in[3], 19);
+    EXT4_DX_ROUND(EXT4_DX_F, a, b, c, d, in[4],  3);
+    EXT4_DX_ROUND(EXT4_DX_F, d, a, b, c, in[5],  7);
+    EXT4_DX_ROUND(EXT4_DX_F, c, d, a, b, in[6], 11);
+    EXT4_DX_ROUND(EXT4_DX_F, b, c, d, a, in[7], 19);
+
+    // round 2
+    EXT4_DX_ROUND(EXT4_DX_G, a, b, c, d, in[1] + EXT4_DX_K2,  3);
+    EXT4_DX_ROUND(EXT4_DX_G, d, a, b, c, in[3] + EXT4_DX_K2,  5);
+    EXT4_DX_ROUND(EXT4_DX_G, c, d, a, b, in[5] + EXT4_DX_K2,  9);
+    EXT4_DX_ROUND(EXT4_DX_G, b, c, d, a, in[7] + EXT4_DX_K2, 13);
+    EXT4_DX_ROUND(EXT4_DX_G, a, b, c, d, in[0] + EXT4_DX_K2,  3);
+    EXT4_DX_ROUND(EXT4_DX_G, d, a, b, c, in[2] + EXT4_DX_K2,  5);
+    EXT4_DX_ROUND(EXT4_DX_G, c, d, a, b, in[4] + EXT4_DX_K2,  9);
+    EXT4_DX_ROUND(EXT4_DX_G, b, c, d, a, in[6] + EXT4_DX_K2, 13);
+
+    // round 3
+    EXT4_DX_ROUND(EXT4_DX_H, a, b, c, d, in[3] + EXT4_DX_K3,  3);
+    EXT4_DX_ROUND(EXT4_DX_H, d, a, b, c, in[7] + EXT4_DX_K3,  9);
+    EXT4_DX_ROUND(EXT4_DX_H, c, d, a, b, in[2] + EXT4_DX_K3, 11);
+    EXT4_DX_ROUND(EXT4_DX_H, b, c, d, a, in[6] + EXT4_DX_K3, 15);
+    EXT4_DX_ROUND(EXT4_DX_H, a, b, c, d, in[1] + EXT4_DX_K3,  3);
+    EXT4_DX_ROUND(EXT4_DX_H, d, a, b, c, in[5] + EXT4_DX_K3,  9);
+    EXT4_DX_ROUND(EXT4_DX_H, c, d, a, b, in[0] + EXT4_DX_K3, 11);
+    EXT4_DX_ROUND(EXT4_DX_H, b, c, d, a, in[4] + EXT4_DX_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/**
+ * Pack up to num*4 name bytes into hash input words, padded with the length.
+ * The signed variants sign-extend the bytes, as ext4 did on x86 before the
+ * unsigned hash versions existed.
+ */
+
+static void fsw_ext4_dx_str2hashbuf(const fsw_u8 *msg, int len, fsw_u32 *buf, int num, int is_signed)
+{
+    fsw_u32         pad, val;
+    int             i, c;
+
+    pad = (fsw_u32)len | ((fsw_u32)len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num * 4)
+        len = num * 4;
+    for (i = 0; i < len; i++) {
+        c = is_signed ? (int)(signed char)msg[i] : (int)msg[i];
+        val = (fsw_u32)c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+static fsw_u32 fsw_ext4_dx_hack_hash(const fsw_u8 *name, int len, int is_signed)
+{
+    fsw_u32         hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int             c;
+
+    while (len--) {
+        c = is_signed ? (int)(signed char)*name++ : (int)*name++;
+        hash = hash1 + (hash0 ^ (fsw_u32)(c * 7152373));
+
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+/**
+ * Compute the major hash of a file name the way ext4 orders it in the index.
+ */
+
+static fsw_status_t fsw_ext4_dx_hash(struct fsw_ext4_volume *vol, int hash_version,
+                                     const fsw_u8 *name, int len, fsw_u32 *hash_out)
+{
+    fsw_u32         buf[4], in[8];
+    fsw_u32         hash;
+    int             i, is_signed;
+
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+    for (i = 0; i < 4; i++) {
+        if (vol->sb->s_hash_seed[i] != 0) {
+            fsw_memcpy(buf, vol->sb->s_hash_seed, sizeof (buf));
+            break;
+        }
+    }
+
+    is_signed = (hash_version < EXT4_DX_HASH_LEGACY_UNSIGNED);
+    switch (hash_version) {
+        case EXT4_DX_HASH_LEGACY:
+        case EXT4_DX_HASH_LEGACY_UNSIGNED:
+            hash = fsw_ext4_dx_hack_hash(name, len, is_signed);
+            break;
+        case EXT4_DX_HASH_HALF_MD4:
+        case EXT4_DX_HASH_HALF_MD4_UNSIGNED:
+            for (; len > 0; len -= 32, name += 32) {
+                fsw_ext4_dx_str2hashbuf(name, len, in, 8, is_signed);
+                fsw_ext4_dx_half_md4_transform(buf, in);
+            }
+            hash = buf[1];
+            break;
+        case EXT4_DX_HASH_TEA:
+        case EXT4_DX_HASH_TEA_UNSIGNED:
+            for (; len > 0; len -= 16, name += 16) {
+                fsw_ext4_dx_str2hashbuf(name, len, in, 4, is_signed);
+                fsw_ext4_dx_tea_transform(buf, in);
+            }
+            hash = buf[0];
+            break;
+        default:
+            return FSW_UNSUPPORTED;
+    }
+
+    // the largest hash value marks the end of the directory in readdir cookies
+    hash &= ~1;
+    if (hash == (0x7fffffffU << 1))
+        hash = (0x7fffffffU - 1) << 1;
+    *hash_out = hash;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Read index block number block of the directory and find its dx_entry array,
+ * which starts at offset in the block. Returns FSW_UNSUPPORTED if the block
+ * doesn't look like an index block.
+ */
+
+static fsw_status_t fsw_ext4_dx_read_node(struct fsw_ext4_volume *vol, struct fsw_shandle *shand,
+                                          fsw_u32 block, fsw_u32 offset, fsw_u8 *buffer,
+                                          struct ext4_dx_entry **entries_out, fsw_u32 *count_out)
+{
+    fsw_status_t    status;
+    fsw_u32         blocksize = vol->g.log_blocksize;
+    fsw_u32         buffer_size = blocksize;
+    struct ext4_dx_countlimit *countlimit;
+
+    if ((fsw_u64)(block + 1) * blocksize > shand->dnode->size)
+        return FSW_UNSUPPORTED;
+    shand->pos = (fsw_u64)block * blocksize;
+    status = fsw_shandle_read(shand, &buffer_size, buffer);
+    if (status)
+        return status;
+    if (buffer_size < blocksize)
+        return FSW_UNSUPPORTED;
+
+    countlimit = (struct ext4_dx_countlimit *)(buffer + offset);
+    if (countlimit->count == 0 || countlimit->count > countlimit->limit ||
+        offset + countlimit->limit * sizeof (struct ext4_dx_entry) > blocksize)
+        return FSW_UNSUPPORTED;
+
+    *entries_out = (struct ext4_dx_entry *)(buffer + offset);
+    *count_out = countlimit->count;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Look up a name in a hash-indexed directory. Walks from the dx_root down to
+ * the leaf block whose hash range holds the name's hash and scans only that
+ * leaf, plus following leaves while a hash collision continues into them.
+ * On success, the directory entry is returned in entry.
+ *
+ * Returns FSW_NOT_FOUND if the index says the name is not there, and
+ * FSW_UNSUPPORTED if the index uses an unknown hash or is damaged, in which
+ * case the caller scans the directory linearly.
+ */
+
+static fsw_status_t fsw_ext4_dx_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                      struct fsw_string *lookup_name, struct fsw_shandle *shand,
+                                      struct ext4_dir_entry *entry)
+{
+    fsw_status_t    status;
+    fsw_u32         blocksize = vol->g.log_blocksize;
+    fsw_u8          *frames = NULL;
+    struct ext4_dir_entry *dirent;
+    struct ext4_dx_root_info *info;
+    struct ext4_dx_entry *entries[EXT4_HTREE_LEVEL];
+    fsw_u32         count[EXT4_HTREE_LEVEL], at[EXT4_HTREE_LEVEL];
+    fsw_u32         hash, lo, hi, mid, leaf;
+    fsw_u64         leaf_end;
+    int             levels, level, hash_version;
+    struct fsw_string name = FSW_STRING_INIT;
+    struct fsw_string entry_name;
+
+    // hash the name as it would be stored on disk
+    status = fsw_strdup_coerce(&name, FSW_STRING_TYPE_ISO88591, lookup_name);
+    if (status)
+        return status;
+    if (name.len == 0 || name.len > EXT4_NAME_LEN) {
+        status = FSW_NOT_FOUND;
+        goto done;
+    }
+
+    status = fsw_alloc(blocksize * EXT4_HTREE_LEVEL, &frames);
+    if (status)
+        goto done;
+
+    // read and check the root block, "." and ".." come first
+    status = fsw_ext4_dx_read_node(vol, shand, 0, EXT4_DX_ROOT_INFO_OFFSET + sizeof (struct ext4_dx_root_info),
+                                   frames, &entries[0], &count[0]);
+    if (status)
+        goto done;
+    dirent = (struct ext4_dir_entry *)frames;
+    if (dirent->rec_len != 12 || dirent->name_len != 1 || dirent->name[0] != '.') {
+        status = FSW_UNSUPPORTED;
+        goto done;
+    }
+    dirent = (struct ext4_dir_entry *)(frames + 12);
+    if (dirent->rec_len != blocksize - 12 || dirent->name_len != 2) {
+        status = FSW_UNSUPPORTED;
+        goto done;
+    }
+    info = (struct ext4_dx_root_info *)(frames + EXT4_DX_ROOT_INFO_OFFSET);
+    if (info->reserved_zero != 0 || info->info_length != sizeof (struct ext4_dx_root_info) ||
+        info->indirect_levels >= EXT4_HTREE_LEVEL) {
+        status = FSW_UNSUPPORTED;
+        goto done;
+    }
+    levels = info->indirect_levels + 1;
+
+    hash_version = info->hash_version;
+    if (hash_version <= EXT4_DX_HASH_TEA && (vol->sb->s_flags & EXT4_FLAGS_UNSIGNED_HASH))
+        hash_version += EXT4_DX_HASH_LEGACY_UNSIGNED;
+    status = fsw_ext4_dx_hash(vol, hash_version, name.data, name.len, &hash);
+    if (status)
+        goto done;
+
+    // descend: at each level, pick the last entry whose hash is <= our hash;
+    //  entry 0 has no hash and covers everything below entry 1
+    for (level = 0; ; level++) {
+        lo = 1;
+        hi = count[level];
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (entries[level][mid].hash > hash)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        at[level] = lo - 1;
+        if (level + 1 == levels)
+            break;
+        status = fsw_ext4_dx_read_node(vol, shand, entries[level][at[level]].block & EXT4_DX_BLOCK_MASK,
+                                       EXT4_DX_NODE_ENTRIES_OFFSET, frames + (level + 1) * blocksize,
+                                       &entries[level + 1], &count[level + 1]);
+        if (status)
+            goto done;
+    }
+
+    for (;;) {
+        // scan the leaf block
+        leaf = entries[levels - 1][at[levels - 1]].block & EXT4_DX_BLOCK_MASK;
+        if ((fsw_u64)(leaf + 1) * blocksize > dno->g.size) {
+            status = FSW_UNSUPPORTED;
+            goto done;
+        }
+        shand->pos = (fsw_u64)leaf * blocksize;
+        leaf_end = shand->pos + blocksize;
+        while (shand->pos < leaf_end) {
+            status = fsw_ext4_read_dentry(shand, entry);
+            if (status)
+                goto done;
+            if (entry->inode == 0)
+                break;
+            entry_name.type = FSW_STRING_TYPE_ISO88591;
+            entry_name.len = entry_name.size = entry->name_len;
+            entry_name.data = entry->name;
+            if (fsw_streq(lookup_name, &entry_name)) {
+                status = FSW_SUCCESS;
+                goto done;
+            }
+        }
+
+        // the name may continue in the next leaf if its hash collides across
+        //  the boundary; that leaf's index entry then has the low bit set
+        for (level = levels - 1; level >= 0 && at[level] + 1 >= count[level]; level--)
+            ;
+        if (level < 0 || (entries[level][at[level] + 1].hash & ~1) != hash) {
+            status = FSW_NOT_FOUND;
+            goto done;
+        }
+        at[level]++;
+        for (; level + 1 < levels; level++) {
+            status = fsw_ext4_dx_read_node(vol, shand, entries[level][at[level]].block & EXT4_DX_BLOCK_MASK,
+                                           EXT4_DX_NODE_ENTRIES_OFFSET, frames + (level + 1) * blocksize,
+                                           &entries[level + 1], &count[level + 1]);
+            if (status)
+                goto done;
+            at[level + 1] = 0;
+        }
+    }
+
+done:
+    if (frames != NULL)
+        fsw_free(frames);
+    fsw_strfree(&name);
+    return status;
+}
+
 /**
  * Lookup a directory's child dnode by name. This function is called on a directory
  * to retrieve the directory entry with the given name. A dnode is constructed for
@@ -579,8 +1117,24 @@ static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_
     if (status)
         return status;
 
-    // scan the directory for the file
+    // use the hash index if there is one, it reads only one block per tree level
     child_ino = 0;
+    if ((vol->sb->s_feature_compat & EXT4_FEATURE_COMPAT_DIR_INDEX) &&
+        (dno->raw->i_flags & EXT4_INDEX_FL)) {
+        status = fsw_ext4_dx_lookup(vol, dno, lookup_name, &shand, &entry);
+        if (status == FSW_SUCCESS) {
+            child_ino = entry.inode;
+            entry_name.len = entry_name.size = entry.name_len;
+            entry_name.data = entry.name;
+        } else if (status == FSW_UNSUPPORTED) {
+            // unknown hash or damaged index, scan all entries instead
+            shand.pos = 0;
+        } else {
+            goto errorexit;
+        }
+    }
+
+    // scan the directory for the file
     while (child_ino == 0) {
         // read next entry
         status = fsw_ext4_read_dentry(&shand, &entry);
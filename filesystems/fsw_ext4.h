@@ -36,6 +36,20 @@
 #define EXT4_SUPERBLOCK_BLOCKSIZE  1024
 //! Block number where the (master copy of the) ext4 superblock resides.
 #define EXT4_SUPERBLOCK_BLOCKNO       1
+//! Number of group descriptor blocks whose inode table locations are kept per volume.
+#ifndef EXT4_GDESC_CACHE_SIZE
+#define EXT4_GDESC_CACHE_SIZE        32
+#endif
+
+
+/**
+ * ext4: Inode table locations of the block groups described by one group descriptor block.
+ */
+
+struct fsw_ext4_gdesc_cache {
+    fsw_u32     dblock;             //!< Index of the descriptor block plus one, 0 if the slot is empty
+    fsw_u64     *inotab_bno;        //!< Block number of the inode table of each group in that block
+};
 
 
 /**
@@ -46,7 +60,10 @@ struct fsw_ext4_volume {
     struct fsw_volume g;            //!< Generic volume structure
     
     struct ext4_super_block *sb;    //!< Full raw ext2 superblock structure
-    fsw_u64     *inotab_bno;        //!< Block numbers of the inode tables
+    fsw_u32     group_count;        //!< Number of block groups
+    fsw_u32     gdesc_per_block;    //!< Number of group descriptors in one block
+    struct fsw_ext4_gdesc_cache gdesc_cache[EXT4_GDESC_CACHE_SIZE];
+                                    //!< Descriptor blocks read so far, direct-mapped by block index
     fsw_u32     ind_bcnt;           //!< Number of blocks addressable through an indirect block
     fsw_u32     dind_bcnt;          //!< Number of blocks addressable through a double-indirect block
     fsw_u32     inode_size;         //!< Size of inode structure in bytes
@@ -60,6 +77,9 @@ struct fsw_ext4_dnode {
     struct fsw_dnode g;             //!< Generic dnode structure
     
     struct ext4_inode *raw;         //!< Full raw inode structure
+    fsw_u64     leaf_bno;           //!< Disk block of the extent leaf used last, 0 if none
+    fsw_u32     leaf_start;         //!< First logical block covered by that leaf
+    fsw_u64     leaf_end;           //!< Logical block after the range covered by that leaf
 };
 
 
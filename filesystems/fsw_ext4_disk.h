@@ -384,6 +384,8 @@ struct ext4_super_block {
 /*
  * Feature set definitions (only the once we need for read support)
  */
+#define EXT4_FEATURE_COMPAT_DIR_INDEX           0x0020
+
 #define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER     0x0001
 
 #define EXT4_FEATURE_INCOMPAT_COMPRESSION	0x0001
@@ -425,6 +427,47 @@ struct ext4_dir_entry {
 // NOTE: The original Linux kernel header defines ext4_dir_entry with the original
 //  layout and ext4_dir_entry_2 with the revised layout. We simply use the revised one.
 
+/*
+ * Hashed directory (htree) index. Block 0 of an indexed directory holds the
+ * "." and ".." entries, the dx_root_info and the first level of dx_entries;
+ * interior index blocks start with an empty 8-byte directory entry spanning
+ * the block. The first dx_entry of each block holds the dx_countlimit in
+ * place of its hash.
+ */
+#define EXT4_DX_HASH_LEGACY             0
+#define EXT4_DX_HASH_HALF_MD4           1
+#define EXT4_DX_HASH_TEA                2
+#define EXT4_DX_HASH_LEGACY_UNSIGNED    3
+#define EXT4_DX_HASH_HALF_MD4_UNSIGNED  4
+#define EXT4_DX_HASH_TEA_UNSIGNED       5
+
+#define EXT4_HTREE_LEVEL                3       /* index levels with largedir */
+#define EXT4_DX_ROOT_INFO_OFFSET        24      /* after the "." and ".." entries */
+#define EXT4_DX_NODE_ENTRIES_OFFSET     8       /* after the empty directory entry */
+#define EXT4_DX_BLOCK_MASK              0x0fffffff
+
+/* s_flags */
+#define EXT4_FLAGS_SIGNED_HASH          0x0001  /* Signed dirhash in use */
+#define EXT4_FLAGS_UNSIGNED_HASH        0x0002  /* Unsigned dirhash in use */
+
+struct ext4_dx_root_info {
+    __le32  reserved_zero;
+    __u8    hash_version;
+    __u8    info_length;            /* 8 */
+    __u8    indirect_levels;
+    __u8    unused_flags;
+};
+
+struct ext4_dx_entry {
+    __le32  hash;
+    __le32  block;                  /* logical block in the directory */
+};
+
+struct ext4_dx_countlimit {
+    __le16  limit;
+    __le16  count;
+};
+
 /*
  * Ext2 directory file types.  Only the low 3 bits are used.  The
  * other bits are reserved for now.
@@ -497,5 +540,12 @@ struct ext4_extent_header {
 
 #define EXT4_EXT_MAGIC		(0xf30a)
 
+/*
+ * ee_len above EXT_INIT_MAX_LEN marks an unwritten (preallocated) extent of
+ * ee_len - EXT_INIT_MAX_LEN blocks, which reads as zeroes.
+ */
+#define EXT_INIT_MAX_LEN	(1UL << 15)
+#define EXT4_MAX_EXTENT_DEPTH	5
+
 
 #endif
@@ -77,6 +77,7 @@ static fsw_status_t fsw_hfs_read_dirrec(struct fsw_shandle *shand, struct hfs_di
 
 static fsw_status_t fsw_hfs_readlink(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
                                          struct fsw_string *link);
+static fsw_status_t fsw_hfs_probe(void *buffer, fsw_u32 size);
 
 //
 // Dispatch Table
@@ -97,6 +98,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(hfs) = {
     fsw_hfs_dir_lookup,  //retrieve the directory entry with the given name
     fsw_hfs_dir_read,	// next directory entry when reading a directory
     fsw_hfs_readlink,   // return FSW_UNSUPPORTED;
+    NULL,               // dnode_locate
+    fsw_hfs_probe,      // signature check without mounting
 };
 
 static const fsw_u16 fsw_latin_case_fold[] =
@@ -248,6 +251,31 @@ HFSGetDescription(CICell ih, char *str, long strMaxLen)
 */
 
 
+/*
+ * Signature check on the volume header for probing without a mount. An HFS
+ * wrapper only passes when it embeds an HFS+ volume, as the mount would still
+ * reject plain HFS after following it.
+ */
+static fsw_status_t fsw_hfs_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u32                  offset = HFS_SUPERBLOCK_BLOCKNO * HFS_BLOCKSIZE;
+    HFSPlusVolumeHeader     *voldesc;
+    HFSMasterDirectoryBlock *mdb;
+    fsw_u16                  signature;
+
+    if (size < offset + HFS_BLOCKSIZE)
+        return FSW_UNSUPPORTED;
+    voldesc   = (HFSPlusVolumeHeader *)((fsw_u8 *)buffer + offset);
+    mdb       = (HFSMasterDirectoryBlock *)voldesc;
+    signature = be16_to_cpu(voldesc->signature);
+
+    if ((signature == kHFSPlusSigWord) || (signature == kHFSXSigWord))
+        return FSW_SUCCESS;
+    if ((signature == kHFSSigWord) && (be16_to_cpu(mdb->drEmbedSigWord) == kHFSPlusSigWord))
+        return FSW_SUCCESS;
+    return FSW_UNSUPPORTED;
+}
+
 static fsw_status_t fsw_hfs_volume_mount(struct fsw_hfs_volume *vol)
 {
     fsw_status_t              status, rv;
@@ -105,6 +105,7 @@ static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, stru
 
 static fsw_status_t fsw_iso9660_readlink(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
                                          struct fsw_string *link);
+static fsw_status_t fsw_iso9660_probe(void *buffer, fsw_u32 size);
 
 static fsw_status_t rr_find_sp(struct iso9660_dirrec *dirrec, struct fsw_rock_ridge_susp_sp **psp);
 static fsw_status_t rr_find_nm(struct fsw_iso9660_volume *vol, struct iso9660_dirrec *dirrec, int off, struct fsw_string *str);
@@ -129,6 +130,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(iso9660) = {
     fsw_iso9660_dir_lookup,
     fsw_iso9660_dir_read,
     fsw_iso9660_readlink,
+    NULL,
+    fsw_iso9660_probe,
 };
 
 static fsw_status_t rr_find_sp(struct iso9660_dirrec *dirrec, struct fsw_rock_ridge_susp_sp **psp)
@@ -276,6 +279,32 @@ static void dump_dirrec(struct iso9660_dirrec *dirrec)
         DEBUG((DEBUG_INFO, "%d: (%d:%x)%c ", i, r[i], r[i], r[i]));
     }
 }*/
+/**
+ * Probe for an ISO9660 volume without mounting. Walks the Volume Descriptor Set
+ * like the mount function does, as far as it lies within the buffer; a set that
+ * runs past the end of the buffer is let through to the mount.
+ */
+
+static fsw_status_t fsw_iso9660_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u32         blockno;
+    struct iso9660_volume_descriptor *voldesc;
+
+    for (blockno = ISO9660_SUPERBLOCK_BLOCKNO;
+         ((blockno + 1) << ISO9660_BLOCKSIZE_BITS) <= size; blockno++) {
+        voldesc = (struct iso9660_volume_descriptor *)((fsw_u8 *)buffer + (blockno << ISO9660_BLOCKSIZE_BITS));
+        if (fsw_memeq(voldesc->standard_identifier, "CD001", 5)) {
+            if (voldesc->volume_descriptor_type == 1 && voldesc->volume_descriptor_version == 1)
+                return FSW_SUCCESS;
+            if (voldesc->volume_descriptor_type == 255)
+                return FSW_UNSUPPORTED;
+        } else if (!fsw_memeq(voldesc->standard_identifier, "CD", 2)) {
+            return FSW_UNSUPPORTED;
+        }
+    }
+    return (blockno == ISO9660_SUPERBLOCK_BLOCKNO) ? FSW_UNSUPPORTED : FSW_SUCCESS;
+}
+
 /**
  * Mount an ISO9660 volume. Reads the superblock and constructs the
  * root directory dnode.
@@ -644,6 +644,20 @@ static int tobits(fsw_u32 val)
     return 31 - __builtin_clz(val);
 }
 
+static fsw_status_t fsw_ntfs_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u8 *bs = (fsw_u8 *)buffer;
+    int sector_size;
+
+    if (size < 512 || !fsw_memeq(bs+3, "NTFS    ", 8))
+	return FSW_UNSUPPORTED;
+
+    sector_size = GETU16(bs, 0xB);
+    if(sector_size==0 || (sector_size & (sector_size-1)) || sector_size < 0x100 || sector_size > 0x1000)
+	return FSW_UNSUPPORTED;
+    return FSW_SUCCESS;
+}
+
 static fsw_status_t fsw_ntfs_volume_mount(struct fsw_volume *volg)
 {
     struct fsw_ntfs_volume *vol = (struct fsw_ntfs_volume *)volg;
@@ -793,6 +807,36 @@ static void fsw_ntfs_dnode_free(struct fsw_volume *vol, struct fsw_dnode *dnog)
 	fsw_free(dno->cbuf);
 }
 
+/**
+ * Report the cluster holding the start of a dnode's MFT record without reading it.
+ * Used by the core to read the records of a directory listing together.
+ */
+
+static fsw_status_t fsw_ntfs_dnode_locate(struct fsw_volume *volg, struct fsw_dnode *dnog, fsw_u64 *phys_bno_out)
+{
+    struct fsw_ntfs_volume *vol = (struct fsw_ntfs_volume *)volg;
+    int l = 0;
+    int r = vol->extmap.used - 1;
+    int m;
+    fsw_u64 vcn = (dnog->dnode_id << vol->mftbits) >> vol->clbits;
+    struct extent_slot *e = vol->extmap.extent;
+
+    while(l <= r) {
+	m = (l+r)/2;
+	if(vcn < e[m].vcn) {
+	    r = m - 1;
+	} else if(vcn >= e[m].vcn + e[m].cnt) {
+	    l = m + 1;
+	} else if(e[m].lcn + 1 == 0) {
+	    return FSW_VOLUME_CORRUPTED;
+	} else {
+	    *phys_bno_out = e[m].lcn + (vcn - e[m].vcn);
+	    return FSW_SUCCESS;
+	}
+    }
+    return FSW_NOT_FOUND;
+}
+
 static fsw_status_t fsw_ntfs_dnode_fill(struct fsw_volume *volg, struct fsw_dnode *dnog)
 {
     struct fsw_ntfs_volume *vol = (struct fsw_ntfs_volume *)volg;
@@ -1593,6 +1637,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ntfs) = {
     fsw_ntfs_dir_lookup,
     fsw_ntfs_dir_read,
     fsw_ntfs_readlink,
+    fsw_ntfs_dnode_locate,
+    fsw_ntfs_probe,
 };
 
 // EOF
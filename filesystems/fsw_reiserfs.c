@@ -45,6 +45,9 @@ static fsw_status_t fsw_reiserfs_dir_read(struct fsw_reiserfs_volume *vol, struc
 static fsw_status_t fsw_reiserfs_readlink(struct fsw_reiserfs_volume *vol, struct fsw_reiserfs_dnode *dno,
                                       struct fsw_string *link);
 
+static int          fsw_reiserfs_sb_version(struct reiserfs_super_block *sb);
+static fsw_status_t fsw_reiserfs_probe(void *buffer, fsw_u32 size);
+
 static fsw_status_t fsw_reiserfs_item_search(struct fsw_reiserfs_volume *vol,
                                              fsw_u32 dir_id, fsw_u32 objectid, fsw_u64 offset,
                                              struct fsw_reiserfs_item *item);
@@ -72,6 +75,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(reiserfs) = {
     fsw_reiserfs_dir_lookup,
     fsw_reiserfs_dir_read,
     fsw_reiserfs_readlink,
+    NULL,
+    fsw_reiserfs_probe,
 };
 
 // misc data
@@ -82,6 +87,47 @@ static fsw_u32  superblock_offsets[3] = {
     0
 };
 
+/**
+ * Get the format version from the magic string of a superblock, or 0 if it
+ * isn't a supported reiserfs superblock.
+ */
+
+static int fsw_reiserfs_sb_version(struct reiserfs_super_block *sb)
+{
+    if (fsw_memeq(sb->s_v1.s_magic,
+                  REISERFS_SUPER_MAGIC_STRING, 8)) {
+        return REISERFS_VERSION_1;
+    } else if (fsw_memeq(sb->s_v1.s_magic,
+                         REISER2FS_SUPER_MAGIC_STRING, 9)) {
+        return REISERFS_VERSION_2;
+    } else if (fsw_memeq(sb->s_v1.s_magic,
+                         REISER2FS_JR_SUPER_MAGIC_STRING, 9)) {
+        if (sb->s_v1.s_version == REISERFS_VERSION_1 || sb->s_v1.s_version == REISERFS_VERSION_2)
+            return sb->s_v1.s_version;
+    }
+    return 0;
+}
+
+/**
+ * Probe for a reiserfs volume at the superblock locations the mount function
+ * tries, without mounting.
+ */
+
+static fsw_status_t fsw_reiserfs_probe(void *buffer, fsw_u32 size)
+{
+    fsw_u32         offset;
+    int             i;
+
+    for (i = 0; superblock_offsets[i]; i++) {
+        offset = superblock_offsets[i] << REISERFS_SUPERBLOCK_BLOCKSIZEBITS;
+        if (size < offset + sizeof (struct reiserfs_super_block))
+            continue;
+        if (fsw_reiserfs_sb_version((struct reiserfs_super_block *)((fsw_u8 *)buffer + offset)))
+            return FSW_SUCCESS;
+    }
+    return FSW_UNSUPPORTED;
+}
+
 /**
  * Mount an reiserfs volume. Reads the superblock and constructs the
  * root directory dnode.
@@ -110,20 +156,9 @@ static fsw_status_t fsw_reiserfs_volume_mount(struct fsw_reiserfs_volume *vol)
         fsw_block_release(vol, superblock_offsets[i], buffer);
 
         // check for one of the magic strings
-        if (fsw_memeq(vol->sb->s_v1.s_magic,
-                      REISERFS_SUPER_MAGIC_STRING, 8)) {
-            vol->version = REISERFS_VERSION_1;
-            break;
-        } else if (fsw_memeq(vol->sb->s_v1.s_magic,
-                             REISER2FS_SUPER_MAGIC_STRING, 9)) {
-            vol->version = REISERFS_VERSION_2;
+        vol->version = fsw_reiserfs_sb_version(vol->sb);
+        if (vol->version)
             break;
-        } else if (fsw_memeq(vol->sb->s_v1.s_magic,
-                             REISER2FS_JR_SUPER_MAGIC_STRING, 9)) {
-            vol->version = vol->sb->s_v1.s_version;
-            if (vol->version == REISERFS_VERSION_1 || vol->version == REISERFS_VERSION_2)
-                break;
-        }
     }
     if (superblock_offsets[i] == 0)
         return FSW_UNSUPPORTED;
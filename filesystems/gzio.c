@@ -728,6 +728,7 @@ init_fixed_block (grub_gzio_t gzio)
         gzio->err = -1;
       huft_free (gzio->tl);
       gzio->tl = 0;
+      gzio->td = 0;
       return;
     }
 
@@ -737,6 +738,21 @@ init_fixed_block (grub_gzio_t gzio)
 }
 
 
+/* Give up on a dynamic block whose tables could not be set up.  While the
+   code lengths are read, td points into tl rather than to a table of its
+   own, so it must never reach huft_free; and tl only holds a table we own
+   if huft_build succeeded or returned 1 (incomplete code), not after it ran
+   out of memory and freed what it had built.  */
+static void
+dynamic_block_fail (grub_gzio_t gzio, int free_tl)
+{
+  if (free_tl)
+    huft_free (gzio->tl);
+  gzio->tl = 0;
+  gzio->td = 0;
+  gzio->err = -1;
+}
+
 /* get header for an inflated type 2 (dynamic Huffman codes) block. */
 
 static void
@@ -786,9 +802,9 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* build decoding table for trees--single level, 7 bit lookup */
   gzio->bl = 7;
-  if (huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl) != 0)
+  if ((i = huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl)) != 0)
     {
-      gzio->err = -1;
+      dynamic_block_fail (gzio, i == 1);
       return;
     }
 
@@ -811,7 +827,7 @@ init_dynamic_block (grub_gzio_t gzio)
           DUMPBITS (2);
           if ((unsigned) i + j > n)
             {
-            gzio->err = -1;
+              dynamic_block_fail (gzio, 1);
               return;
             }
           while (j--)
@@ -824,7 +840,7 @@ init_dynamic_block (grub_gzio_t gzio)
           DUMPBITS (3);
           if ((unsigned) i + j > n)
             {
-              gzio->err = -1;
+              dynamic_block_fail (gzio, 1);
               return;
             }
           while (j--)
@@ -839,7 +855,7 @@ init_dynamic_block (grub_gzio_t gzio)
           DUMPBITS (7);
           if ((unsigned) i + j > n)
             {
-              gzio->err = -1;
+              dynamic_block_fail (gzio, 1);
               return;
             }
           while (j--)
@@ -859,17 +875,17 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* build the decoding tables for literal/length and distance codes */
   gzio->bl = lbits;
-  if (huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  if ((i = huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl)) != 0)
     {
-      gzio->err = -1;
+      dynamic_block_fail (gzio, i == 1);
       return;
     }
   gzio->bd = dbits;
-  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd) != 0)
+  if ((i = huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd)) != 0)
     {
-      huft_free (gzio->tl);
-      gzio->tl = 0;
-      gzio->err = -1;
+      if (i == 1)
+        huft_free (gzio->td);
+      dynamic_block_fail (gzio, 1);
       return;
     }
 
@@ -1004,6 +1020,8 @@ initialize_tables (grub_gzio_t gzio)
   /* Reset memory allocation stuff.  */
   huft_free (gzio->tl);
   huft_free (gzio->td);
+  gzio->tl = 0;
+  gzio->td = 0;
 }
 
 
@@ -1103,6 +1121,9 @@ grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
     }
 
   ret = grub_gzio_read_real (gzio, off, outbuf, outsize);
+  /* The read may stop in the middle of a block.  */
+  huft_free (gzio->tl);
+  huft_free (gzio->td);
   FreePool (gzio);
 
   /* FIXME: Check Adler.  */
@@ -20,6 +20,25 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef HOST_POSIX
+
+/*
+ * The posix test host mounts a single image file, so there are no other
+ * devices to scan for the missing members of a multi-device file system.
+ */
+
+static struct fsw_volume *clone_dummy_volume(struct fsw_volume *vol)
+{
+    return NULL;
+}
+
+static int scan_disks(int (*hook)(struct fsw_volume *, struct fsw_volume *), struct fsw_volume *master)
+{
+    return 0;
+}
+
+#else
+
 #include "fsw_efi.h"
 #ifdef __MAKEWITH_GNUEFI
 #include "edk2/DriverBinding.h"
@@ -84,6 +103,7 @@ static struct fsw_volume *clone_dummy_volume(struct fsw_volume *vol)
 
 static void free_dummy_volume(struct fsw_volume *vol)
 {
+    fsw_efi_clear_cache((FSW_VOLUME_DATA *)vol->host_data);
     fsw_free(vol->host_data);
     fsw_unmount(vol);
 }
@@ -146,3 +166,5 @@ static int scan_disks(int (*hook)(struct fsw_volume *, struct fsw_volume *), str
     }
     return scanned;
 }
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * \file dnodebench.c
+ * Microbenchmark for dnode lookups in the FSW core.
+ */
+
+/*
+ * Copyright (c) 2006 Christoph Pfisterer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ *  * Neither the name of Christoph Pfisterer nor the names of the
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Mounts a synthetic in-memory file system, keeps a growing number of dnodes
+ * alive and measures the cost of fsw_dnode_create_with_tree on dnodes that
+ * already exist. With the per-volume dnode hash table the time per lookup
+ * should stay flat as the number of live dnodes grows.
+ */
+
+#include "fsw_core.h"
+
+#include <time.h>
+
+
+#define LOOKUPS_PER_ROUND (1000000)
+
+static fsw_status_t bench_volume_mount(struct fsw_volume *vol);
+static void bench_volume_free(struct fsw_volume *vol);
+static fsw_status_t bench_dnode_fill(struct fsw_volume *vol, struct fsw_dnode *dno);
+static void bench_dnode_free(struct fsw_volume *vol, struct fsw_dnode *dno);
+static void bench_change_blocksize(struct fsw_volume *vol,
+                                   fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
+                                   fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
+static fsw_status_t bench_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+
+static struct fsw_host_table bench_host_table = {
+    FSW_STRING_TYPE_ISO88591,
+
+    bench_change_blocksize,
+    bench_read_block
+};
+
+static struct fsw_fstype_table bench_fstype_table = {
+    { FSW_STRING_TYPE_ISO88591, 5, 5, "bench" },
+    sizeof (struct fsw_volume),
+    sizeof (struct fsw_dnode),
+
+    bench_volume_mount,
+    bench_volume_free,
+    NULL,
+    bench_dnode_fill,
+    bench_dnode_free,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+static fsw_status_t bench_volume_mount(struct fsw_volume *vol)
+{
+    return fsw_dnode_create_root(vol, 2, &vol->root);
+}
+
+static void bench_volume_free(struct fsw_volume *vol)
+{
+}
+
+static fsw_status_t bench_dnode_fill(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    return FSW_SUCCESS;
+}
+
+static void bench_dnode_free(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+}
+
+static void bench_change_blocksize(struct fsw_volume *vol,
+                                   fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
+                                   fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize)
+{
+}
+
+static fsw_status_t bench_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
+{
+    memset(buffer, 0, vol->phys_blocksize);
+    return FSW_SUCCESS;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_volume   *vol;
+    struct fsw_dnode    **live, *dno;
+    struct fsw_string   name;
+    fsw_u32             count, max_count, i, live_count;
+    fsw_u64             id;
+    double              start, elapsed;
+
+    max_count = (argc > 1) ? (fsw_u32)strtoul(argv[1], NULL, 0) : 65536;
+
+    if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol)) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+    if (fsw_alloc(max_count * sizeof (struct fsw_dnode *), &live)) {
+        fsw_unmount(vol);
+        return 1;
+    }
+
+    name.type = FSW_STRING_TYPE_ISO88591;
+    name.len = name.size = 1;
+    name.data = "x";
+
+    printf("live_dnodes\tns_per_lookup\n");
+    live_count = 0;
+    for (count = 16; count <= max_count; count <<= 1) {
+        // keep count dnodes alive, spread over a few trees like btrfs subvolumes
+        for (; live_count < count; live_count++) {
+            if (fsw_dnode_create_with_tree(vol->root, live_count & 3, 100 + live_count,
+                                           FSW_DNODE_TYPE_FILE, &name, &live[live_count])) {
+                fprintf(stderr, "Out of memory at %u dnodes.\n", live_count);
+                return 1;
+            }
+        }
+
+        // look up existing dnodes in a scattered order
+        start = now_ns();
+        for (i = 0; i < LOOKUPS_PER_ROUND; i++) {
+            id = (i * 2654435761U) % count;
+            fsw_dnode_create_with_tree(vol->root, id & 3, 100 + id, FSW_DNODE_TYPE_FILE, &name, &dno);
+            fsw_dnode_release(dno);
+        }
+        elapsed = now_ns() - start;
+        printf("%u\t%.1f\n", count, elapsed / LOOKUPS_PER_ROUND);
+    }
+
+    for (i = 0; i < live_count; i++)
+        fsw_dnode_release(live[i]);
+    fsw_free(live);
+    fsw_unmount(vol);
+
+    return 0;
+}
+
+// EOF
@@ -52,7 +52,13 @@ fsw_status_t fsw_posix_open_dno(struct fsw_posix_volume *pvol, const char *path,
 void fsw_posix_change_blocksize(struct fsw_volume *vol,
                               fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                               fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
-fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void *buffer);
+fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+fsw_status_t fsw_posix_read_blocks(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer);
+fsw_u64 fsw_posix_clock(void);
+fsw_status_t fsw_posix_submit_read(struct fsw_volume *vol, struct fsw_io_request *req);
+fsw_status_t fsw_posix_complete_read(struct fsw_volume *vol, struct fsw_io_request *req);
+void fsw_posix_lock(void);
+void fsw_posix_unlock(void);
 
 /**
  * Dispatch table for our FSW host driver.
@@ -62,41 +68,278 @@ struct fsw_host_table   fsw_posix_host_table = {
     FSW_STRING_TYPE_ISO88591,
 
     fsw_posix_change_blocksize,
-    fsw_posix_read_block
+    fsw_posix_read_block,
+    fsw_posix_read_blocks,
+    fsw_posix_clock,
+    fsw_posix_submit_read,
+    fsw_posix_complete_read,
+    fsw_posix_lock,
+    fsw_posix_unlock
 };
 
+/**
+ * Lock for state shared by all volumes: the drivers' own, see fsw_host_lock,
+ * and the disk model below.
+ */
+
+static pthread_mutex_t fsw_posix_host_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(FSTYPE);
 
+/**
+ * Disk model applied to newly mounted volumes.
+ */
+
+static struct fsw_posix_io_model fsw_posix_io_model;
+static int fsw_posix_io_model_set = 0;
+
+/**
+ * Set the disk model for volumes mounted from now on. Without a call to this
+ * function, the model is taken from the environment variables
+ * FSW_POSIX_LATENCY_US, FSW_POSIX_BANDWIDTH (bytes per second),
+ * FSW_POSIX_TRACE (file name for the access log) and FSW_POSIX_IO_THREADS
+ * (default 4).
+ */
+
+void fsw_posix_set_io_model(struct fsw_posix_io_model *model)
+{
+    pthread_mutex_lock(&fsw_posix_host_mutex);
+    fsw_posix_io_model = *model;
+    fsw_posix_io_model_set = 1;
+    pthread_mutex_unlock(&fsw_posix_host_mutex);
+}
+
+static void fsw_posix_io_model_from_env(void)
+{
+    const char          *value;
+
+    fsw_posix_io_model.io_threads = 4;
+    if ((value = getenv("FSW_POSIX_IO_THREADS")) != NULL)
+        fsw_posix_io_model.io_threads = strtoul(value, NULL, 0);
+    if ((value = getenv("FSW_POSIX_LATENCY_US")) != NULL)
+        fsw_posix_io_model.latency_us = strtoul(value, NULL, 0);
+    if ((value = getenv("FSW_POSIX_BANDWIDTH")) != NULL)
+        fsw_posix_io_model.bandwidth = strtoull(value, NULL, 0);
+    if ((value = getenv("FSW_POSIX_TRACE")) != NULL) {
+        fsw_posix_io_model.trace = fopen(value, "w");
+        if (fsw_posix_io_model.trace == NULL)
+            fprintf(stderr, "fsw_posix: %s: %s\n", value, strerror(errno));
+    }
+    fsw_posix_io_model_set = 1;
+}
+
+/**
+ * Check that a volume is used from the thread that mounted it. The core does no
+ * locking, so anything else would corrupt the volume's caches; stop right away.
+ */
+
+static void fsw_posix_check_thread(struct fsw_posix_volume *pvol, const char *fn)
+{
+    if (!pthread_equal(pvol->owner, pthread_self())) {
+        fprintf(stderr, "%s: volume used from a thread other than the one that mounted it\n", fn);
+        abort();
+    }
+}
+
+/**
+ * Account a read call of the given size at the given offset: log it, update the
+ * access pattern counters and wait as long as the disk model says it takes. The
+ * latency of concurrent calls overlaps, the transfers queue up behind each other.
+ * Worker threads always sleep so that they do not compete for the CPU.
+ */
+
+static void fsw_posix_simulate_io(struct fsw_posix_volume *pvol, const char *op, fsw_u64 offset, fsw_u64 length,
+                                  int sleep_only)
+{
+    struct fsw_posix_io_model *model = &pvol->io_model;
+    fsw_u64             now, deadline;
+    struct timespec     ts;
+
+    pthread_mutex_lock(&pvol->io_lock);
+    if (offset == pvol->io_next_offset && pvol->io_calls > 0)
+        pvol->io_sequential++;
+    pvol->io_calls++;
+    pvol->io_bytes += length;
+    pvol->io_next_offset = offset + length;
+
+    if (model->trace != NULL)
+        fprintf(model->trace, "%s %llu %llu\n", op, (unsigned long long)offset, (unsigned long long)length);
+
+    if (model->latency_us == 0 && model->bandwidth == 0) {
+        pthread_mutex_unlock(&pvol->io_lock);
+        return;
+    }
+    now = fsw_posix_clock();
+    deadline = now + (fsw_u64)model->latency_us * 1000;
+    if (model->bandwidth > 0) {
+        if (deadline < pvol->io_busy_until)
+            deadline = pvol->io_busy_until;
+        deadline += length * 1000000000ULL / model->bandwidth;
+        pvol->io_busy_until = deadline;
+    }
+    pvol->io_delay_ns += deadline - now;
+    pthread_mutex_unlock(&pvol->io_lock);
+
+    if (sleep_only || model->sleep_only) {
+        ts.tv_sec = deadline / 1000000000;
+        ts.tv_nsec = deadline % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        return;
+    }
+
+    // sleep for the bulk of long delays, then spin for accuracy
+    if (deadline - now > 2000000) {
+        ts.tv_sec = (deadline - now - 1000000) / 1000000000;
+        ts.tv_nsec = (deadline - now - 1000000) % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+    while (fsw_posix_clock() < deadline)
+        ;
+}
+
+/** Completion markers stored in fsw_io_request.host_data by the workers. */
+static fsw_u8 fsw_posix_io_ok, fsw_posix_io_failed;
+
+/**
+ * Worker thread for asynchronous reads. Takes requests from the volume's queue in
+ * order and reads them with pread, which leaves the file offset used by the
+ * synchronous read functions alone.
+ */
+
+static void *fsw_posix_io_worker(void *arg)
+{
+    struct fsw_posix_volume *pvol = arg;
+    struct fsw_io_request *req;
+    fsw_u64             offset, length;
+    fsw_u8              *buffer;
+    ssize_t             read_result;
+    fsw_status_t        status;
+
+    pthread_mutex_lock(&pvol->io_lock);
+    for (;;) {
+        while (pvol->io_queue == NULL && !pvol->io_shutdown)
+            pthread_cond_wait(&pvol->io_submitted, &pvol->io_lock);
+        if (pvol->io_queue == NULL)
+            break;
+        req = pvol->io_queue;
+        pvol->io_queue = req->next;
+        pthread_mutex_unlock(&pvol->io_lock);
+
+        offset = req->phys_bno * pvol->vol->phys_blocksize;
+        length = (fsw_u64)req->count * pvol->vol->phys_blocksize;
+        fsw_posix_simulate_io(pvol, "submit_read", offset, length, 1);
+        status = FSW_SUCCESS;
+        for (buffer = req->buffer; length > 0; buffer += read_result, offset += read_result, length -= read_result) {
+            read_result = pread(pvol->fd, buffer, length, (off_t)offset);
+            if (read_result <= 0) {
+                status = FSW_IO_ERROR;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&pvol->io_lock);
+        req->host_data = (status == FSW_SUCCESS) ? &fsw_posix_io_ok : &fsw_posix_io_failed;
+        pthread_cond_broadcast(&pvol->io_completed);
+    }
+    pthread_mutex_unlock(&pvol->io_lock);
+    return NULL;
+}
+
+/**
+ * Stop the worker threads of a volume. All requests must have been completed.
+ */
+
+static void fsw_posix_io_stop(struct fsw_posix_volume *pvol)
+{
+    fsw_u32             i;
+
+    pthread_mutex_lock(&pvol->io_lock);
+    pvol->io_shutdown = 1;
+    pthread_cond_broadcast(&pvol->io_submitted);
+    pthread_mutex_unlock(&pvol->io_lock);
+    for (i = 0; i < pvol->io_worker_count; i++)
+        pthread_join(pvol->io_workers[i], NULL);
+    pvol->io_worker_count = 0;
+
+    pthread_cond_destroy(&pvol->io_completed);
+    pthread_cond_destroy(&pvol->io_submitted);
+    pthread_mutex_destroy(&pvol->io_lock);
+}
+
 
 /**
- * Mount function.
+ * Mount function. Uses the given file system driver, or the one the host was
+ * built for if fstype_table is NULL.
  */
 
 struct fsw_posix_volume * fsw_posix_mount(const char *path, struct fsw_fstype_table *fstype_table)
+{
+    struct fsw_fstype_table *fstype_tables[2];
+
+    fstype_tables[0] = (fstype_table != NULL) ? fstype_table : &FSW_FSTYPE_TABLE_NAME(FSTYPE);
+    fstype_tables[1] = NULL;
+    return fsw_posix_mount_any(path, fstype_tables);
+}
+
+/**
+ * Mount function trying several file system drivers, see fsw_mount_any. The
+ * driver that mounted the volume is pvol->vol->fstype_table.
+ */
+
+struct fsw_posix_volume * fsw_posix_mount_any(const char *path, struct fsw_fstype_table **fstype_tables)
 {
     fsw_status_t        status;
     struct fsw_posix_volume *pvol;
+    void                *probe_buffer = NULL;
+    ssize_t             probe_result = 0;
 
     // allocate volume structure
     status = fsw_alloc_zero(sizeof (struct fsw_posix_volume), (void **)&pvol);
     if (status)
         return NULL;
     pvol->fd = -1;
+    pvol->owner = pthread_self();
+    pthread_mutex_lock(&fsw_posix_host_mutex);
+    if (!fsw_posix_io_model_set)
+        fsw_posix_io_model_from_env();
+    pvol->io_model = fsw_posix_io_model;
+    pthread_mutex_unlock(&fsw_posix_host_mutex);
+    if (pvol->io_model.io_threads > FSW_POSIX_IO_THREADS_MAX)
+        pvol->io_model.io_threads = FSW_POSIX_IO_THREADS_MAX;
+    pthread_mutex_init(&pvol->io_lock, NULL);
+    pthread_cond_init(&pvol->io_submitted, NULL);
+    pthread_cond_init(&pvol->io_completed, NULL);
 
     // open underlying file/device
     pvol->fd = open(path, O_RDONLY, 0);
     if (pvol->fd < 0) {
         fprintf(stderr, "fsw_posix_mount: %s: %s\n", path, strerror(errno));
+        fsw_posix_io_stop(pvol);
         fsw_free(pvol);
         return NULL;
     }
 
+    // read the superblock area once, so drivers that can't match skip their trial mount
+    status = fsw_alloc(FSW_PROBE_SIZE, &probe_buffer);
+    if (status == FSW_SUCCESS) {
+        fsw_posix_simulate_io(pvol, "probe", 0, FSW_PROBE_SIZE, 0);
+        probe_result = pread(pvol->fd, probe_buffer, FSW_PROBE_SIZE, 0);
+        if (probe_result < 0) {
+            fsw_free(probe_buffer);
+            probe_buffer = NULL;
+        }
+    }
+
     // mount the filesystem
-    if (fstype_table == NULL)
-        fstype_table = &FSW_FSTYPE_TABLE_NAME(FSTYPE);
-    status = fsw_mount(pvol, &fsw_posix_host_table, fstype_table, &pvol->vol);
+    status = fsw_mount_any(pvol, &fsw_posix_host_table, fstype_tables,
+                           probe_buffer, (probe_buffer != NULL) ? (fsw_u32)probe_result : 0, &pvol->vol);
+    if (probe_buffer != NULL)
+        fsw_free(probe_buffer);
     if (status) {
         fprintf(stderr, "fsw_posix_mount: fsw_mount returned %d\n", status);
+        fsw_posix_io_stop(pvol);
+        close(pvol->fd);
         fsw_free(pvol);
         return NULL;
     }
@@ -110,12 +353,78 @@ struct fsw_posix_volume * fsw_posix_mount(const char *path, struct fsw_fstype_ta
 
 int fsw_posix_unmount(struct fsw_posix_volume *pvol)
 {
+    fsw_posix_check_thread(pvol, "fsw_posix_unmount");
     if (pvol->vol != NULL)
         fsw_unmount(pvol->vol);
+    fsw_posix_io_stop(pvol);
+    close(pvol->fd);
     fsw_free(pvol);
     return 0;
 }
 
+/**
+ * Print the performance counters and allocator statistics of a mounted volume.
+ */
+
+void fsw_posix_print_stats(struct fsw_posix_volume *pvol)
+{
+    struct fsw_volume   *vol = pvol->vol;
+    struct fsw_volume_perf perf;
+    struct fsw_perf_counter counters[FSW_PERF_COUNTERS_MAX];
+    fsw_u32             count;
+    fsw_u64             hits = 0, misses = 0;
+    int                 i;
+
+    fsw_volume_perf_snapshot(vol, &perf);
+    count = fsw_volume_driver_counters(vol, counters, FSW_PERF_COUNTERS_MAX);
+    for (i = 0; i <= MAX_CACHE_LEVEL; i++) {
+        hits += perf.bcache_hits[i];
+        misses += perf.bcache_misses[i];
+    }
+
+    fprintf(stderr, "Host I/O: %llu read_block calls, %llu read_blocks calls, %llu bytes, %.3f ms\n",
+            (unsigned long long)perf.read_block_calls, (unsigned long long)perf.read_blocks_calls,
+            (unsigned long long)perf.bytes_read, perf.io_time / 1e6);
+    if (perf.read_async_calls > 0)
+        fprintf(stderr, "Async I/O: %llu reads submitted, up to %llu in flight, %u worker threads\n",
+                (unsigned long long)perf.read_async_calls, (unsigned long long)perf.read_async_peak,
+                pvol->io_worker_count);
+    if (pvol->io_calls > 0) {
+        fprintf(stderr, "Access pattern: %llu calls, %llu sequential, %llu bytes (%.0f per call), %.3f ms injected\n",
+                (unsigned long long)pvol->io_calls, (unsigned long long)pvol->io_sequential,
+                (unsigned long long)pvol->io_bytes, (double)pvol->io_bytes / pvol->io_calls,
+                pvol->io_delay_ns / 1e6);
+    }
+    fprintf(stderr, "Block cache: %llu hits, %llu misses (%.1f%% hit rate), %u entries of %u bytes\n",
+            (unsigned long long)hits, (unsigned long long)misses,
+            hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+            vol->bcache_size, vol->phys_blocksize);
+    for (i = 0; i <= MAX_CACHE_LEVEL; i++) {
+        if (perf.bcache_hits[i] || perf.bcache_misses[i])
+            fprintf(stderr, "  level %d: %llu hits, %llu misses\n", i,
+                    (unsigned long long)perf.bcache_hits[i], (unsigned long long)perf.bcache_misses[i]);
+    }
+    fprintf(stderr, "Extent maps: %llu get_extent calls, %llu served from dnode extent maps\n",
+            (unsigned long long)perf.get_extent_calls, (unsigned long long)perf.extent_map_hits);
+    fprintf(stderr, "Lookups: %llu dir_lookup calls, %llu cache hits, %llu negative hits\n",
+            (unsigned long long)perf.dir_lookup_calls, (unsigned long long)perf.dcache_hits,
+            (unsigned long long)perf.dcache_negative_hits);
+    fprintf(stderr, "Dnodes: %llu created\n", (unsigned long long)perf.dnodes_created);
+    if (count > 0) {
+        fprintf(stderr, "Driver:");
+        for (i = 0; i < (int)count; i++)
+            fprintf(stderr, "%s %s %llu", i ? "," : "", counters[i].name,
+                    (unsigned long long)counters[i].value);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "Arena: %u chunks, %llu bytes reserved, %llu bytes peak in use\n",
+            vol->arena.chunk_count, (unsigned long long)vol->arena.bytes,
+            (unsigned long long)vol->arena.peak_bytes);
+    fprintf(stderr, "Slab allocations: %llu dnodes, %llu blocks, %llu extent maps\n",
+            (unsigned long long)vol->dnode_slab.allocs, (unsigned long long)vol->block_slab.allocs,
+            (unsigned long long)vol->extent_slab.allocs);
+}
+
 /**
  * Open a named regular file.
  */
@@ -153,6 +462,7 @@ ssize_t fsw_posix_read(struct fsw_posix_file *file, void *buf, size_t nbytes)
     fsw_status_t        status;
     fsw_u32             buffer_size;
 
+    fsw_posix_check_thread(file->pvol, "fsw_posix_read");
     buffer_size = nbytes;
     status = fsw_shandle_read(&file->shand, &buffer_size, buf);
     if (status)
@@ -190,6 +500,7 @@ off_t fsw_posix_lseek(struct fsw_posix_file *file, off_t offset, int whence)
 
 int fsw_posix_close(struct fsw_posix_file *file)
 {
+    fsw_posix_check_thread(file->pvol, "fsw_posix_close");
     fsw_shandle_close(&file->shand);
     fsw_free(file);
     return 0;
@@ -205,7 +516,7 @@ struct fsw_posix_dir * fsw_posix_opendir(struct fsw_posix_volume *pvol, const ch
     struct fsw_posix_dir *dir;
 
     // allocate file structure
-    status = fsw_alloc(sizeof (struct fsw_posix_dir), &dir);
+    status = fsw_alloc_zero(sizeof (struct fsw_posix_dir), (void **)&dir);
     if (status)
         return NULL;
     dir->pvol = pvol;
@@ -222,53 +533,83 @@ struct fsw_posix_dir * fsw_posix_opendir(struct fsw_posix_volume *pvol, const ch
 }
 
 /**
- * Read the next entry from a directory.
+ * Release the directory entries read ahead by fsw_posix_readdir.
+ */
+
+static void fsw_posix_release_batch(struct fsw_posix_dir *dir)
+{
+    fsw_u32             i;
+
+    for (i = 0; i < dir->batch_count; i++) {
+        if (dir->batch[i] != NULL)
+            fsw_dnode_release(dir->batch[i]);
+        dir->batch[i] = NULL;
+    }
+    dir->batch_count = 0;
+    dir->batch_index = 0;
+}
+
+/**
+ * Read the next entry from a directory. The entry's dnode stays referenced until
+ * the next call, so that a stat right after readdir finds it already filled.
  */
 
 struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
 {
     fsw_status_t        status;
     struct fsw_dnode    *dno;
-    static struct dirent dent;
+    struct dirent       *dent = &dir->dent;
 
-    // get next entry from file system
-    status = fsw_dnode_dir_read(&dir->shand, &dno);
-    if (status) {
-        if (status != 4)
-            fprintf(stderr, "fsw_posix_readdir: fsw_dnode_dir_read returned %d\n", status);
-        return NULL;
+    fsw_posix_check_thread(dir->pvol, "fsw_posix_readdir");
+    if (dir->batch_index > 0 && dir->batch[dir->batch_index - 1] != NULL) {
+        fsw_dnode_release(dir->batch[dir->batch_index - 1]);
+        dir->batch[dir->batch_index - 1] = NULL;
     }
+
+    // get next batch of entries from file system
+    if (dir->batch_index >= dir->batch_count) {
+        fsw_posix_release_batch(dir);
+        dir->batch_count = FSW_DIR_READ_PLUS_MAX;
+        status = fsw_dnode_dir_read_plus(&dir->shand, dir->batch, &dir->batch_count);
+        if (status) {
+            fprintf(stderr, "fsw_posix_readdir: fsw_dnode_dir_read_plus returned %d\n", status);
+            dir->batch_count = 0;
+            return NULL;
+        }
+        if (dir->batch_count == 0)
+            return NULL;
+    }
+    dno = dir->batch[dir->batch_index++];
     status = fsw_dnode_fill(dno);
     if (status) {
         fprintf(stderr, "fsw_posix_readdir: fsw_dnode_fill returned %d\n", status);
-        fsw_dnode_release(dno);
         return NULL;
     }
 
     // fill dirent structure
-    dent.d_fileno = dno->dnode_id;
-    dent.d_reclen = 8 + dno->name.size + 1;
+    dent->d_fileno = dno->dnode_id;
+    dent->d_reclen = 8 + dno->name.size + 1;
     switch (dno->type) {
         case FSW_DNODE_TYPE_FILE:
-            dent.d_type = DT_REG;
+            dent->d_type = DT_REG;
             break;
         case FSW_DNODE_TYPE_DIR:
-            dent.d_type = DT_DIR;
+            dent->d_type = DT_DIR;
             break;
         case FSW_DNODE_TYPE_SYMLINK:
-            dent.d_type = DT_LNK;
+            dent->d_type = DT_LNK;
             break;
         default:
-            dent.d_type = DT_UNKNOWN;
+            dent->d_type = DT_UNKNOWN;
             break;
     }
 #if 0
-    dent.d_namlen = dno->name.size;
+    dent->d_namlen = dno->name.size;
 #endif
-    memcpy(dent.d_name, dno->name.data, dno->name.size);
-    dent.d_name[dno->name.size] = 0;
+    memcpy(dent->d_name, dno->name.data, dno->name.size);
+    dent->d_name[dno->name.size] = 0;
 
-    return &dent;
+    return dent;
 }
 
 /**
@@ -277,6 +618,8 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
 
 void fsw_posix_rewinddir(struct fsw_posix_dir *dir)
 {
+    fsw_posix_check_thread(dir->pvol, "fsw_posix_rewinddir");
+    fsw_posix_release_batch(dir);
     dir->shand.pos = 0;
 }
 
@@ -286,11 +629,67 @@ void fsw_posix_rewinddir(struct fsw_posix_dir *dir)
 
 int fsw_posix_closedir(struct fsw_posix_dir *dir)
 {
+    fsw_posix_check_thread(dir->pvol, "fsw_posix_closedir");
+    fsw_posix_release_batch(dir);
     fsw_shandle_close(&dir->shand);
     fsw_free(dir);
     return 0;
 }
 
+/**
+ * Get information about a file system object by path. Symlinks are followed.
+ */
+
+int fsw_posix_stat(struct fsw_posix_volume *pvol, const char *path, struct stat *st)
+{
+    fsw_status_t        status;
+    struct fsw_dnode    *dno;
+    struct fsw_dnode    *target_dno;
+    struct fsw_string   lookup_path;
+    struct fsw_dnode_stat sb;
+
+    fsw_posix_check_thread(pvol, "fsw_posix_stat");
+    lookup_path.type = FSW_STRING_TYPE_ISO88591;
+    lookup_path.len  = strlen(path);
+    lookup_path.size = lookup_path.len;
+    lookup_path.data = (void *)path;
+
+    status = fsw_dnode_lookup_path(pvol->vol->root, &lookup_path, '/', &dno);
+    if (status)
+        return -1;
+    status = fsw_dnode_resolve(dno, &target_dno);
+    fsw_dnode_release(dno);
+    if (status)
+        return -1;
+    dno = target_dno;
+
+    memset(st, 0, sizeof (struct stat));
+    memset(&sb, 0, sizeof (struct fsw_dnode_stat));
+    sb.host_data = st;
+    status = fsw_dnode_stat(dno, &sb);
+    if (status) {
+        fsw_dnode_release(dno);
+        return -1;
+    }
+
+    st->st_ino = dno->dnode_id;
+    st->st_size = dno->size;
+    st->st_blocks = (sb.used_bytes + 511) / 512;
+    switch (dno->type) {
+        case FSW_DNODE_TYPE_FILE:
+            st->st_mode |= S_IFREG;
+            break;
+        case FSW_DNODE_TYPE_DIR:
+            st->st_mode |= S_IFDIR;
+            break;
+        case FSW_DNODE_TYPE_SYMLINK:
+            st->st_mode |= S_IFLNK;
+            break;
+    }
+    fsw_dnode_release(dno);
+    return 0;
+}
+
 /**
  * Open a shand of a required type by path.
  */
@@ -302,6 +701,7 @@ fsw_status_t fsw_posix_open_dno(struct fsw_posix_volume *pvol, const char *path,
     struct fsw_dnode    *target_dno;
     struct fsw_string   lookup_path;
 
+    fsw_posix_check_thread(pvol, "fsw_posix_open_dno");
     lookup_path.type = FSW_STRING_TYPE_ISO88591;
     lookup_path.len  = strlen(path);
     lookup_path.size = lookup_path.len;
@@ -362,13 +762,13 @@ void fsw_posix_change_blocksize(struct fsw_volume *vol,
  * to read a block of data from the device. The buffer is allocated by the core code.
  */
 
-fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void *buffer)
+fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
 {
     struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
     off_t           block_offset, seek_result;
     ssize_t         read_result;
 
-    FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_posix_read_block: %d  (%d)\n"), phys_bno, vol->phys_blocksize));
+    FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_posix_read_block: %llu  (%d)\n"), (unsigned long long)phys_bno, vol->phys_blocksize));
 
     // read from disk
     block_offset = (off_t)phys_bno * vol->phys_blocksize;
@@ -378,10 +778,166 @@ fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void
     read_result = read(pvol->fd, buffer, vol->phys_blocksize);
     if (read_result != vol->phys_blocksize)
         return FSW_IO_ERROR;
+    fsw_posix_simulate_io(pvol, "read_block", block_offset, vol->phys_blocksize, 0);
 
     return FSW_SUCCESS;
 }
 
+/**
+ * FSW interface function to read a run of consecutive data blocks straight into the
+ * caller's buffer. This function is called by the FSW core for block-aligned file data.
+ */
+
+fsw_status_t fsw_posix_read_blocks(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer)
+{
+    struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
+    off_t           block_offset, seek_result;
+    size_t          length;
+    ssize_t         read_result;
+
+    FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_posix_read_blocks: %llu +%u  (%d)\n"), (unsigned long long)phys_bno, count, vol->phys_blocksize));
+
+    // read from disk
+    block_offset = (off_t)phys_bno * vol->phys_blocksize;
+    seek_result = lseek(pvol->fd, block_offset, SEEK_SET);
+    if (seek_result != block_offset)
+        return FSW_IO_ERROR;
+    length = (size_t)count * vol->phys_blocksize;
+    fsw_posix_simulate_io(pvol, "read_blocks", block_offset, length, 0);
+    while (length > 0) {
+        read_result = read(pvol->fd, buffer, length);
+        if (read_result <= 0)
+            return FSW_IO_ERROR;
+        buffer = (fsw_u8 *)buffer + read_result;
+        length -= read_result;
+    }
+
+    return FSW_SUCCESS;
+}
+
+/**
+ * FSW interface function to start an asynchronous read. The request is queued for
+ * the volume's worker threads, which are started on first use. Fails if the disk
+ * model has no worker threads, so that the core reads synchronously.
+ */
+
+fsw_status_t fsw_posix_submit_read(struct fsw_volume *vol, struct fsw_io_request *req)
+{
+    struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
+
+    pthread_mutex_lock(&pvol->io_lock);
+    while (pvol->io_worker_count < pvol->io_model.io_threads) {
+        if (pthread_create(&pvol->io_workers[pvol->io_worker_count], NULL, fsw_posix_io_worker, pvol) != 0)
+            break;
+        pvol->io_worker_count++;
+    }
+    if (pvol->io_worker_count == 0) {
+        pthread_mutex_unlock(&pvol->io_lock);
+        return FSW_UNSUPPORTED;
+    }
+
+    req->host_data = NULL;   // set to a completion marker by the worker
+    req->next = NULL;
+    if (pvol->io_queue == NULL)
+        pvol->io_queue = req;
+    else
+        pvol->io_queue_tail->next = req;
+    pvol->io_queue_tail = req;
+    pthread_cond_signal(&pvol->io_submitted);
+    pthread_mutex_unlock(&pvol->io_lock);
+    return FSW_SUCCESS;
+}
+
+/**
+ * FSW interface function to wait for an asynchronous read started with
+ * fsw_posix_submit_read.
+ */
+
+fsw_status_t fsw_posix_complete_read(struct fsw_volume *vol, struct fsw_io_request *req)
+{
+    struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
+    fsw_status_t        status;
+
+    pthread_mutex_lock(&pvol->io_lock);
+    while (req->host_data == NULL)
+        pthread_cond_wait(&pvol->io_completed, &pvol->io_lock);
+    status = (req->host_data == &fsw_posix_io_ok) ? FSW_SUCCESS : FSW_IO_ERROR;
+    pthread_mutex_unlock(&pvol->io_lock);
+    return status;
+}
+
+/**
+ * FSW interface functions for the lock on state shared between volumes.
+ */
+
+void fsw_posix_lock(void)
+{
+    pthread_mutex_lock(&fsw_posix_host_mutex);
+}
+
+void fsw_posix_unlock(void)
+{
+    pthread_mutex_unlock(&fsw_posix_host_mutex);
+}
+
+/**
+ * FSW interface function returning a monotonic time in nanoseconds. The core uses
+ * it to account the time spent in host reads.
+ */
+
+fsw_u64 fsw_posix_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (fsw_u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+ * Time mapping callback for the fsw_dnode_stat call. Stores the timestamp in the
+ * struct stat passed as host_data, if any.
+ */
+
+void fsw_store_time_posix(struct fsw_dnode_stat *sb, int which, fsw_u32 posix_time)
+{
+    struct stat         *st = (struct stat *)sb->host_data;
+
+    if (st == NULL)
+        return;
+    if (which == FSW_DNODE_STAT_CTIME)
+        st->st_ctime = posix_time;
+    else if (which == FSW_DNODE_STAT_MTIME)
+        st->st_mtime = posix_time;
+    else if (which == FSW_DNODE_STAT_ATIME)
+        st->st_atime = posix_time;
+}
+
+/**
+ * Mode mapping callback for the fsw_dnode_stat call. Stores the permission bits
+ * in the struct stat passed as host_data, if any.
+ */
+
+void fsw_store_attr_posix(struct fsw_dnode_stat *sb, fsw_u16 posix_mode)
+{
+    struct stat         *st = (struct stat *)sb->host_data;
+
+    if (st != NULL)
+        st->st_mode = posix_mode & 07777;
+}
+
+/**
+ * Attribute mapping callback for the fsw_dnode_stat call, for drivers that report
+ * EFI file attributes. Read-only files lose their write permission bits.
+ */
+
+void fsw_store_attr_efi(struct fsw_dnode_stat *sb, fsw_u16 attr)
+{
+    struct stat         *st = (struct stat *)sb->host_data;
+
+    if (st != NULL)
+        st->st_mode = (attr & 0x01) ? 0555 : 0755;
+}
 
 /**
  * Time mapping callback for the fsw_dnode_stat call. This function converts
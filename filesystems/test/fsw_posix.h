@@ -42,18 +42,61 @@
 
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/dir.h>
+#include <time.h>
+#include <pthread.h>
 
+/** Most worker threads serving asynchronous reads of one volume. */
+#define FSW_POSIX_IO_THREADS_MAX 64
+
+
+/**
+ * POSIX Host: Model of a slow disk. Every read call first waits for a fixed
+ * latency and then for the transfer time at the given bandwidth, like firmware
+ * DiskIo implementations with a high per-call cost. A zero model reads at the
+ * speed of the underlying file. Asynchronous reads are served by io_threads
+ * workers; their latencies overlap while the bandwidth is shared, like a disk
+ * with several outstanding requests.
+ */
+
+struct fsw_posix_io_model {
+    fsw_u32                     latency_us;     //!< Fixed delay per read call in microseconds
+    fsw_u64                     bandwidth;      //!< Transfer rate cap in bytes per second (0 = no cap)
+    FILE                        *trace;         //!< If set, every read call is logged here
+    fsw_u32                     io_threads;     //!< Worker threads for asynchronous reads (0 = none)
+    int                         sleep_only;     //!< Always sleep through delays instead of spinning
+                                                //!< at the end, for many threads on few CPUs
+};
 
 /**
- * POSIX Host: Private per-volume structure.
+ * POSIX Host: Private per-volume structure. A volume belongs to the thread that
+ * mounted it; it and the files and directories opened on it must only be used
+ * from that thread. Different volumes can be used from different threads.
  */
 
 struct fsw_posix_volume {
     struct fsw_volume           *vol;           //!< FSW volume structure
 
     int                         fd;             //!< System file descriptor for data access
-
+    pthread_t                   owner;          //!< The thread that mounted the volume
+
+    struct fsw_posix_io_model   io_model;       //!< Simulated disk speed for this volume
+    fsw_u64                     io_calls;       //!< Number of read calls to the disk
+    fsw_u64                     io_sequential;  //!< Read calls starting where the previous one ended
+    fsw_u64                     io_bytes;       //!< Bytes read from the disk
+    fsw_u64                     io_delay_ns;    //!< Total delay injected by the io_model
+    fsw_u64                     io_next_offset; //!< Byte offset just past the previous read
+    fsw_u64                     io_busy_until;  //!< Clock value at which the modelled disk is idle again
+
+    pthread_mutex_t             io_lock;        //!< Protects the io_* fields and the request queue
+    pthread_cond_t              io_submitted;   //!< Signalled when a request is queued or on shutdown
+    pthread_cond_t              io_completed;   //!< Signalled when a request has finished
+    pthread_t                   io_workers[FSW_POSIX_IO_THREADS_MAX]; //!< Worker threads, started on first use
+    fsw_u32                     io_worker_count; //!< Number of running worker threads
+    int                         io_shutdown;    //!< Set to make the workers exit
+    struct fsw_io_request       *io_queue;      //!< Submitted requests not picked up yet, oldest first
+    struct fsw_io_request       *io_queue_tail; //!< Last request in io_queue
 };
 
 /**
@@ -76,13 +119,25 @@ struct fsw_posix_dir {
 
     struct fsw_shandle          shand;          //!< FSW handle for this file
 
+    struct fsw_dnode            *batch[FSW_DIR_READ_PLUS_MAX]; //!< Entries read ahead, filled
+    fsw_u32                     batch_count;    //!< Number of entries in batch
+    fsw_u32                     batch_index;    //!< Next entry of batch to return
+    struct dirent               dent;           //!< Entry returned by the last readdir call
+
 };
 
 
 /* functions */
 
 struct fsw_posix_volume * fsw_posix_mount(const char *path, struct fsw_fstype_table *fstype_table);
+struct fsw_posix_volume * fsw_posix_mount_any(const char *path, struct fsw_fstype_table **fstype_tables);
 int fsw_posix_unmount(struct fsw_posix_volume *pvol);
+extern struct fsw_host_table fsw_posix_host_table;
+
+void fsw_posix_set_io_model(struct fsw_posix_io_model *model);
+void fsw_posix_print_stats(struct fsw_posix_volume *pvol);
+
+int fsw_posix_stat(struct fsw_posix_volume *pvol, const char *path, struct stat *st);
 
 struct fsw_posix_file * fsw_posix_open(struct fsw_posix_volume *pvol, const char *path, int flags, mode_t mode);
 ssize_t fsw_posix_read(struct fsw_posix_file *file, void *buf, size_t nbytes);
@@ -71,6 +71,7 @@ typedef uint64_t            fsw_u64;
 
 #define fsw_memzero(dest,size) memset(dest,0,size)
 #define fsw_memcpy(dest,src,size) memcpy(dest,src,size)
+#define fsw_memmove(dest,src,size) memmove(dest,src,size)
 #define fsw_memeq(p1,p2,size) (memcmp(p1,p2,size) == 0)
 
 // message printing
@@ -84,7 +85,45 @@ typedef uint64_t            fsw_u64;
 #define FSW_U64_DIV(val,divisor) ((val) / (divisor))
 #define DEBUG(x)
 
+#ifndef EFIAPI
+#define EFIAPI
+#endif
+
 #define RShiftU64(val, shift) ((val) >> (shift))
 #define LShiftU64(val, shift) ((val) << (shift))
+#define DivU64x32(val, divisor) ((val) / (divisor))
+
+static inline uint64_t DivU64x32Remainder(uint64_t val, uint32_t divisor, uint32_t *remainder)
+{
+    if (remainder != NULL)
+        *remainder = (uint32_t)(val % divisor);
+    return val / divisor;
+}
+
+// EFI types and library calls used directly by some drivers
+
+typedef uint8_t             BOOLEAN;
+typedef uint8_t             UINT8;
+typedef uint16_t            UINT16;
+typedef uint32_t            UINT32;
+typedef uint64_t            UINT64;
+typedef int32_t             INT32;
+typedef int64_t             INT64;
+typedef uintptr_t           UINTN;
+typedef intptr_t            INTN;
+typedef void                VOID;
+
+#ifndef TRUE
+#define TRUE                1
+#define FALSE               0
+#endif
+
+#define AllocatePool(size) malloc(size)
+#define AllocateZeroPool(size) calloc(1, size)
+#define FreePool(ptr) free(ptr)
+#define CopyMem(dest,src,size) memmove(dest,src,size)
+#define SetMem(dest,size,value) memset(dest,value,size)
+#define ZeroMem(dest,size) memset(dest,0,size)
+#define CompareMem(p1,p2,size) memcmp(p1,p2,size)
 
 #endif
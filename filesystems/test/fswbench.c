@@ -0,0 +1,676 @@
+/**
+ * \file fswbench.c
+ * Benchmark harness running repeatable workloads against a disk image.
+ */
+
+/*
+ * Copyright (c) 2006 Christoph Pfisterer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ *  * Neither the name of Christoph Pfisterer nor the names of the
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Mounts a disk image with one of the FSW drivers and runs a set of workloads
+ * on it: mounting, a full tree walk with a stat of every entry, random path
+ * lookups, a sequential read of the largest file, reads of many small
+ * files, and whole-file reads of large files the way a boot loader reads a
+ * kernel or initrd. Every run starts from a freshly mounted volume, so the core caches
+ * are cold. One JSON object per run is written to stdout with throughput,
+ * latency percentiles and the volume's I/O counters. Options -L and -B run
+ * the image through a simulated slow disk.
+ */
+
+#include "fsw_posix.h"
+
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(ext2);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(ext4);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(btrfs);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(reiserfs);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(hfs);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(iso9660);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(ntfs);
+
+/** Drivers in the order they are tried when no type is given. */
+static struct fsw_fstype_table *fstypes[] = {
+    &FSW_FSTYPE_TABLE_NAME(ext2),
+    &FSW_FSTYPE_TABLE_NAME(ext4),
+    &FSW_FSTYPE_TABLE_NAME(btrfs),
+    &FSW_FSTYPE_TABLE_NAME(reiserfs),
+    &FSW_FSTYPE_TABLE_NAME(hfs),
+    &FSW_FSTYPE_TABLE_NAME(iso9660),
+    &FSW_FSTYPE_TABLE_NAME(ntfs),
+    NULL
+};
+
+/**
+ * An object found while scanning the image.
+ */
+
+struct bench_entry {
+    char                *path;          //!< Absolute path, directories end with '/'
+    int                 type;           //!< DT_REG, DT_DIR, ...
+    fsw_u64             size;           //!< Size in bytes
+};
+
+/**
+ * Measurements of one workload run.
+ */
+
+struct bench_result {
+    double              *lat;           //!< Latency of each operation in nanoseconds
+    fsw_u32             ops;            //!< Number of operations
+    fsw_u32             lat_size;       //!< Allocated entries in lat
+    fsw_u32             errors;         //!< Number of failed operations
+    fsw_u64             bytes;          //!< Bytes of file data read
+    double              elapsed;        //!< Sum of the operation latencies in nanoseconds
+    struct fsw_volume_perf perf;        //!< Volume counters accumulated over the run
+    struct fsw_perf_counter driver[FSW_PERF_COUNTERS_MAX]; //!< Driver-specific counters accumulated over the run
+    fsw_u32             driver_count;   //!< Number of entries in driver
+    fsw_u64             io_calls;       //!< Read calls that reached the image file
+    fsw_u64             io_sequential;  //!< Of those, calls continuing the previous one
+    fsw_u64             io_delay_ns;    //!< Delay injected by the simulated disk
+};
+
+static const char           *image_path;
+static struct fsw_fstype_table *fstype;
+static struct bench_entry   *entries;
+static fsw_u32              entry_count, entry_size;
+static fsw_u32              opt_runs = 3;
+static fsw_u32              opt_lookups = 1000;
+static fsw_u32              opt_mounts = 10;
+static fsw_u32              opt_seed = 1;
+static fsw_u32              opt_chunk = 65536;
+static fsw_u64              opt_small = 65536;
+static fsw_u64              opt_large = 1048576;
+static char                 *read_buffer;
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Repeatable pseudo-random numbers (xorshift32), independent of the C library.
+ */
+
+static fsw_u32 bench_random(fsw_u32 *state)
+{
+    fsw_u32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void record_op(struct bench_result *res, double start)
+{
+    double              *new_lat;
+
+    if (res->ops >= res->lat_size) {
+        res->lat_size = res->lat_size ? res->lat_size * 2 : 1024;
+        new_lat = realloc(res->lat, res->lat_size * sizeof (double));
+        if (new_lat == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        res->lat = new_lat;
+    }
+    res->lat[res->ops++] = now_ns() - start;
+}
+
+static void add_perf(struct fsw_volume_perf *sum, struct fsw_volume_perf *perf)
+{
+    int                 i;
+
+    sum->read_block_calls += perf->read_block_calls;
+    sum->read_blocks_calls += perf->read_blocks_calls;
+    sum->read_async_calls += perf->read_async_calls;
+    if (sum->read_async_peak < perf->read_async_peak)
+        sum->read_async_peak = perf->read_async_peak;
+    sum->bytes_read += perf->bytes_read;
+    sum->io_time += perf->io_time;
+    for (i = 0; i <= MAX_CACHE_LEVEL; i++) {
+        sum->bcache_hits[i] += perf->bcache_hits[i];
+        sum->bcache_misses[i] += perf->bcache_misses[i];
+    }
+    sum->get_extent_calls += perf->get_extent_calls;
+    sum->extent_map_hits += perf->extent_map_hits;
+    sum->dir_lookup_calls += perf->dir_lookup_calls;
+    sum->dcache_hits += perf->dcache_hits;
+    sum->dcache_negative_hits += perf->dcache_negative_hits;
+    sum->dnodes_created += perf->dnodes_created;
+}
+
+static struct fsw_posix_volume *bench_mount(void)
+{
+    struct fsw_posix_volume *pvol;
+
+    pvol = fsw_posix_mount(image_path, fstype);
+    if (pvol == NULL) {
+        fprintf(stderr, "Mounting %s failed.\n", image_path);
+        exit(1);
+    }
+    return pvol;
+}
+
+static void bench_unmount(struct fsw_posix_volume *pvol, struct bench_result *res)
+{
+    struct fsw_volume_perf perf;
+    struct fsw_perf_counter counters[FSW_PERF_COUNTERS_MAX];
+    fsw_u32             count, i;
+
+    fsw_volume_perf_snapshot(pvol->vol, &perf);
+    add_perf(&res->perf, &perf);
+    // the driver reports the same counters in the same order on every mount
+    count = fsw_volume_driver_counters(pvol->vol, counters, FSW_PERF_COUNTERS_MAX);
+    for (i = 0; i < count; i++) {
+        if (i >= res->driver_count)
+            res->driver[i].name = counters[i].name;
+        res->driver[i].value += counters[i].value;
+    }
+    if (count > res->driver_count)
+        res->driver_count = count;
+    res->io_calls += pvol->io_calls;
+    res->io_sequential += pvol->io_sequential;
+    res->io_delay_ns += pvol->io_delay_ns;
+    fsw_posix_unmount(pvol);
+}
+
+//
+// scanning the image
+//
+
+static void add_entry(const char *path, int type, fsw_u64 size)
+{
+    struct bench_entry  *new_entries;
+
+    if (entry_count >= entry_size) {
+        entry_size = entry_size ? entry_size * 2 : 256;
+        new_entries = realloc(entries, entry_size * sizeof (struct bench_entry));
+        if (new_entries == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        entries = new_entries;
+    }
+    entries[entry_count].path = strdup(path);
+    entries[entry_count].type = type;
+    entries[entry_count].size = size;
+    entry_count++;
+}
+
+/**
+ * Walk a directory tree, stat-ing every entry. Used both to build the list of
+ * objects for the other workloads and as the "walk" workload itself.
+ */
+
+static void walk_dir(struct fsw_posix_volume *pvol, const char *path, struct bench_result *res, int collect)
+{
+    struct fsw_posix_dir *dir;
+    struct dirent       *dent;
+    struct stat         st;
+    char                **subdirs = NULL;
+    fsw_u32             subdir_count = 0, i;
+    char                child[4096];
+    double              start;
+
+    start = now_ns();
+    dir = fsw_posix_opendir(pvol, path);
+    if (dir == NULL) {
+        res->errors++;
+        return;
+    }
+    while ((dent = fsw_posix_readdir(dir)) != NULL) {
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+        snprintf(child, sizeof (child), "%s%s%s", path, dent->d_name, dent->d_type == DT_DIR ? "/" : "");
+        if (fsw_posix_stat(pvol, child, &st) != 0) {
+            res->errors++;
+            continue;
+        }
+        if (collect)
+            add_entry(child, dent->d_type, st.st_size);
+        if (dent->d_type == DT_DIR) {
+            subdirs = realloc(subdirs, (subdir_count + 1) * sizeof (char *));
+            subdirs[subdir_count++] = strdup(child);
+        }
+    }
+    fsw_posix_closedir(dir);
+    record_op(res, start);
+
+    for (i = 0; i < subdir_count; i++) {
+        walk_dir(pvol, subdirs[i], res, collect);
+        free(subdirs[i]);
+    }
+    free(subdirs);
+}
+
+//
+// workloads
+//
+
+static void run_mount(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+    fsw_u32             i;
+    double              start;
+
+    for (i = 0; i < opt_mounts; i++) {
+        start = now_ns();
+        pvol = bench_mount();
+        record_op(res, start);
+        bench_unmount(pvol, res);
+    }
+}
+
+static void run_walk(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+
+    pvol = bench_mount();
+    fsw_volume_perf_reset(pvol->vol);
+    walk_dir(pvol, "/", res, 0);
+    bench_unmount(pvol, res);
+}
+
+static void run_lookup(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+    struct stat         st;
+    fsw_u32             i, state = opt_seed ? opt_seed : 1;
+    double              start;
+
+    pvol = bench_mount();
+    fsw_volume_perf_reset(pvol->vol);
+    for (i = 0; i < opt_lookups && entry_count > 0; i++) {
+        start = now_ns();
+        if (fsw_posix_stat(pvol, entries[bench_random(&state) % entry_count].path, &st) != 0)
+            res->errors++;
+        record_op(res, start);
+    }
+    bench_unmount(pvol, res);
+}
+
+static fsw_u64 read_whole_file(struct fsw_posix_volume *pvol, const char *path, struct bench_result *res,
+                               int record_reads)
+{
+    struct fsw_posix_file *file;
+    ssize_t             len;
+    fsw_u64             total = 0;
+    double              start;
+
+    file = fsw_posix_open(pvol, path, 0, 0);
+    if (file == NULL) {
+        res->errors++;
+        return 0;
+    }
+    for (;;) {
+        start = now_ns();
+        len = fsw_posix_read(file, read_buffer, opt_chunk);
+        if (len <= 0)
+            break;
+        if (record_reads)
+            record_op(res, start);
+        total += len;
+    }
+    if (len < 0)
+        res->errors++;
+    fsw_posix_close(file);
+    return total;
+}
+
+static void run_seqread(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+    struct bench_entry  *largest = NULL;
+    fsw_u32             i;
+
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i].type == DT_REG && (largest == NULL || entries[i].size > largest->size))
+            largest = &entries[i];
+    }
+    if (largest == NULL)
+        return;
+
+    pvol = bench_mount();
+    fsw_volume_perf_reset(pvol->vol);
+    res->bytes = read_whole_file(pvol, largest->path, res, 1);
+    bench_unmount(pvol, res);
+}
+
+static void run_randread(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+    struct fsw_posix_file *file;
+    struct bench_entry  *largest = NULL;
+    fsw_u32             i, state = opt_seed ? opt_seed : 1;
+    ssize_t             len;
+    double              start;
+
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i].type == DT_REG && (largest == NULL || entries[i].size > largest->size))
+            largest = &entries[i];
+    }
+    if (largest == NULL || largest->size == 0)
+        return;
+
+    pvol = bench_mount();
+    fsw_volume_perf_reset(pvol->vol);
+    file = fsw_posix_open(pvol, largest->path, 0, 0);
+    if (file == NULL) {
+        res->errors++;
+        bench_unmount(pvol, res);
+        return;
+    }
+    // reads at random offsets, as when a loader picks headers and sections out of an image
+    for (i = 0; i < opt_lookups; i++) {
+        start = now_ns();
+        fsw_posix_lseek(file, (off_t)(bench_random(&state) % largest->size), SEEK_SET);
+        len = fsw_posix_read(file, read_buffer, opt_chunk);
+        record_op(res, start);
+        if (len < 0)
+            res->errors++;
+        else
+            res->bytes += len;
+    }
+    fsw_posix_close(file);
+    bench_unmount(pvol, res);
+}
+
+static void run_smallfiles(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+    fsw_u32             i;
+    double              start;
+
+    pvol = bench_mount();
+    fsw_volume_perf_reset(pvol->vol);
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i].type != DT_REG || entries[i].size > opt_small)
+            continue;
+        start = now_ns();
+        res->bytes += read_whole_file(pvol, entries[i].path, res, 0);
+        record_op(res, start);
+    }
+    bench_unmount(pvol, res);
+}
+
+static void run_largefiles(struct bench_result *res)
+{
+    struct fsw_posix_volume *pvol;
+    struct fsw_posix_file *file;
+    char                *buffer;
+    ssize_t             len;
+    fsw_u32             i;
+    double              start;
+
+    pvol = bench_mount();
+    fsw_volume_perf_reset(pvol->vol);
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i].type != DT_REG || entries[i].size < opt_large)
+            continue;
+        buffer = malloc(entries[i].size);
+        if (buffer == NULL) {
+            res->errors++;
+            continue;
+        }
+        start = now_ns();
+        file = fsw_posix_open(pvol, entries[i].path, 0, 0);
+        if (file == NULL) {
+            res->errors++;
+            free(buffer);
+            continue;
+        }
+        // one read for the whole file, as LoadImage or the loader does
+        len = fsw_posix_read(file, buffer, entries[i].size);
+        fsw_posix_close(file);
+        record_op(res, start);
+        if (len != (ssize_t)entries[i].size)
+            res->errors++;
+        if (len > 0)
+            res->bytes += len;
+        free(buffer);
+    }
+    bench_unmount(pvol, res);
+}
+
+static struct {
+    const char          *name;
+    void                (*run)(struct bench_result *res);
+} workloads[] = {
+    { "mount",      run_mount },
+    { "walk",       run_walk },
+    { "lookup",     run_lookup },
+    { "seqread",    run_seqread },
+    { "randread",   run_randread },
+    { "smallfiles", run_smallfiles },
+    { "largefiles", run_largefiles },
+    { NULL,         NULL }
+};
+
+//
+// reporting
+//
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile(struct bench_result *res, double p)
+{
+    fsw_u32             i;
+
+    if (res->ops == 0)
+        return 0;
+    i = (fsw_u32)(p / 100.0 * (res->ops - 1) + 0.5);
+    return res->lat[i];
+}
+
+static void report(const char *workload, fsw_u32 run, struct bench_result *res)
+{
+    struct fsw_volume_perf *perf = &res->perf;
+    fsw_u64             hits = 0, misses = 0;
+    double              seconds;
+    fsw_u32             op;
+    int                 i;
+
+    for (i = 0; i <= MAX_CACHE_LEVEL; i++) {
+        hits += perf->bcache_hits[i];
+        misses += perf->bcache_misses[i];
+    }
+    if (res->ops > 0)
+        qsort(res->lat, res->ops, sizeof (double), compare_double);
+
+    // only the timed operations count, not the mounts around them
+    res->elapsed = 0;
+    for (op = 0; op < res->ops; op++)
+        res->elapsed += res->lat[op];
+    seconds = res->elapsed / 1e9;
+
+    printf("{\"fstype\":\"%.*s\",\"workload\":\"%s\",\"run\":%u,\"ops\":%u,\"errors\":%u,"
+           "\"bytes\":%llu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f,",
+           fstype->name.size, (char *)fstype->name.data, workload, run, res->ops, res->errors,
+           (unsigned long long)res->bytes, seconds,
+           seconds > 0 ? res->ops / seconds : 0.0,
+           seconds > 0 ? res->bytes / seconds / (1024 * 1024) : 0.0);
+    printf("\"lat_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f},",
+           percentile(res, 50) / 1e3, percentile(res, 90) / 1e3, percentile(res, 99) / 1e3,
+           percentile(res, 100) / 1e3);
+    printf("\"io\":{\"read_block\":%llu,\"read_blocks\":%llu,\"async\":%llu,\"async_peak\":%llu,"
+           "\"bytes\":%llu,\"ms\":%.3f},",
+           (unsigned long long)perf->read_block_calls, (unsigned long long)perf->read_blocks_calls,
+           (unsigned long long)perf->read_async_calls, (unsigned long long)perf->read_async_peak,
+           (unsigned long long)perf->bytes_read, perf->io_time / 1e6);
+    printf("\"pattern\":{\"calls\":%llu,\"sequential\":%llu,\"injected_ms\":%.3f},",
+           (unsigned long long)res->io_calls, (unsigned long long)res->io_sequential, res->io_delay_ns / 1e6);
+    printf("\"driver\":{");
+    for (i = 0; i < (int)res->driver_count; i++)
+        printf("%s\"%s\":%llu", i ? "," : "", res->driver[i].name,
+               (unsigned long long)res->driver[i].value);
+    printf("},");
+    printf("\"bcache\":{\"hits\":%llu,\"misses\":%llu},\"get_extent\":%llu,\"dir_lookup\":%llu,\"dnodes\":%llu}\n",
+           (unsigned long long)hits, (unsigned long long)misses,
+           (unsigned long long)perf->get_extent_calls, (unsigned long long)perf->dir_lookup_calls,
+           (unsigned long long)perf->dnodes_created);
+    fflush(stdout);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: fswbench [options] <image>\n"
+            "  -t type     file system driver (default: first one that mounts)\n"
+            "  -w list     comma-separated workloads: mount,walk,lookup,seqread,randread,\n"
+            "              smallfiles,largefiles\n"
+            "  -n runs     runs per workload (default 3)\n"
+            "  -l count    random lookups or reads per run (default 1000)\n"
+            "  -m count    mounts per run of the mount workload (default 10)\n"
+            "  -s seed     seed for the lookup sequence (default 1)\n"
+            "  -c bytes    read size for file reads (default 65536)\n"
+            "  -S bytes    largest file read by smallfiles (default 65536)\n"
+            "  -b bytes    smallest file read by largefiles (default 1048576)\n"
+            "  -D          disable the host's multi-block reads (readahead and direct reads)\n"
+            "  -Q threads  worker threads for asynchronous reads, 0 disables them (default 4)\n"
+            "  -L usec     simulated disk latency per read call\n"
+            "  -B MB/s     simulated disk bandwidth\n"
+            "  -T file     log every read call to file\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *pvol;
+    struct bench_result scan, res;
+    struct fsw_posix_io_model io_model;
+    const char          *opt_type = NULL, *opt_workloads = "mount,walk,lookup,seqread,randread,smallfiles,largefiles";
+    const char          *p;
+    size_t              len;
+    fsw_u32             run;
+    int                 c, i;
+
+    memset(&io_model, 0, sizeof (io_model));
+    io_model.io_threads = 4;
+    while ((c = getopt(argc, argv, "t:w:n:l:m:s:c:S:b:DQ:L:B:T:")) != -1) {
+        switch (c) {
+            case 't': opt_type = optarg; break;
+            case 'w': opt_workloads = optarg; break;
+            case 'n': opt_runs = strtoul(optarg, NULL, 0); break;
+            case 'l': opt_lookups = strtoul(optarg, NULL, 0); break;
+            case 'm': opt_mounts = strtoul(optarg, NULL, 0); break;
+            case 's': opt_seed = strtoul(optarg, NULL, 0); break;
+            case 'c': opt_chunk = strtoul(optarg, NULL, 0); break;
+            case 'S': opt_small = strtoull(optarg, NULL, 0); break;
+            case 'b': opt_large = strtoull(optarg, NULL, 0); break;
+            case 'D': fsw_posix_host_table.read_blocks = NULL; break;
+            case 'Q': io_model.io_threads = strtoul(optarg, NULL, 0); break;
+            case 'L': io_model.latency_us = strtoul(optarg, NULL, 0); break;
+            case 'B': io_model.bandwidth = (fsw_u64)(strtod(optarg, NULL) * 1024 * 1024); break;
+            case 'T':
+                io_model.trace = fopen(optarg, "w");
+                if (io_model.trace == NULL) {
+                    fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1 || opt_chunk == 0)
+        usage();
+    image_path = argv[optind];
+    fsw_posix_set_io_model(&io_model);
+
+    read_buffer = malloc(opt_chunk);
+    if (read_buffer == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    // pick the driver
+    pvol = NULL;
+    for (i = 0; fstypes[i] != NULL; i++) {
+        if (opt_type != NULL && (strlen(opt_type) != (size_t)fstypes[i]->name.size ||
+                                 memcmp(opt_type, fstypes[i]->name.data, fstypes[i]->name.size) != 0))
+            continue;
+        pvol = fsw_posix_mount(image_path, fstypes[i]);
+        if (pvol != NULL)
+            break;
+    }
+    if (pvol == NULL) {
+        fprintf(stderr, "No driver could mount %s.\n", image_path);
+        return 1;
+    }
+    fstype = fstypes[i];
+
+    // collect the objects on the volume
+    memset(&scan, 0, sizeof (scan));
+    walk_dir(pvol, "/", &scan, 1);
+    fsw_posix_unmount(pvol);
+    free(scan.lat);
+    fprintf(stderr, "%.*s: %u objects\n", fstype->name.size, (char *)fstype->name.data, entry_count);
+
+    // run the selected workloads
+    for (p = opt_workloads; *p; p += len + (p[len] == ',')) {
+        len = strcspn(p, ",");
+        for (i = 0; workloads[i].name != NULL; i++) {
+            if (strlen(workloads[i].name) == len && memcmp(workloads[i].name, p, len) == 0)
+                break;
+        }
+        if (workloads[i].name == NULL) {
+            fprintf(stderr, "Unknown workload %.*s.\n", (int)len, p);
+            return 1;
+        }
+        for (run = 1; run <= opt_runs; run++) {
+            memset(&res, 0, sizeof (res));
+            workloads[i].run(&res);
+            report(workloads[i].name, run, &res);
+            free(res.lat);
+        }
+    }
+
+    for (run = 0; run < entry_count; run++)
+        free(entries[run].path);
+    free(entries);
+    free(read_buffer);
+    if (io_model.trace != NULL)
+        fclose(io_model.trace);
+    return 0;
+}
+
+// EOF
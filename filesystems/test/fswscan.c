@@ -0,0 +1,322 @@
+/**
+ * \file fswscan.c
+ * Parallel scan of many disk images, one volume per thread.
+ */
+
+/*
+ * Copyright (c) 2006 Christoph Pfisterer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ *  * Neither the name of Christoph Pfisterer nor the names of the
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Mounts each image given on the command line, walks its whole tree and reads
+ * every regular file, hashing names and contents. A pool of worker threads
+ * takes the images in turn; every volume is mounted, used and unmounted by a
+ * single thread, as the FSW core requires. One JSON object per image is written
+ * to stdout in command line order, and a summary to stderr.
+ */
+
+#include "fsw_posix.h"
+
+#include <unistd.h>
+
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(ext2);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(ext4);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(btrfs);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(reiserfs);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(hfs);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(iso9660);
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(ntfs);
+
+/** Drivers in the order they are tried when no type is given. */
+static struct fsw_fstype_table *fstypes[] = {
+    &FSW_FSTYPE_TABLE_NAME(ext2),
+    &FSW_FSTYPE_TABLE_NAME(ext4),
+    &FSW_FSTYPE_TABLE_NAME(btrfs),
+    &FSW_FSTYPE_TABLE_NAME(reiserfs),
+    &FSW_FSTYPE_TABLE_NAME(hfs),
+    &FSW_FSTYPE_TABLE_NAME(iso9660),
+    &FSW_FSTYPE_TABLE_NAME(ntfs),
+    NULL
+};
+
+/** Size of the buffer each worker reads file data into. */
+#define SCAN_BUFFER_SIZE (256 * 1024)
+
+/**
+ * Result of scanning one image.
+ */
+
+struct scan_result {
+    const char          *path;          //!< Image file name
+    struct fsw_fstype_table *fstype;    //!< Driver that mounted the image, NULL if none did
+    fsw_u64             dirs;           //!< Directories walked
+    fsw_u64             files;          //!< Regular files read
+    fsw_u64             bytes;          //!< File data read
+    fsw_u64             errors;         //!< Objects that could not be opened or read
+    fsw_u64             hash;           //!< FNV-1a over all names and file contents
+    double              seconds;        //!< Time from mount to unmount
+};
+
+/**
+ * Per-thread scan state.
+ */
+
+struct scan_worker {
+    pthread_t           thread;
+    char                *buffer;        //!< SCAN_BUFFER_SIZE bytes for file data
+};
+
+static int                  opt_read = 1;
+static struct scan_result   *results;
+static fsw_u32              result_count;
+static fsw_u32              next_image;
+static pthread_mutex_t      next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static fsw_u64 fnv_add(fsw_u64 hash, const void *data, size_t len)
+{
+    const fsw_u8        *p = data;
+
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void scan_file(struct fsw_posix_volume *pvol, const char *path, struct scan_result *res, char *buffer)
+{
+    struct fsw_posix_file *file;
+    ssize_t             len;
+
+    file = fsw_posix_open(pvol, path, 0, 0);
+    if (file == NULL) {
+        res->errors++;
+        return;
+    }
+    while ((len = fsw_posix_read(file, buffer, SCAN_BUFFER_SIZE)) > 0) {
+        res->hash = fnv_add(res->hash, buffer, len);
+        res->bytes += len;
+    }
+    if (len < 0)
+        res->errors++;
+    fsw_posix_close(file);
+    res->files++;
+}
+
+static void scan_dir(struct fsw_posix_volume *pvol, const char *path, struct scan_result *res, char *buffer)
+{
+    struct fsw_posix_dir *dir;
+    struct dirent       *dent;
+    char                **children = NULL;
+    int                 *types = NULL;
+    fsw_u32             child_count = 0, i;
+    char                child[4096];
+
+    dir = fsw_posix_opendir(pvol, path);
+    if (dir == NULL) {
+        res->errors++;
+        return;
+    }
+    res->dirs++;
+    while ((dent = fsw_posix_readdir(dir)) != NULL) {
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+        res->hash = fnv_add(res->hash, dent->d_name, strlen(dent->d_name) + 1);
+        if (dent->d_type != DT_DIR && (dent->d_type != DT_REG || !opt_read))
+            continue;
+        snprintf(child, sizeof (child), "%s%s%s", path, dent->d_name, dent->d_type == DT_DIR ? "/" : "");
+        children = realloc(children, (child_count + 1) * sizeof (char *));
+        types = realloc(types, (child_count + 1) * sizeof (int));
+        types[child_count] = dent->d_type;
+        children[child_count++] = strdup(child);
+    }
+    fsw_posix_closedir(dir);
+
+    // visit the children after closing the directory, so that only one is open per level
+    for (i = 0; i < child_count; i++) {
+        if (types[i] == DT_DIR)
+            scan_dir(pvol, children[i], res, buffer);
+        else
+            scan_file(pvol, children[i], res, buffer);
+        free(children[i]);
+    }
+    free(children);
+    free(types);
+}
+
+static void scan_image(struct scan_result *res, char *buffer)
+{
+    struct fsw_posix_volume *pvol;
+    double              start;
+
+    start = now_sec();
+    res->hash = 0xcbf29ce484222325ULL;
+    pvol = fsw_posix_mount_any(res->path, fstypes);
+    if (pvol == NULL)
+        return;
+    res->fstype = pvol->vol->fstype_table;
+
+    scan_dir(pvol, "/", res, buffer);
+    fsw_posix_unmount(pvol);
+    res->seconds = now_sec() - start;
+}
+
+static void *scan_thread(void *arg)
+{
+    struct scan_worker  *worker = arg;
+    fsw_u32             index;
+
+    for (;;) {
+        pthread_mutex_lock(&next_lock);
+        index = next_image++;
+        pthread_mutex_unlock(&next_lock);
+        if (index >= result_count)
+            break;
+        scan_image(&results[index], worker->buffer);
+    }
+    return NULL;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: fswscan [options] <image>...\n"
+            "  -j threads  worker threads (default: number of CPUs)\n"
+            "  -t type     file system driver (default: first one that mounts)\n"
+            "  -n          walk the trees only, do not read file data\n"
+            "  -L usec     simulated disk latency per read call\n"
+            "  -B MB/s     simulated disk bandwidth\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct scan_worker  *workers;
+    struct scan_result  *res;
+    struct fsw_posix_io_model io_model;
+    fsw_u32             thread_count, i;
+    fsw_u64             files = 0, bytes = 0, failed = 0;
+    double              start, seconds;
+    int                 c;
+
+    thread_count = (fsw_u32)sysconf(_SC_NPROCESSORS_ONLN);
+    memset(&io_model, 0, sizeof (io_model));
+    io_model.sleep_only = 1;
+    while ((c = getopt(argc, argv, "j:t:nL:B:")) != -1) {
+        switch (c) {
+            case 'j': thread_count = strtoul(optarg, NULL, 0); break;
+            case 't':
+                for (i = 0; fstypes[i] != NULL; i++) {
+                    if (strlen(optarg) == (size_t)fstypes[i]->name.size &&
+                        memcmp(optarg, fstypes[i]->name.data, fstypes[i]->name.size) == 0)
+                        break;
+                }
+                if (fstypes[i] == NULL) {
+                    fprintf(stderr, "Unknown file system type %s.\n", optarg);
+                    return 1;
+                }
+                fstypes[0] = fstypes[i];
+                fstypes[1] = NULL;
+                break;
+            case 'n': opt_read = 0; break;
+            case 'L': io_model.latency_us = strtoul(optarg, NULL, 0); break;
+            case 'B': io_model.bandwidth = (fsw_u64)(strtod(optarg, NULL) * 1024 * 1024); break;
+            default: usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+    if (thread_count == 0)
+        thread_count = 1;
+    fsw_posix_set_io_model(&io_model);
+
+    result_count = argc - optind;
+    results = calloc(result_count, sizeof (struct scan_result));
+    workers = calloc(thread_count, sizeof (struct scan_worker));
+    if (results == NULL || workers == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (i = 0; i < result_count; i++)
+        results[i].path = argv[optind + i];
+
+    start = now_sec();
+    for (i = 0; i < thread_count; i++) {
+        workers[i].buffer = malloc(SCAN_BUFFER_SIZE);
+        if (workers[i].buffer == NULL || pthread_create(&workers[i].thread, NULL, scan_thread, &workers[i]) != 0) {
+            fprintf(stderr, "Cannot start worker thread %u.\n", i);
+            return 1;
+        }
+    }
+    for (i = 0; i < thread_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].buffer);
+    }
+    seconds = now_sec() - start;
+
+    for (i = 0; i < result_count; i++) {
+        res = &results[i];
+        if (res->fstype == NULL) {
+            printf("{\"image\":\"%s\",\"fstype\":null}\n", res->path);
+            failed++;
+            continue;
+        }
+        printf("{\"image\":\"%s\",\"fstype\":\"%.*s\",\"dirs\":%llu,\"files\":%llu,\"bytes\":%llu,"
+               "\"errors\":%llu,\"hash\":\"%016llx\",\"seconds\":%.6f}\n",
+               res->path, res->fstype->name.size, (char *)res->fstype->name.data,
+               (unsigned long long)res->dirs, (unsigned long long)res->files,
+               (unsigned long long)res->bytes, (unsigned long long)res->errors,
+               (unsigned long long)res->hash, res->seconds);
+        files += res->files;
+        bytes += res->bytes;
+    }
+    fprintf(stderr, "%u images (%llu not mounted), %llu files, %llu bytes in %.3f s with %u threads: "
+            "%.1f images/s, %.2f MB/s\n",
+            result_count, (unsigned long long)failed, (unsigned long long)files, (unsigned long long)bytes,
+            seconds, thread_count, seconds > 0 ? result_count / seconds : 0.0,
+            seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0);
+
+    free(results);
+    free(workers);
+    return 0;
+}
+
+// EOF
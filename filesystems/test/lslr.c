@@ -118,7 +118,7 @@ int main(int argc, char **argv)
     for (i = 0; fstypes[i]; i++) {
         vol = fsw_posix_mount(argv[1], fstypes[i]);
         if (vol != NULL) {
-            fprintf(stderr, "Mounted as '%s'.\n", fstypes[i]->name.data);
+            fprintf(stderr, "Mounted as '%s'.\n", (char *)fstypes[i]->name.data);
             break;
         }
     }
@@ -130,6 +130,7 @@ int main(int argc, char **argv)
     listdir(vol, "/boot/", 0);
     catfile(vol, "/boot/testfile.txt");
 
+    fsw_posix_print_stats(vol);
     fsw_posix_unmount(vol);
 
     return 0;
@@ -72,6 +72,7 @@ int main(int argc, char **argv)
         fprintf(stderr, "- %s\n", dent->d_name);
     }
     fsw_posix_closedir(dir);
+    fsw_posix_print_stats(vol);
     fsw_posix_unmount(vol);
 
     return 0;
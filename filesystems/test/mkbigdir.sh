@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+#
+# Build an ext4 image with one large hash-indexed directory, for benchmarking
+# directory lookups with fswbench:
+#
+#   ./mkbigdir.sh bigdir.img 10000 tea
+#   ./fswbench -t ext4 -w lookup -l 20000 bigdir.img
+#
+# Arguments: image file, number of entries in /big (default 10000) and the
+# directory hash (half_md4, tea or legacy; default half_md4). Needs mke2fs,
+# debugfs and e2fsck from e2fsprogs, but no root privileges.
+
+set -e
+
+IMAGE="${1:?usage: $0 image [entries] [hash]}"
+ENTRIES="${2:-10000}"
+HASH="${3:-half_md4}"
+
+TREE="$(mktemp -d)"
+trap 'rm -rf "$TREE"' EXIT
+
+mkdir "$TREE/big"
+for ((i = 1; i <= ENTRIES; i++)); do
+   : > "$TREE/big/file-$i.conf"
+done
+
+rm -f "$IMAGE"
+mke2fs -q -F -t ext4 -d "$TREE" "$IMAGE" $((ENTRIES / 64 + 16))M > /dev/null
+debugfs -w -R "ssv def_hash_version $HASH" "$IMAGE" > /dev/null 2>&1
+
+# mke2fs -d writes directories unindexed; let e2fsck build the htree
+e2fsck -fyD "$IMAGE" > /dev/null 2>&1 || [ $? -le 1 ]
@@ -0,0 +1,394 @@
+#!/usr/bin/env python3
+#
+# Build a small btrfs image from a directory, for testing and benchmarking the
+# btrfs driver with fswscan and fswbench, including layouts that mkfs.btrfs
+# cannot make in a single file without root privileges: compressed extents and
+# RAID5/6 data chunks with missing devices.
+#
+#   ./mkbtrfs.py --raid raid6 --nstripes 5 --missing 2 --chunk 3145728 src degraded.img
+#   ./fswbench -t btrfs -w largefiles,randread degraded.img
+#
+# All members of a RAID5/6 chunk live in the one image file; the first
+# --missing members get device ids the volume does not know, so the driver has
+# to rebuild their stripes from parity on every read. Data chunks must hold a
+# whole number of 64 KiB stripes per data member; metadata is never striped.
+# --compress zstd needs the zstd command line tool, and LZO extents are stored
+# as literal runs. --corrupt replaces the data of the first compressed extents
+# outside the tree with a broken stream; for zlib it is a dynamic block whose
+# code lengths run past the end of the table, which once made the inflate code
+# free a Huffman table twice.
+
+import os, sys, struct, zlib, subprocess, argparse, stat
+
+ap = argparse.ArgumentParser(description='Build a btrfs image from a directory.')
+ap.add_argument('src', help='directory to copy into the image')
+ap.add_argument('img', help='image file to write')
+ap.add_argument('--nodesize', type=int, default=4096, help='tree node size (default 4096)')
+ap.add_argument('--chunk', type=int, default=256 * 1024, help='size of data and metadata chunks (default 256 KiB)')
+ap.add_argument('--compress', default='none', choices=['none', 'zlib', 'lzo', 'zstd'], help='compression of file extents')
+ap.add_argument('--inline-max', type=int, default=2048, help='largest file stored inline in the tree (default 2048)')
+ap.add_argument('--raid', default='', choices=['', 'raid5', 'raid6'], help='profile of the data chunks (default single)')
+ap.add_argument('--nstripes', type=int, default=3, help='members of a RAID5/6 data chunk (default 3)')
+ap.add_argument('--missing', type=int, default=0, help='members of a RAID5/6 data chunk that are missing (default 0)')
+ap.add_argument('--corrupt', type=int, default=0, help='compressed extents outside the tree to replace with a broken stream (default 0)')
+a = ap.parse_args()
+
+SS = 4096
+NS = a.nodesize
+GEN = 7
+
+# crc32c (Castagnoli), raw update without pre/post inversion
+T = []
+for i in range(256):
+    c = i
+    for _ in range(8):
+        c = (c >> 1) ^ 0x82F63B78 if c & 1 else c >> 1
+    T.append(c)
+def crc32c_raw(crc, data):
+    for b in data:
+        crc = (crc >> 8) ^ T[(crc ^ b) & 0xff]
+    return crc
+def name_hash(n):
+    return crc32c_raw(0xfffffffe, n)
+
+def key(o, t, off):
+    return struct.pack('<QBQ', o, t, off)
+
+# ---- physical space and chunks ---------------------------------------------
+img = bytearray()
+def pwrite(off, data):
+    global img
+    if len(img) < off + len(data):
+        img.extend(b'\0' * (off + len(data) - len(img)))
+    img[off:off + len(data)] = data
+
+phys_next = 1 << 20       # first MiB reserved
+chunks = []               # (logical, size, type, stripes[(devid, physoff)], nstripes, nsub, stripe_len)
+log_next = 0x10000000
+
+SYS, DATA, META = 2, 1, 4
+RAID5, RAID6 = 0x80, 0x100
+
+def new_chunk(ctype, size, raid=0):
+    global phys_next, log_next
+    la = log_next
+    log_next += size * 3      # leave gaps
+    if raid:
+        n = a.nstripes
+        npar = 1 if raid == RAID5 else 2
+        # RAID5/6 chunk: size is data bytes; per-stripe length = size / (n - npar)
+        assert size % ((n - npar) * 65536) == 0
+        per = size // (n - npar)
+        stripes = []
+        for i in range(n):
+            devid = 1 if i >= a.missing else 100 + i    # missing members get unknown ids
+            stripes.append((devid, phys_next)); phys_next += per
+        chunks.append(dict(l=la, size=size, type=ctype | raid, stripes=stripes, slen=65536, sub=1))
+    else:
+        chunks.append(dict(l=la, size=size, type=ctype, stripes=[(1, phys_next)], slen=65536, sub=0))
+        phys_next += size
+    return chunks[-1]
+
+def l2p_write(la, data):
+    # write logical range
+    while data:
+        for c in chunks:
+            if c['l'] <= la < c['l'] + c['size']:
+                break
+        else:
+            raise Exception('unmapped %x' % la)
+        off = la - c['l']
+        if c['type'] & (RAID5 | RAID6):
+            # record in raid data map, materialised later
+            n = min(len(data), c['size'] - off)
+            c.setdefault('data', bytearray(c['size']))
+            c['data'][off:off + n] = data[:n]
+        else:
+            n = min(len(data), c['size'] - off)
+            pwrite(c['stripes'][0][1] + off, data[:n])
+        la += n; data = data[n:]
+
+# byte-wise multiplication by x over GF(2^8) with the RAID6 polynomial 0x11d
+MUL2 = bytes(((b << 1) ^ (0x11d if b & 0x80 else 0)) & 0xff for b in range(256))
+
+def xor(x, y):
+    return (int.from_bytes(x, 'little') ^ int.from_bytes(y, 'little')).to_bytes(len(x), 'little')
+
+def materialise_raid(c):
+    n = len(c['stripes']); raid6 = bool(c['type'] & RAID6); npar = 2 if raid6 else 1
+    d = n - npar; sl = c['slen']; buf = c.get('data', bytearray(c['size']))
+    rows = c['size'] // (sl * d)
+    for row in range(rows):
+        # btrfs rotation: data stripe k of row r is on device (r + k) % n
+        cols = [bytes(buf[(row * d + k) * sl:(row * d + k + 1) * sl]) for k in range(d)]
+        P = bytes(sl); Q = bytes(sl)
+        for col in cols:
+            P = xor(P, col)
+        if raid6:
+            # Q = sum x**k * D_k, by Horner from the highest k
+            for col in reversed(cols):
+                Q = xor(Q.translate(MUL2), col)
+        for k in range(d):
+            pwrite(c['stripes'][(row + k) % n][1] + row * sl, cols[k])
+        pwrite(c['stripes'][(row + d) % n][1] + row * sl, P)
+        if raid6:
+            pwrite(c['stripes'][(row + d + 1) % n][1] + row * sl, Q)
+
+# system chunk for the chunk tree
+sys_chunk = new_chunk(SYS, 4 << 20)
+meta_cur = None; meta_used = 0
+def alloc_meta():
+    global meta_cur, meta_used
+    if meta_cur is None or meta_used + NS > meta_cur['size']:
+        meta_cur = new_chunk(META, max(a.chunk, NS)); meta_used = 0
+    la = meta_cur['l'] + meta_used; meta_used += NS
+    return la
+sys_used = 0
+def alloc_sys():
+    global sys_used
+    la = sys_chunk['l'] + sys_used; sys_used += NS
+    assert sys_used <= sys_chunk['size']
+    return la
+
+data_cur = None; data_used = 0
+def alloc_data(n, maxn):
+    """returns (laddr, len) with len <= n, sector aligned"""
+    global data_cur, data_used
+    raid = {'raid5': RAID5, 'raid6': RAID6}.get(a.raid, 0)
+    if data_cur is None or data_used >= data_cur['size']:
+        data_cur = new_chunk(DATA, a.chunk, raid); data_used = 0
+    n = min(n, data_cur['size'] - data_used, maxn)
+    la = data_cur['l'] + data_used; data_used += (n + SS - 1) // SS * SS
+    return la, n
+
+# ---- trees -----------------------------------------------------------------
+HDR = 0x65
+def header(addr, owner, nitems, level):
+    h = bytearray(HDR)
+    struct.pack_into('<QQ', h, 0x30, addr, 1)
+    struct.pack_into('<QQIB', h, 0x50, GEN, owner, nitems, level)
+    return h
+
+def build_tree(items, owner, alloc):
+    """items: sorted list of (keybytes, data). returns root logical addr and level"""
+    # leaves
+    leaves = []  # (firstkey, addr)
+    i = 0
+    while True:
+        addr = alloc()
+        node = bytearray(NS)
+        dataend = NS - HDR
+        n = 0; off = HDR
+        while i < len(items):
+            k, d = items[i]
+            if off + 25 + len(d) > HDR + dataend:
+                break
+            dataend -= len(d)
+            node[HDR + dataend:HDR + dataend + len(d)] = d
+            node[off:off + 25] = k + struct.pack('<II', dataend, len(d))
+            off += 25; n += 1; i += 1
+        assert n > 0 or not items, 'item too large'
+        node[0:HDR] = header(addr, owner, n, 0)
+        l2p_write(addr, bytes(node))
+        leaves.append((items[i - n][0] if n else key(0, 0, 0), addr))
+        if i >= len(items):
+            break
+    level = 0
+    nodes = leaves
+    per = (NS - HDR) // 33
+    while len(nodes) > 1:
+        level += 1
+        up = []
+        for j in range(0, len(nodes), per):
+            grp = nodes[j:j + per]
+            addr = alloc()
+            node = bytearray(NS)
+            node[0:HDR] = header(addr, owner, len(grp), level)
+            off = HDR
+            for k, ca in grp:
+                node[off:off + 33] = k + struct.pack('<QQ', ca, GEN); off += 33
+            l2p_write(addr, bytes(node))
+            up.append((grp[0][0], addr))
+        nodes = up
+    return nodes[0][1], level
+
+# ---- file system tree --------------------------------------------------------
+fs_items = []
+def inode_item(st_mode, size, nbytes, nlink):
+    b = bytearray(0xa0)
+    struct.pack_into('<QQQQQIIIIQQQ', b, 0, GEN, GEN, size, nbytes, 0, nlink, 0, 0, st_mode, 0, 0, 1)
+    return bytes(b)
+
+def dir_item(child, ctype, name, t=1):
+    return key(child, t, 0) + struct.pack('<QHHB', GEN, 0, len(name), ctype) + name
+
+COMP = {'none': 0, 'zlib': 1, 'lzo': 2, 'zstd': 3}[a.compress]
+
+def lzo_literal(data):
+    # LZO1X stream made of a single literal run followed by the end marker
+    n = len(data); out = bytearray()
+    if n <= 238 and n >= 4:
+        out.append(17 + n)
+    else:
+        # "0000LLLL" literal run with zero-extension
+        if n - 3 <= 15:
+            out.append(n - 3)
+        else:
+            out.append(0); r = n - 18
+            while r > 255: out.append(0); r -= 255
+            out.append(r)
+    out += data
+    out += b'\x11\x00\x00'
+    return bytes(out)
+
+def compress(data):
+    if COMP == 1:
+        return zlib.compress(data, 6)
+    if COMP == 3:
+        return subprocess.run(['zstd', '-q', '-c', '-3', '--no-check', '--zstd=wlog=17'], input=data, stdout=subprocess.PIPE, check=True).stdout
+    if COMP == 2:
+        out = bytearray(4)
+        for i in range(0, len(data), SS):
+            seg = lzo_literal(data[i:i + SS])
+            # a segment header must not straddle a page boundary
+            pos = len(out)
+            if (pos % SS) > SS - 4:
+                out += b'\0' * (SS - pos % SS)
+            out += struct.pack('<I', len(seg)) + seg
+        struct.pack_into('<I', out, 0, len(out))
+        return bytes(out)
+
+# zlib header, then a dynamic block whose code length codes repeat past nl + nd
+BAD_ZLIB = bytes.fromhex('7801050082e0ff1f')
+corrupt_left = a.corrupt
+
+def extent_regular(la, disk_len, off, num, ram, comp):
+    return struct.pack('<QQBBHB', GEN, ram, comp, 0, 0, 1) + struct.pack('<QQQQ', la, disk_len, off, num)
+
+def extent_inline(data, ram, comp):
+    return struct.pack('<QQBBHB', GEN, ram, comp, 0, 0, 0) + data
+
+next_ino = 257
+def add_file(ino, path):
+    global corrupt_left
+    data = open(path, 'rb').read()
+    size = len(data)
+    nbytes = 0
+    if size == 0:
+        pass
+    elif size <= a.inline_max:
+        if COMP:
+            z = compress(data)
+            fs_items.append((key(ino, 0x6c, 0), extent_inline(z, size, COMP)))
+        else:
+            fs_items.append((key(ino, 0x6c, 0), extent_inline(data, size, 0)))
+    else:
+        pos = 0
+        while pos < size:
+            if COMP:
+                n = min(128 * 1024, size - pos)
+                raw = data[pos:pos + n]
+                rawp = raw + b'\0' * ((-len(raw)) % SS)
+                z = compress(rawp)
+                if corrupt_left > 0:
+                    corrupt_left -= 1
+                    z = (BAD_ZLIB if COMP == 1 else b'\xff' * 8) + b'\0' * (len(z) - 8)
+                la, got = alloc_data(len(z), len(z))
+                if got < len(z):
+                    # does not fit into this chunk, start a new one
+                    global data_used
+                    data_used = data_cur['size']
+                    la, got = alloc_data(len(z), len(z))
+                l2p_write(la, z)
+                fs_items.append((key(ino, 0x6c, pos), extent_regular(la, (len(z) + SS - 1) // SS * SS, 0, len(rawp), len(rawp), COMP)))
+                pos += n; nbytes += len(rawp)
+            else:
+                la, n = alloc_data(size - pos, 1 << 20)
+                chunk = data[pos:pos + n]
+                l2p_write(la, chunk)
+                num = (n + SS - 1) // SS * SS
+                # describe the extent as part of a larger one with an offset, as btrfs does after CoW
+                fs_items.append((key(ino, 0x6c, pos), extent_regular(la, num, 0, num, num, 0)))
+                pos += n; nbytes += num
+    fs_items.append((key(ino, 1, 0), inode_item(stat.S_IFREG | 0o644, size, nbytes, 1)))
+
+def add_dir(ino, path, parent):
+    global next_ino
+    ents = sorted(os.listdir(path))
+    dirsize = 0
+    byhash = {}
+    for idx, name in enumerate(ents, 2):
+        p = os.path.join(path, name)
+        nb = name.encode()
+        child = next_ino; next_ino += 1
+        st = os.lstat(p)
+        if stat.S_ISDIR(st.st_mode):
+            t = 2; add_dir(child, p, ino)
+        elif stat.S_ISLNK(st.st_mode):
+            t = 7
+            tgt = os.readlink(p).encode()
+            fs_items.append((key(child, 0x6c, 0), extent_inline(tgt, len(tgt), 0)))
+            fs_items.append((key(child, 1, 0), inode_item(stat.S_IFLNK | 0o777, len(tgt), len(tgt), 1)))
+        else:
+            t = 1; add_file(child, p)
+        fs_items.append((key(child, 12, ino), struct.pack('<QH', idx, len(nb)) + nb))
+        di = dir_item(child, t, nb)
+        h = name_hash(nb)
+        byhash[h] = byhash.get(h, b'') + di
+        fs_items.append((key(ino, 0x60, idx), di))
+        dirsize += 2 * len(nb)
+    for h, d in byhash.items():
+        fs_items.append((key(ino, 0x54, h), d))
+    fs_items.append((key(ino, 1, 0), inode_item(stat.S_IFDIR | 0o755, dirsize, 0, 1)))
+
+add_dir(256, a.src, 256)
+fs_items.append((key(256, 12, 256), struct.pack('<QH', 0, 2) + b'..'))
+fs_items.sort(key=lambda kv: struct.unpack('<QBQ', kv[0]))
+fs_root, fs_level = build_tree(fs_items, 5, alloc_meta)
+
+# root tree: ROOT_ITEM for the fs tree
+ri = bytearray(439)
+ri[0:0xa0] = inode_item(stat.S_IFDIR | 0o755, 3, 0, 1)
+struct.pack_into('<QQQ', ri, 0xa0, GEN, 256, fs_root)
+struct.pack_into('B', ri, 0xee, fs_level)
+root_items = [(key(5, 0x84, 0), bytes(ri))]
+root_root, root_level = build_tree(root_items, 1, alloc_meta)
+
+# chunk tree in the system chunk; chunk list is final now
+def chunk_item(c):
+    b = struct.pack('<QQQQIIIHH', c['size'], 2, c['slen'], c['type'], SS, SS, SS, len(c['stripes']), c['sub'])
+    for devid, po in c['stripes']:
+        b += struct.pack('<QQ', devid, po) + b'\0' * 16
+    return b
+
+chunk_items = []
+dev_item = struct.pack('<QQQIII', 1, 0, 0, SS, SS, SS) + b'\0' * (0x62 - 0x24)
+chunk_items.append((key(1, 0xd8, 1), dev_item))
+for c in sorted(chunks, key=lambda c: c['l']):
+    chunk_items.append((key(0x100, 0xe4, c['l']), chunk_item(c)))
+chunk_root, chunk_level = build_tree(chunk_items, 3, alloc_sys)
+
+for c in chunks:
+    if c['type'] & (RAID5 | RAID6):
+        materialise_raid(c)
+
+# superblock
+total = max(len(img), phys_next)
+sb = bytearray(4096)
+sb[0x20:0x30] = b'\x11' * 16
+struct.pack_into('<Q', sb, 0x30, 0x10000)
+sb[0x40:0x48] = b'_BHRfS_M'
+struct.pack_into('<QQQ', sb, 0x48, GEN, root_root, chunk_root)
+nd = 1 + (1 if a.missing else 0)
+struct.pack_into('<QQQQII', sb, 0x70, total, total // 2, 6, nd, SS, NS)
+struct.pack_into('<I', sb, 0x98, NS)
+sysarr = key(0x100, 0xe4, sys_chunk['l']) + chunk_item(sys_chunk)
+struct.pack_into('<I', sb, 0xa0, len(sysarr))
+struct.pack_into('<BB', sb, 0xc6, root_level, chunk_level)
+struct.pack_into('<QQ', sb, 0xc9, 1, total)
+sb[0x32b:0x32b + len(sysarr)] = sysarr
+pwrite(0x10000, bytes(sb))
+if len(img) < total:
+    img.extend(b'\0' * (total - len(img)))
+open(a.img, 'wb').write(img)
+print('%s: %d chunks, %d bytes' % (a.img, len(chunks), len(img)), file=sys.stderr)
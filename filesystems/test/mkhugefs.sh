@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+#
+# Build a sparse ext4 image of several terabytes, for benchmarking mount time
+# with fswbench:
+#
+#   ./mkhugefs.sh huge.img 8T
+#   ./fswbench -t ext4 -w mount -m 10 huge.img
+#
+# Arguments: image file, size (default 8T; the file system holding the image
+# must allow sparse files that large) and an optional directory to copy into
+# the image. The image uses the 64bit and meta_bg layouts and takes up only a
+# few tens of MB on disk. Needs mke2fs from e2fsprogs, but no root privileges.
+
+set -e
+
+IMAGE="${1:?usage: $0 image [size] [source-dir]}"
+SIZE="${2:-8T}"
+SOURCE="${3:-}"
+
+rm -f "$IMAGE"
+truncate -s "$SIZE" "$IMAGE"
+mke2fs -q -F -t ext4 -O 64bit,meta_bg,^resize_inode \
+   -E lazy_itable_init=1,lazy_journal_init=1 ${SOURCE:+-d "$SOURCE"} "$IMAGE" > /dev/null
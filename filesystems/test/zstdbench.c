@@ -0,0 +1,173 @@
+/**
+ * \file zstdbench.c
+ * Microbenchmark for the zstd decompressor of the btrfs driver.
+ */
+
+/*
+ * Copyright (c) 2006 Christoph Pfisterer
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ *  * Neither the name of Christoph Pfisterer nor the names of the
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Decompresses zstd frames the way the btrfs driver does for compressed
+ * extents, and prints the time per frame for three cases:
+ *
+ *   fresh   - a new workspace for every frame (the driver before it kept one
+ *             per volume)
+ *   reused  - one workspace for all frames, whole frames in one pass
+ *   offset  - one workspace, output starting in the middle of each frame,
+ *             which goes through the streaming decoder
+ *
+ * Each file on the command line must hold one frame of at most 128 KiB, as
+ * btrfs writes them, e.g.
+ *
+ *   split -b 131072 vmlinuz part. && zstd -q --zstd=wlog=17 part.*
+ *   ./zstdbench part.*.zst
+ */
+
+#include "fsw_core.h"
+
+#include <stddef.h>
+#include <time.h>
+
+#define DPRINT(x...)    /* */
+#define fsw_size_t int
+#define fsw_ssize_t int
+#define grub_off_t fsw_s32
+
+#include "fsw_btrfs_zstd.h"
+
+
+#define MAX_FRAMES (4096)
+#define MIN_ROUND_NS (200e6)
+
+static struct {
+    char                *data;
+    fsw_size_t          size;
+    fsw_size_t          content;
+} frames[MAX_FRAMES];
+static int          frame_count;
+static char         out[ZSTD_BTRFS_MAX_INPUT];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int load_frame(const char *path)
+{
+    FILE                *f;
+    ZSTD_frameParams    params;
+    long                size;
+
+    f = fopen(path, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return -1;
+    }
+    rewind(f);
+    // pad to a sector, as the driver reads compressed extents
+    frames[frame_count].size = (fsw_size_t)((size + 511) & ~511L);
+    frames[frame_count].data = calloc(1, frames[frame_count].size);
+    if (frames[frame_count].data == NULL || fread(frames[frame_count].data, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return -1;
+    }
+    fclose(f);
+    if (ZSTD_getFrameParams(&params, frames[frame_count].data, size) != 0
+            || params.frameContentSize == 0 || params.frameContentSize > ZSTD_BTRFS_MAX_INPUT) {
+        fprintf(stderr, "%s: not a zstd frame of at most %d bytes with its content size\n",
+                path, ZSTD_BTRFS_MAX_INPUT);
+        return -1;
+    }
+    frames[frame_count].content = (fsw_size_t)params.frameContentSize;
+    frame_count++;
+    return 0;
+}
+
+static int run(const char *name, int fresh, int offset)
+{
+    void                *workspace = NULL;
+    fsw_u64             count = 0, bytes = 0;
+    fsw_size_t          start, len;
+    double              begin, elapsed;
+    int                 i;
+
+    begin = now_ns();
+    do {
+        for (i = 0; i < frame_count; i++) {
+            start = offset ? frames[i].content / 2 : 0;
+            len = frames[i].content - start;
+            if (zstd_decompress(&workspace, frames[i].data, frames[i].size, start, out, len) != len) {
+                fprintf(stderr, "%s: frame %d failed\n", name, i);
+                return -1;
+            }
+            if (fresh) {
+                FreePool(workspace);
+                workspace = NULL;
+            }
+            bytes += len;
+            count++;
+        }
+        elapsed = now_ns() - begin;
+    } while (elapsed < MIN_ROUND_NS);
+    if (workspace)
+        FreePool(workspace);
+
+    printf("%s\t%.1f\t%.1f\n", name, elapsed / 1e3 / count, bytes / (elapsed / 1e9) / (1024 * 1024));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int                 i;
+
+    if (argc < 2 || argc - 1 > MAX_FRAMES) {
+        fprintf(stderr, "Usage: zstdbench <frame.zst>...\n");
+        return 1;
+    }
+    for (i = 1; i < argc; i++) {
+        if (load_frame(argv[i]))
+            return 1;
+    }
+
+    printf("mode\tus_per_frame\tMB_per_sec\n");
+    if (run("fresh", 1, 0) || run("reused", 0, 0) || run("offset", 0, 1))
+        return 1;
+
+    for (i = 0; i < frame_count; i++)
+        free(frames[i].data);
+    return 0;
+}
+
+// EOF
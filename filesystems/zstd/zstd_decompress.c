@@ -1542,6 +1542,13 @@ static size_t ZSTD_decompressMultiFrame(ZSTD_DCtx *dctx, void *dst, size_t dstCa
 	return (BYTE *)dst - (BYTE *)dststart;
 }
 
+/*! ZSTD_decompressDCtx() :
+*   single-pass decompression of the whole of @src into @dst with an existing @dctx */
+size_t ZSTD_decompressDCtx(ZSTD_DCtx *dctx, void *dst, size_t dstCapacity, const void *src, size_t srcSize)
+{
+	return ZSTD_decompressMultiFrame(dctx, dst, dstCapacity, src, srcSize, NULL, 0);
+}
+
 /***************************************
 *   Advanced Streaming Decompression API
 *   Bufferless and synchronous